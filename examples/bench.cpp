@@ -0,0 +1,119 @@
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <chrono>
+#include <set>
+#include <string>
+#include "orion/database.h"
+
+// Usage: bench_orion [count] [dim] [queries] [k] [prefetch_distance] [huge_pages] [lock_memory]
+// Defaults build 200k x 768-d vectors (~600 MB), larger than a typical LLC,
+// so the graph walk is dominated by memory latency.
+struct BenchParams
+{
+    size_t count = 200000;
+    uint32_t dim = 768;
+    size_t queries = 1000;
+    size_t k = 10;
+    uint32_t prefetch_distance = 4;
+    bool huge_pages = false;
+    bool lock_memory = false;
+};
+
+static BenchParams parse_args(int argc, char **argv)
+{
+    BenchParams p;
+    if (argc > 1) p.count = std::strtoull(argv[1], nullptr, 10);
+    if (argc > 2) p.dim = static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (argc > 3) p.queries = std::strtoull(argv[3], nullptr, 10);
+    if (argc > 4) p.k = std::strtoull(argv[4], nullptr, 10);
+    if (argc > 5) p.prefetch_distance = static_cast<uint32_t>(std::strtoul(argv[5], nullptr, 10));
+    if (argc > 6) p.huge_pages = std::strtoul(argv[6], nullptr, 10) != 0;
+    if (argc > 7) p.lock_memory = std::strtoul(argv[7], nullptr, 10) != 0;
+    return p;
+}
+
+static orion::Vector random_vector(uint32_t dim, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    orion::Vector v(dim);
+    for (auto &f : v) f = dist(rng);
+    return v;
+}
+
+template <typename F>
+static double time_ms(F &&f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    const BenchParams p = parse_args(argc, argv);
+    const std::string db_path = "bench.orion";
+    std::remove(db_path.c_str());
+
+    orion::Config cfg(p.dim, p.count);
+    cfg.prefetch_distance = p.prefetch_distance;
+    cfg.huge_pages = p.huge_pages;
+    cfg.lock_memory = p.lock_memory;
+    auto db_opt = orion::Database::create(db_path, cfg);
+    if (!db_opt) {
+        std::cerr << "Cannot create DB\n";
+        return 1;
+    }
+    auto db = std::move(*db_opt);
+
+    std::mt19937 rng(42);
+    double insert_ms = time_ms([&] {
+        for (size_t i = 0; i < p.count; ++i)
+            db.add(i, random_vector(p.dim, rng), {{"bucket", int64_t(i % 100)}});
+    });
+    std::cout << "dim=" << p.dim << " count=" << p.count << " prefetch_distance=" << p.prefetch_distance
+              << " huge_pages=" << p.huge_pages << " lock_memory=" << p.lock_memory << "\n";
+    std::cout << "insert: " << insert_ms << " ms\n";
+
+    std::vector<orion::Vector> queries;
+    for (size_t i = 0; i < p.queries; ++i) queries.push_back(random_vector(p.dim, rng));
+
+    std::vector<std::vector<orion::QueryResult>> graph_results(p.queries);
+    double graph_ms = time_ms([&] {
+        for (size_t i = 0; i < p.queries; ++i) graph_results[i] = db.query(queries[i], p.k);
+    });
+    std::cout << "graph query: " << (p.queries * 1000.0 / graph_ms) << " QPS\n";
+
+    double layout_ms = time_ms([&] { db.optimize_layout(); });
+    double relabeled_ms = time_ms([&] {
+        for (size_t i = 0; i < p.queries; ++i) db.query(queries[i], p.k);
+    });
+    std::cout << "optimize_layout: " << layout_ms << " ms, graph query after: "
+              << (p.queries * 1000.0 / relabeled_ms) << " QPS\n";
+
+    double filtered_ms = time_ms([&] {
+        for (size_t i = 0; i < p.queries; ++i) db.query(queries[i], p.k, {{"bucket", int64_t(i % 100)}});
+    });
+    std::cout << "filtered query (1%): " << (p.queries * 1000.0 / filtered_ms) << " QPS\n";
+
+    orion::QueryOptions exact;
+    exact.strategy = orion::SearchStrategy::Exact;
+    const size_t exact_queries = std::min<size_t>(p.queries, 100);
+    size_t hits = 0;
+    double exact_ms = time_ms([&] {
+        for (size_t i = 0; i < exact_queries; ++i) {
+            auto truth = db.query(queries[i], p.k, {}, exact);
+            std::set<orion::VectorId> ids;
+            for (const auto &r : truth) ids.insert(r.id);
+            for (const auto &r : graph_results[i]) hits += ids.count(r.id);
+        }
+    });
+    std::cout << "exact scan: " << (exact_queries * 1000.0 / exact_ms) << " QPS\n";
+    std::cout << "graph recall@" << p.k << ": " << double(hits) / double(exact_queries * p.k) << "\n";
+
+    std::remove(db_path.c_str());
+    return 0;
+}
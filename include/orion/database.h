@@ -3,39 +3,266 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 #include <variant>
 #include <map>
 #include <optional>
+#include <functional>
+#include <span>
 
 namespace orion {
 
 using VectorId = uint64_t;
 using Vector = std::vector<float>;
+// packed bits for ElementType::Binary; component i is bit (i % 8) of byte i / 8
+using BitVector = std::vector<std::byte>;
 using MetadataValue = std::variant<int64_t, double, std::string>;
 using Metadata = std::map<std::string, MetadataValue>;
 
+// which search path produced a query result
+enum class SearchPath : uint8_t
+{
+    Graph,      // single HNSW pass
+    GraphRetry, // HNSW re-run with a larger ef after a short filtered result
+    ExactScan,  // brute-force scan over the filter candidates
+    Quantized,  // quantized-code scan with exact rerank
+    InvertedFile // scan of the nprobe closest IVF lists
+};
+
 struct QueryResult
 {
     VectorId id;
     float distance;
+    SearchPath path = SearchPath::Graph;
+};
+
+enum class SearchStrategy : uint8_t
+{
+    Auto,  // exact scan for small filtered candidate sets, graph otherwise
+    Graph, // always walk the HNSW graph
+    Exact, // always scan the candidates (all vectors without a filter), at full dimension when a projection is active
+    // scan the candidates' anisotropic PQ codes and rerank the best exactly;
+    // falls back to Exact until train_quantizer() has run
+    Quantized
+};
+
+struct QueryOptions
+{
+    SearchStrategy strategy = SearchStrategy::Auto;
+    // score only the first prefix_dim components (Matryoshka embeddings;
+    // 0 = all), then rerank the best n * prefix_rerank_factor on all of them
+    uint32_t prefix_dim = 0;
+    uint32_t prefix_rerank_factor = 4;
+    // IVF lists to scan (IndexType::IVF; 0 = Config::ivf_nprobe)
+    uint32_t nprobe = 0;
+    // HNSW candidate list size (0 = Config::ef_search)
+    uint32_t ef = 0;
+};
+
+// storage type of vector components
+enum class ElementType : uint8_t
+{
+    Float32,
+    Int8, // quantized embeddings, added and queried through the int8_t overloads
+    UInt8, // quantized embeddings, added and queried through the uint8_t overloads
+    Binary // bit vectors (hashes, binary embeddings) compared by Hamming distance;
+           // vector_dim counts bits, added and queried as packed std::byte spans
+};
+
+enum class Metric : uint8_t
+{
+    L2,          // squared euclidean distance
+    InnerProduct // 1 - dot product
+};
+
+// dimensionality reduction applied before vectors reach the graph
+enum class Projection : uint8_t
+{
+    None,
+    PCA,             // learned from the stored vectors by train_projection()
+    RandomOrthogonal // drawn at create(), no training needed
+};
+
+// how the vectors are indexed for approximate search
+enum class IndexType : uint8_t
+{
+    HNSW,
+    IVF // k-means inverted lists, no graph links
 };
 
 struct Config
 {
     uint32_t vector_dim = 0;
+    ElementType element_type = ElementType::Float32;
+    Metric metric = Metric::L2; // ignored for ElementType::Binary
+    // name of a metric registered with register_metric() (orion/metric.h);
+    // overrides metric, float vectors only
+    std::string custom_metric;
+    // anisotropic product quantization for float InnerProduct databases:
+    // pq_subspaces 4-bit codes per vector (0 disables), trained on the stored
+    // vectors by train_quantizer(). pq_threshold is the score, relative to a
+    // vector's norm, whose neighborhood the codes are most accurate for;
+    // SearchStrategy::Quantized reranks n * pq_rerank_factor codes exactly.
+    uint32_t pq_subspaces = 0;
+    float pq_threshold = 0.2f;
+    uint32_t pq_rerank_factor = 10;
+    // build and search the graph (and scans) on float vectors projected to
+    // projected_dim < vector_dim; add() and query() inputs are projected
+    // automatically, full vectors are kept, and the best
+    // n * projection_rerank_factor candidates are reranked at full dimension.
+    // Not combinable with custom metrics or the PQ quantizer.
+    Projection projection = Projection::None;
+    uint32_t projected_dim = 0;
+    uint32_t projection_rerank_factor = 4;
+    // IndexType::IVF drops the graph: k-means partitions the vectors into
+    // ivf_lists contiguous lists (0 = about sqrt(count)) and queries scan the
+    // nprobe lists with the closest centroids. Lists are trained once
+    // ivf_train_size vectors are stored and retrained whenever the count has
+    // doubled since (or by train_ivf()); until then queries scan everything
+    // and adds go to the nearest list. ivf_sq8 stores one byte per component
+    // and reranks n * ivf_rerank_factor exactly. Float vectors with a
+    // built-in metric only, without PQ or projection.
+    IndexType index_type = IndexType::HNSW;
+    uint32_t ivf_lists = 0;
+    uint32_t ivf_nprobe = 8;
+    uint64_t ivf_train_size = 1024;
+    bool ivf_sq8 = false;
+    uint32_t ivf_rerank_factor = 4;
     uint64_t max_elements = 1000000; // default max elements for HNSW index
+    // HNSW search candidate list size (at least n per query); 0 = the hnswlib
+    // default of 10. Set by Database::autotune().
+    uint32_t ef_search = 0;
+    // metadata keys that get a per-value HNSW entry point; filtered queries on
+    // these keys start the graph walk inside the matching partition
+    std::vector<std::string> entry_point_keys;
+    // a filtered graph pass scores at most about ef * 2M nodes; queries
+    // returning fewer than min(n, candidates) hits are re-run with ef
+    // multiplied by filter_retry_factor up to filter_max_ef, then answered by
+    // an exact scan over the candidates
+    uint32_t filter_retry_factor = 4;
+    uint64_t filter_max_ef = 1024;
+    // filters leaving at most this many candidates are answered by an exact
+    // scan instead of a graph walk (SearchStrategy::Auto)
+    uint64_t exact_scan_threshold = 2048;
+    // how many neighbors ahead the graph search prefetches link lists and
+    // vectors while scoring the current ones (0 disables prefetching)
+    uint32_t prefetch_distance = 4;
+    // run optimize_layout() before every save()
+    bool optimize_layout_on_save = false;
+    // back graph and vector memory with 2M transparent huge pages (Linux)
+    bool huge_pages = false;
+    // pin graph and vector memory with mlock so queries never page-fault;
+    // needs RLIMIT_MEMLOCK >= max_elements worth of graph memory.
+    // Neither is saved: load() takes them from LoadOptions.
+    bool lock_memory = false;
+    // drop the stored copy of each vector and its metadata from memory: they
+    // stay in the DB file and are read with pread when needed (reranking
+    // projected results, get(), rebuilds), through an LRU of
+    // tiered_cache_size records. Vectors added since the last save() stay
+    // in memory until it. The graph's level-0 memory still holds the vectors
+    // it indexes, so only with a projection (or int8/binary elements) is the
+    // resident copy smaller than the full fp32 vectors. HNSW only.
+    bool tiered_storage = false;
+    uint32_t tiered_cache_size = 4096;
+    // once removed vectors that no repair pass has cleared reach this
+    // fraction of the graph nodes, a repair pass starts and remove() advances
+    // it a slice at a time (see repair_graph(); 0 = never automatically)
+    float repair_threshold = 0.1f;
 
     Config() = default;
     Config(uint32_t dim, uint64_t max_elems = 1000000) : vector_dim(dim), max_elements(max_elems) {}
 };
 
+// construction settings for Database::build_disk_index() (orion/disk_index.h)
+struct DiskIndexConfig
+{
+    uint32_t max_degree = 32;      // Vamana out-degree R
+    uint32_t build_list_size = 64; // candidate list L while building
+    float alpha = 1.2f;            // pruning slack of the second pass; > 1 keeps long edges
+    // bytes of the in-memory PQ code per vector (256 centroids per byte);
+    // 0 = vector_dim / 4
+    uint32_t pq_bytes = 0;
+};
+
+// result of Database::cluster(); assignments[i] is the index in centroids of
+// the cluster that ids[i] belongs to
+struct Clustering
+{
+    std::vector<Vector> centroids;
+    std::vector<VectorId> ids;
+    std::vector<uint32_t> assignments;
+};
+
+// sizes of the value -> ids lists of one metadata key
+struct PostingStats
+{
+    uint64_t values = 0; // distinct values, one list each
+    uint64_t total = 0;  // ids over all lists
+    uint64_t smallest = 0;
+    uint64_t largest = 0;
+    // size_histogram[b]: lists holding 2^b .. 2^(b+1) - 1 ids
+    std::vector<uint64_t> size_histogram;
+};
+
+// returned by Database::stats() and Database::inspect(); the graph figures
+// stay empty for IndexType::IVF
+struct IndexStats
+{
+    uint64_t vectors = 0;     // stored vectors
+    uint64_t graph_nodes = 0; // HNSW slots in use, removed vectors included
+    uint64_t tombstones = 0;  // removed vectors still in the graph
+    double tombstone_fraction = 0.0;
+    uint64_t unreachable = 0; // live nodes no walk from the entry point reaches
+    int entry_point_level = -1;
+    uint32_t max_links = 0;   // link capacity above level 0 (M)
+    uint32_t max_links0 = 0;  // link capacity on level 0 (2M)
+    std::vector<uint64_t> level_counts;                   // [l]: nodes whose top level is l
+    std::vector<std::vector<uint64_t>> degree_histograms; // [l][d]: nodes with d links on level l
+    std::vector<uint64_t> ivf_list_sizes;
+    std::map<std::string, PostingStats> postings; // per metadata key
+};
+
+// memory policy of a loaded database (Config::huge_pages / lock_memory);
+// it belongs to the process, not the file
+struct LoadOptions
+{
+    bool huge_pages = false;
+    bool lock_memory = false;
+};
+
+// where Database::import_npy() / import_fvecs() take ids and metadata from
+struct ImportOptions
+{
+    // row i gets id_start + i unless ids_path names a file with one id per
+    // row: a one-dimensional int64/uint64 .npy, or text with one id per line
+    VectorId id_start = 0;
+    std::string ids_path;
+    // JSON Lines, one flat object per row (string, integer, float and boolean
+    // values); an integer "id" in a line overrides that row's id
+    std::string metadata_path;
+};
+
+// called by Database::for_each() for every stored vector; return false to stop
+using RecordVisitor = std::function<bool(VectorId id, const Vector &vec, const Metadata &meta)>;
+
+// receives the neighbors of one source vector during Database::knn_join();
+// calls are serialized but come from the join's worker threads
+using JoinCallback = std::function<void(VectorId id, const std::vector<QueryResult> &neighbors)>;
+
 class Database
 {
 public:
     // create a new database at path (overwrites if exists)
     static std::optional<Database> create(const std::string &path, const Config &config);
     // load an existing database from path
-    static std::optional<Database> load(const std::string &path);
+    static std::optional<Database> load(const std::string &path, const LoadOptions &options = {});
+    // check the file's checksum (format 17 and later), load it and check the
+    // graph links, graph/storage agreement and metadata index; problems are
+    // reported on std::cerr
+    static bool verify(const std::string &path);
+    // stats() of the database file at path, read in one pass without
+    // loading it: records are skipped and only the graph links are kept
+    static std::optional<IndexStats> inspect(const std::string &path);
 
     Database(Database &&other) noexcept;
     Database &operator=(Database &&other) noexcept;
@@ -46,6 +273,18 @@ public:
 
     // add or update a vector with metadata
     bool add(VectorId id, const Vector &vec, const Metadata &meta);
+    // add or update a quantized vector; must match Config::element_type
+    bool add(VectorId id, std::span<const int8_t> vec, const Metadata &meta);
+    bool add(VectorId id, std::span<const uint8_t> vec, const Metadata &meta);
+    bool add(VectorId id, std::span<const std::byte> bits, const Metadata &meta);
+    // add or update many float vectors at once; the graph inserts run in
+    // parallel. metas is empty or one per id.
+    bool add_batch(const std::vector<VectorId> &ids, const std::vector<Vector> &vectors, const std::vector<Metadata> &metas = {});
+    // memory-map a float32 matrix (.npy in C order with shape (rows,
+    // vector_dim), or .fvecs), check its dtype and shape and add every row
+    // as add_batch() does, reading the rows straight from the mapping
+    bool import_npy(const std::string &path, const ImportOptions &options = {});
+    bool import_fvecs(const std::string &path, const ImportOptions &options = {});
 
     // query top-n nearest neighbors (no filter)
     std::vector<QueryResult> query(const Vector &query_vec, size_t n) const;
@@ -53,12 +292,91 @@ public:
     // query top-n nearest neighbors with metadata filter (AND of key=value pairs)
     std::vector<QueryResult> query(const Vector &query_vec, size_t n, const Metadata &filter) const;
 
-    // retrieve raw vector and metadata
+    // query with an explicit search strategy; the filter may be empty
+    std::vector<QueryResult> query(const Vector &query_vec, size_t n, const Metadata &filter, const QueryOptions &options) const;
+
+    // query a quantized database with a query of the same element type
+    std::vector<QueryResult> query(std::span<const int8_t> query_vec, size_t n, const Metadata &filter = {}, const QueryOptions &options = {}) const;
+    std::vector<QueryResult> query(std::span<const uint8_t> query_vec, size_t n, const Metadata &filter = {}, const QueryOptions &options = {}) const;
+    std::vector<QueryResult> query(std::span<const std::byte> query_bits, size_t n, const Metadata &filter = {}, const QueryOptions &options = {}) const;
+
+    // top-n for each of many queries; results[i] answers queries[i]. With
+    // SearchStrategy::Exact on float vectors the whole batch is scored as a
+    // cache-blocked matrix product across threads, otherwise each query runs
+    // through query()
+    std::vector<std::vector<QueryResult>> query_batch(const std::vector<Vector> &queries, size_t n, const Metadata &filter = {}, const QueryOptions &options = {}) const;
+
+    // retrieve vector (converted to float for quantized databases, 0/1 per bit
+    // for binary ones) and metadata
     std::optional<std::pair<Vector, Metadata>> get(VectorId id) const;
 
     // remove a vector by id
     bool remove(VectorId id);
 
+    // every stored vector (as get() returns it) in id order, under the read
+    // lock, so visit must not modify the database
+    void for_each(const RecordVisitor &visit) const;
+
+    // rebuild the graph from the stored vectors, dropping removed ones
+    bool compact();
+
+    // train the anisotropic quantizer on (a sample of) the stored vectors and
+    // encode every vector; needs pq_subspaces > 0, float vectors and
+    // Metric::InnerProduct. Vectors added afterwards are encoded on insert.
+    bool train_quantizer();
+
+    // learn the PCA projection from (a sample of) the stored vectors and
+    // rebuild the graph in projected space; needs Projection::PCA
+    bool train_projection();
+
+    // (re)train the IVF lists on (a sample of) the stored vectors and
+    // redistribute every vector; needs IndexType::IVF
+    bool train_ivf();
+
+    // write the float vectors to an SSD-resident Vamana index at path, opened
+    // with DiskIndex::open(); needs float vectors and a built-in metric
+    bool build_disk_index(const std::string &path, const DiskIndexConfig &config = {}) const;
+
+    // k-means++ seeded Lloyd clustering of the stored float vectors that match
+    // filter (all of them when empty), run across threads: centroids are
+    // trained on up to sample_size of them (0 = all) for at most iterations
+    // rounds, then every matching vector is assigned to its nearest centroid.
+    // L2 geometry whatever the metric; empty on bad arguments.
+    Clustering cluster(size_t k, size_t iterations = 25, size_t sample_size = 0, const Metadata &filter = {}) const;
+
+    // approximate k nearest neighbors in other of every vector stored here,
+    // streamed to on_result as they are found (in no fixed order); pass *this
+    // for a self-join, which leaves each vector out of its own list and
+    // starts each unfiltered graph walk at the source's own node. filter
+    // restricts the neighbors. Sources are visited graph neighborhood by
+    // neighborhood on threads workers (0 = hardware threads). Needs matching
+    // element types and dimensions.
+    bool knn_join(const Database &other, size_t k, const JoinCallback &on_result, const Metadata &filter = {}, size_t threads = 0) const;
+
+    // find the smallest ef whose graph recall@k, over sample_queries stored
+    // vectors held out of their own results, reaches target_recall against an
+    // exact scan; it becomes Config::ef_search (saved with the next save())
+    // and is returned. 0 without an HNSW index or with at most k vectors.
+    uint32_t autotune(float target_recall = 0.95f, size_t k = 10, size_t sample_queries = 200);
+
+    // reconnect live graph nodes whose neighbor lists point at removed
+    // vectors through the removed vectors' own neighbors; runs in slices
+    // that release the write lock, so queries keep running. Returns the
+    // number of neighbor lists rewritten.
+    size_t repair_graph();
+
+    // relabel graph nodes so that neighbors sit close together in memory
+    bool optimize_layout();
+
+    // prefault and cache the hot parts of the index (upper HNSW layers, entry
+    // point neighborhoods up to node_budget nodes, posting lists), then replay
+    // sample_queries; returns the number of graph nodes touched
+    size_t warmup(size_t node_budget, const std::vector<Vector> &sample_queries = {}) const;
+
+    // graph shape (levels, degree histograms, tombstones, unreachable
+    // nodes), IVF list sizes and per-key posting-list sizes
+    IndexStats stats() const;
+
     // number of stored vectors
     size_t count() const;
 
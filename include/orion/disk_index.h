@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "orion/database.h"
+
+namespace orion {
+
+struct DiskQueryOptions
+{
+    uint32_t list_size = 64; // candidate list L; larger is slower and more accurate
+    uint32_t beam_width = 4; // nodes read from disk per hop
+};
+
+// SSD-resident Vamana graph (DiskANN). Each node's full vector and neighbor
+// list share a 4 KiB-aligned sector slot, so expanding a node is one read.
+// Only the PQ codes, the codebook and the entry point stay in memory; the
+// beam search steers by PQ distance and ranks results by the exact
+// distances of the nodes it read.
+class DiskIndex
+{
+public:
+    // open an index written by Database::build_disk_index()
+    static std::optional<DiskIndex> open(const std::string &path);
+
+    DiskIndex(DiskIndex &&other) noexcept;
+    DiskIndex &operator=(DiskIndex &&other) noexcept;
+    ~DiskIndex();
+
+    // top-n nearest neighbors; the query must have dim() components
+    std::vector<QueryResult> query(const Vector &query_vec, size_t n, const DiskQueryOptions &options = {}) const;
+
+    size_t size() const;
+    uint32_t dim() const;
+    // sectors read by queries so far
+    uint64_t sectors_read() const;
+
+private:
+    DiskIndex();
+    class Impl;
+    Impl *pimpl;
+};
+
+} // namespace orion
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace orion {
+
+// what the hnswlib space's dist_func_param points at
+struct MetricParam
+{
+    size_t dim;
+    const void *context;
+};
+
+// type-erased distance entry points, smaller is closer; custom metrics see
+// float vectors of dim components and get their registered functor as context
+struct MetricKernels
+{
+    float (*distance_fn)(const void *a, const void *b, size_t dim, const void *context);
+    // distances from one query to four vectors
+    void (*batch4_fn)(const void *query, const void *const *vectors, size_t dim, float *out, const void *context);
+    // hnswlib space function; the param points at a MetricParam
+    float (*space)(const void *a, const void *b, const void *param);
+    const void *context = nullptr;
+
+    float distance(const void *a, const void *b, size_t dim) const { return distance_fn(a, b, dim, context); }
+    void batch4(const void *query, const void *const *vectors, size_t dim, float *out) const
+    {
+        batch4_fn(query, vectors, dim, out, context);
+    }
+};
+
+namespace detail {
+
+template <typename F>
+float metric_distance(const void *a, const void *b, size_t dim, const void *context)
+{
+    return (*static_cast<const F *>(context))(static_cast<const float *>(a), static_cast<const float *>(b), dim);
+}
+
+// the functor is inlined four times per call, so Orion's search and scan
+// loops pay one indirect call per block of four comparisons
+template <typename F>
+void metric_batch4(const void *query, const void *const *vectors, size_t dim, float *out, const void *context)
+{
+    const F &metric = *static_cast<const F *>(context);
+    const float *q = static_cast<const float *>(query);
+    out[0] = metric(q, static_cast<const float *>(vectors[0]), dim);
+    out[1] = metric(q, static_cast<const float *>(vectors[1]), dim);
+    out[2] = metric(q, static_cast<const float *>(vectors[2]), dim);
+    out[3] = metric(q, static_cast<const float *>(vectors[3]), dim);
+}
+
+template <typename F>
+float metric_space(const void *a, const void *b, const void *param)
+{
+    const MetricParam &p = *static_cast<const MetricParam *>(param);
+    return metric_distance<F>(a, b, p.dim, p.context);
+}
+
+// the registry owns functor; kernels.context points at it
+bool register_metric_kernels(const std::string &name, const MetricKernels &kernels, std::shared_ptr<const void> functor);
+
+} // namespace detail
+
+// Registers F, a copyable functor
+//   float operator()(const float *a, const float *b, size_t dim) const
+// under name, for databases created with Config::custom_metric = name. The
+// name is stored in the file and load() refuses files whose metric is not
+// registered, so version it when the metric's definition changes
+// ("weighted_l2/v2"). Register before create()/load(). Each registration
+// keeps its own copy of metric, so names may share a functor type; databases
+// opened before a name is registered again keep the functor they started
+// with. Returns false if name is empty.
+template <typename F>
+bool register_metric(const std::string &name, F metric = F{})
+{
+    auto functor = std::make_shared<const F>(std::move(metric));
+    const MetricKernels kernels{detail::metric_distance<F>, detail::metric_batch4<F>, detail::metric_space<F>, functor.get()};
+    return detail::register_metric_kernels(name, kernels, std::move(functor));
+}
+
+} // namespace orion
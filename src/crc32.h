@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ORION_CRC32_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace orion
+{
+  // CRC-32C (Castagnoli) of the saved file, checked by Database::verify().
+  // SSE4.2 has an instruction for it; other CPUs use a byte table.
+  namespace crc32c
+  {
+    inline const std::array<uint32_t, 256> &table()
+    {
+      static const std::array<uint32_t, 256> entries = []
+      {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+          uint32_t c = i;
+          for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+          t[i] = c;
+        }
+        return t;
+      }();
+      return entries;
+    }
+
+    inline uint32_t update_scalar(uint32_t crc, const uint8_t *data, size_t size)
+    {
+      const auto &t = table();
+      for (size_t i = 0; i < size; ++i)
+        crc = t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+      return crc;
+    }
+
+#ifdef ORION_CRC32_DISPATCH
+    __attribute__((target("sse4.2"))) inline uint32_t update_sse42(uint32_t crc, const uint8_t *data, size_t size)
+    {
+      size_t i = 0;
+#if defined(__x86_64__)
+      uint64_t wide = crc;
+      for (; i + 8 <= size; i += 8)
+      {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        wide = _mm_crc32_u64(wide, word);
+      }
+      crc = static_cast<uint32_t>(wide);
+#endif
+      for (; i < size; ++i)
+        crc = _mm_crc32_u8(crc, data[i]);
+      return crc;
+    }
+#endif
+
+    // continues a running CRC; start from 0
+    inline uint32_t update(uint32_t crc, const void *data, size_t size)
+    {
+      const uint8_t *bytes = static_cast<const uint8_t *>(data);
+      crc = ~crc;
+#ifdef ORION_CRC32_DISPATCH
+      static const bool sse42 = __builtin_cpu_supports("sse4.2");
+      if (sse42)
+        return ~update_sse42(crc, bytes, size);
+#endif
+      return ~update_scalar(crc, bytes, size);
+    }
+
+    // output buffer in front of another streambuf that keeps the CRC of every
+    // byte passed on, so save() checksums the file as it writes it. Seeking
+    // is limited to tellp().
+    class ostreambuf : public std::streambuf
+    {
+    public:
+      explicit ostreambuf(std::streambuf *sink) : sink_(sink), buffer_(1 << 16)
+      {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+      }
+      ~ostreambuf() override { flush_buffer(); }
+      ostreambuf(const ostreambuf &) = delete;
+      ostreambuf &operator=(const ostreambuf &) = delete;
+
+      // of the bytes passed on so far; flush the stream first
+      uint32_t crc() const { return crc_; }
+
+    protected:
+      int_type overflow(int_type ch) override
+      {
+        if (!flush_buffer())
+          return traits_type::eof();
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+          *pptr() = traits_type::to_char_type(ch);
+          pbump(1);
+        }
+        return traits_type::not_eof(ch);
+      }
+
+      int sync() override { return flush_buffer() && sink_->pubsync() == 0 ? 0 : -1; }
+
+      pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+      {
+        if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+          return pos_type(off_type(-1));
+        const pos_type flushed = sink_->pubseekoff(0, std::ios_base::cur, std::ios_base::out);
+        if (flushed == pos_type(off_type(-1)))
+          return flushed;
+        return flushed + off_type(pptr() - pbase());
+      }
+
+    private:
+      bool flush_buffer()
+      {
+        const std::streamsize pending = pptr() - pbase();
+        crc_ = update(crc_, pbase(), static_cast<size_t>(pending));
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+        return sink_->sputn(buffer_.data(), pending) == pending;
+      }
+
+      std::streambuf *sink_;
+      std::vector<char> buffer_;
+      uint32_t crc_ = 0;
+    };
+  } // namespace crc32c
+} // namespace orion
@@ -6,6 +6,7 @@
 #include <shared_mutex>
 #include <fstream>
 #include <sstream>
+#include <queue>
 #include <stdexcept>
 #include <algorithm>
 #include <vector>
@@ -16,45 +17,36 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <bit>
+#include <unordered_set>
+#include <unordered_map>
+#include <list>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <numeric>
 
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 #include "hnswlib/hnswlib.h"
+#include "distance.h"
+#include "quantizer.h"
+#include "projection.h"
+#include "gemm.h"
+#include "ivf.h"
+#include "stats.h"
+#include "crc32.h"
+#include "import.h"
+#include "endian.h"
+#include "vamana.h"
 
 namespace orion
 {
-  namespace endian_helpers
-  {
-    template <typename T>
-    void write_le(std::ostream &os, const T &value)
-    {
-      if constexpr (std::endian::native == std::endian::little)
-      {
-        os.write(reinterpret_cast<const char *>(&value), sizeof(T));
-      }
-      else
-      {
-        T le_value = value;
-        char *bytes = reinterpret_cast<char *>(&le_value);
-        std::reverse(bytes, bytes + sizeof(T));
-        os.write(bytes, sizeof(T));
-      }
-    }
-
-    template <typename T>
-    void read_le(std::istream &is, T &value)
-    {
-      is.read(reinterpret_cast<char *>(&value), sizeof(T));
-      if constexpr (std::endian::native != std::endian::little)
-      {
-        char *bytes = reinterpret_cast<char *>(&value);
-        std::reverse(bytes, bytes + sizeof(T));
-      }
-    }
-  } // namespace endian_helpers
-
   using namespace endian_helpers;
 
   template <typename T>
@@ -83,16 +75,183 @@ namespace orion
     return str;
   }
 
+  // version 3: entry_point_keys appended to the config header
+  // version 4: filter retry settings
+  // version 5: exact_scan_threshold
+  // version 6: prefetch_distance
+  // version 7: optimize_layout_on_save
+  // version 8: huge_pages, lock_memory
+  // version 9: element_type, metric; stored vectors are raw elements (packed
+  // bytes for binary vectors)
+  // version 10: custom_metric
+  // version 11: quantizer settings, followed by the trained PQ codebook
+  // version 12: projection settings, followed by the projection matrix
+  // version 13: IVF settings, followed by the coarse quantizer and list membership
+  // version 14: tiered_storage, tiered_cache_size
+  // version 15: repair_threshold
+  // version 16: ef_search
+  // version 17: CRC-32C of everything before it appended to the file
+  // version 18: huge_pages, lock_memory dropped (load-time LoadOptions)
+  // version 19: PQ codes of the graph nodes after the codebook
+  constexpr uint32_t kFormatVersion = 19;
+  constexpr uint32_t kFirstChecksummedVersion = 17;
+
+  // CRC-32C of the first length bytes of the file at path
+  std::optional<uint32_t> file_crc(const std::string &path, uint64_t length)
+  {
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+      return std::nullopt;
+    std::vector<char> buffer(1 << 20);
+    uint32_t crc = 0;
+    while (length > 0)
+    {
+      const size_t chunk = static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+      if (!is.read(buffer.data(), static_cast<std::streamsize>(chunk)))
+        return std::nullopt;
+      crc = crc32c::update(crc, buffer.data(), chunk);
+      length -= chunk;
+    }
+    return crc;
+  }
+
   void write_config(std::ostream &os, const Config &cfg)
   {
     write_le(os, cfg.vector_dim);
     write_le(os, cfg.max_elements);
+    uint64_t key_count = cfg.entry_point_keys.size();
+    write_le(os, key_count);
+    for (const auto &key : cfg.entry_point_keys)
+      write_string(os, key);
+    write_le(os, cfg.filter_retry_factor);
+    write_le(os, cfg.filter_max_ef);
+    write_le(os, cfg.exact_scan_threshold);
+    write_le(os, cfg.prefetch_distance);
+    uint8_t optimize_on_save = cfg.optimize_layout_on_save ? 1 : 0;
+    write_le(os, optimize_on_save);
+    uint8_t element_type = static_cast<uint8_t>(cfg.element_type);
+    write_le(os, element_type);
+    uint8_t metric = static_cast<uint8_t>(cfg.metric);
+    write_le(os, metric);
+    write_string(os, cfg.custom_metric);
+    write_le(os, cfg.pq_subspaces);
+    write_le(os, cfg.pq_threshold);
+    write_le(os, cfg.pq_rerank_factor);
+    uint8_t projection = static_cast<uint8_t>(cfg.projection);
+    write_le(os, projection);
+    write_le(os, cfg.projected_dim);
+    write_le(os, cfg.projection_rerank_factor);
+    uint8_t index_type = static_cast<uint8_t>(cfg.index_type);
+    write_le(os, index_type);
+    write_le(os, cfg.ivf_lists);
+    write_le(os, cfg.ivf_nprobe);
+    write_le(os, cfg.ivf_train_size);
+    uint8_t ivf_sq8 = cfg.ivf_sq8 ? 1 : 0;
+    write_le(os, ivf_sq8);
+    write_le(os, cfg.ivf_rerank_factor);
+    uint8_t tiered = cfg.tiered_storage ? 1 : 0;
+    write_le(os, tiered);
+    write_le(os, cfg.tiered_cache_size);
+    write_le(os, cfg.repair_threshold);
+    write_le(os, cfg.ef_search);
   }
 
-  void read_config(std::istream &is, Config &cfg)
+  void read_config(std::istream &is, Config &cfg, uint32_t format_version)
   {
     read_le(is, cfg.vector_dim);
     read_le(is, cfg.max_elements);
+    cfg.entry_point_keys.clear();
+    if (format_version >= 3)
+    {
+      uint64_t key_count = 0;
+      read_le(is, key_count);
+      for (uint64_t i = 0; i < key_count; ++i)
+        cfg.entry_point_keys.push_back(read_string(is));
+    }
+    if (format_version >= 4)
+    {
+      read_le(is, cfg.filter_retry_factor);
+      read_le(is, cfg.filter_max_ef);
+    }
+    if (format_version >= 5)
+      read_le(is, cfg.exact_scan_threshold);
+    if (format_version >= 6)
+      read_le(is, cfg.prefetch_distance);
+    if (format_version >= 7)
+    {
+      uint8_t optimize_on_save = 0;
+      read_le(is, optimize_on_save);
+      cfg.optimize_layout_on_save = optimize_on_save != 0;
+    }
+    if (format_version >= 8 && format_version < 18)
+    {
+      // huge_pages/lock_memory of the process that saved the file; ignored
+      uint8_t memory_flags = 0;
+      read_le(is, memory_flags);
+    }
+    cfg.element_type = ElementType::Float32;
+    cfg.metric = Metric::L2;
+    if (format_version >= 9)
+    {
+      uint8_t element_type = 0;
+      read_le(is, element_type);
+      uint8_t metric = 0;
+      read_le(is, metric);
+      if (element_type > static_cast<uint8_t>(ElementType::Binary) || metric > static_cast<uint8_t>(Metric::InnerProduct))
+        throw std::runtime_error("Unknown element type or metric in config.");
+      cfg.element_type = static_cast<ElementType>(element_type);
+      cfg.metric = static_cast<Metric>(metric);
+    }
+    cfg.custom_metric.clear();
+    if (format_version >= 10)
+      cfg.custom_metric = read_string(is);
+    if (format_version >= 11)
+    {
+      read_le(is, cfg.pq_subspaces);
+      read_le(is, cfg.pq_threshold);
+      read_le(is, cfg.pq_rerank_factor);
+    }
+    cfg.projection = Projection::None;
+    if (format_version >= 12)
+    {
+      uint8_t projection = 0;
+      read_le(is, projection);
+      if (projection > static_cast<uint8_t>(Projection::RandomOrthogonal))
+        throw std::runtime_error("Unknown projection in config.");
+      cfg.projection = static_cast<Projection>(projection);
+      read_le(is, cfg.projected_dim);
+      read_le(is, cfg.projection_rerank_factor);
+    }
+    cfg.index_type = IndexType::HNSW;
+    if (format_version >= 13)
+    {
+      uint8_t index_type = 0;
+      read_le(is, index_type);
+      if (index_type > static_cast<uint8_t>(IndexType::IVF))
+        throw std::runtime_error("Unknown index type in config.");
+      cfg.index_type = static_cast<IndexType>(index_type);
+      read_le(is, cfg.ivf_lists);
+      read_le(is, cfg.ivf_nprobe);
+      read_le(is, cfg.ivf_train_size);
+      uint8_t ivf_sq8 = 0;
+      read_le(is, ivf_sq8);
+      cfg.ivf_sq8 = ivf_sq8 != 0;
+      read_le(is, cfg.ivf_rerank_factor);
+    }
+    cfg.tiered_storage = false;
+    if (format_version >= 14)
+    {
+      uint8_t tiered = 0;
+      read_le(is, tiered);
+      cfg.tiered_storage = tiered != 0;
+      read_le(is, cfg.tiered_cache_size);
+    }
+    cfg.repair_threshold = Config().repair_threshold;
+    if (format_version >= 15)
+      read_le(is, cfg.repair_threshold);
+    cfg.ef_search = 0;
+    if (format_version >= 16)
+      read_le(is, cfg.ef_search);
   }
 
   void write_metadata_value(std::ostream &os, const MetadataValue &val);
@@ -144,460 +303,3325 @@ namespace orion
     }
   }
 
+  namespace
+  {
+    // Registered metrics by name, each with the functor its kernels point
+    // at. A name registered again moves its old functor to retired_metrics,
+    // which databases already using it may still call.
+    struct MetricRegistration
+    {
+      MetricKernels kernels;
+      std::shared_ptr<const void> functor;
+    };
+    std::mutex metric_registry_mutex;
+    std::map<std::string, MetricRegistration> metric_registry;
+    std::vector<std::shared_ptr<const void>> retired_metrics;
+
+    std::optional<MetricKernels> find_metric(const std::string &name)
+    {
+      std::lock_guard<std::mutex> lock(metric_registry_mutex);
+      auto it = metric_registry.find(name);
+      if (it == metric_registry.end())
+        return std::nullopt;
+      return it->second.kernels;
+    }
+
+    bool metric_available(const Config &cfg)
+    {
+      if (cfg.custom_metric.empty())
+        return true;
+      if (cfg.element_type != ElementType::Float32)
+      {
+        std::cerr << "Custom metric '" << cfg.custom_metric << "' requires float vectors." << std::endl;
+        return false;
+      }
+      if (!find_metric(cfg.custom_metric))
+      {
+        std::cerr << "Metric '" << cfg.custom_metric << "' is not registered." << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    bool projection_valid(const Config &cfg)
+    {
+      if (cfg.projection == Projection::None)
+        return true;
+      if (cfg.element_type != ElementType::Float32 || !cfg.custom_metric.empty() || cfg.pq_subspaces > 0 ||
+          cfg.projected_dim == 0 || cfg.projected_dim >= cfg.vector_dim)
+      {
+        std::cerr << "Projection needs float vectors, a built-in metric, no PQ and 0 < projected_dim < vector_dim." << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    bool index_valid(const Config &cfg)
+    {
+      if (cfg.tiered_storage && cfg.index_type != IndexType::HNSW)
+      {
+        std::cerr << "Tiered storage needs the HNSW index." << std::endl;
+        return false;
+      }
+      if (cfg.index_type == IndexType::HNSW)
+        return true;
+      if (cfg.element_type != ElementType::Float32 || !cfg.custom_metric.empty() || cfg.pq_subspaces > 0 ||
+          cfg.projection != Projection::None)
+      {
+        std::cerr << "IVF needs float vectors and a built-in metric, without PQ or projection." << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    // a registered custom metric replaces the built-in kernels
+    distance::Kernels kernels_for(const Config &cfg)
+    {
+      if (cfg.custom_metric.empty())
+        return distance::kernels_for(cfg.element_type, cfg.metric, cfg.vector_dim);
+      if (std::optional<MetricKernels> custom = find_metric(cfg.custom_metric))
+        return *custom;
+      throw std::runtime_error("Unregistered metric: " + cfg.custom_metric);
+    }
+  } // namespace
+
+  bool detail::register_metric_kernels(const std::string &name, const MetricKernels &kernels, std::shared_ptr<const void> functor)
+  {
+    if (name.empty())
+      return false;
+    std::lock_guard<std::mutex> lock(metric_registry_mutex);
+    MetricRegistration &registration = metric_registry[name];
+    if (registration.functor)
+      retired_metrics.push_back(std::move(registration.functor));
+    registration = MetricRegistration{kernels, std::move(functor)};
+    return true;
+  }
+
+  // hnswlib space over Orion's kernel table, so graph construction uses the
+  // same element-type- and dimension-specialized kernels as Orion's own
+  // search loops; hnswlib only sees data_size_ opaque bytes per vector. The
+  // dist_func_param carries the dimension and a custom metric's functor.
+  class KernelSpace : public hnswlib::SpaceInterface<float>
+  {
+    MetricParam param_;
+    size_t data_size_;
+    hnswlib::DISTFUNC<float> dist_func_;
+
+  public:
+    explicit KernelSpace(const Config &cfg) : KernelSpace(cfg, kernels_for(cfg)) {}
+    KernelSpace(const Config &cfg, const distance::Kernels &kernels)
+        : param_{cfg.vector_dim, kernels.context}, data_size_(distance::vector_bytes(cfg.element_type, cfg.vector_dim)),
+          dist_func_(kernels.space) {}
+    size_t get_data_size() override { return data_size_; }
+    hnswlib::DISTFUNC<float> get_dist_func() override { return dist_func_; }
+    void *get_dist_func_param() override { return &param_; }
+  };
+
   class Database::Impl
   {
   public:
+    // float databases keep vector, quantized and binary ones keep the raw bytes
+    // in codes. A tiered record that lives only in the DB file has empty
+    // fields and its location in offset/length.
     struct VectorData
     {
       Vector vector;
+      std::vector<uint8_t> codes;
       Metadata metadata;
+      uint64_t offset = 0;
+      uint64_t length = 0;
+
+      bool resident() const { return length == 0; }
     };
+    using Record = std::shared_ptr<const VectorData>;
+    using RecordCache = std::list<std::pair<VectorId, Record>>; // most recently used first
     using InvertedIndex = std::map<std::string, std::map<MetadataValue, std::set<VectorId>>>;
+    using EntryPointTable = std::map<std::string, std::map<MetadataValue, VectorId>>;
 
     std::string db_path;
     Config config;
     std::map<VectorId, VectorData> storage;
     InvertedIndex metadata_index;
-    hnswlib::L2Space space;
-    hnswlib::HierarchicalNSW<float> *hnsw_index = nullptr;
+    EntryPointTable entry_points;
+    std::unique_ptr<KernelSpace> space; // hnsw_index keeps a pointer into it
+    distance::Kernels kernels; // at index_dim(), what the graph and scans use
+    distance::Kernels full_kernels; // at vector_dim, for reranking projected results
+    std::vector<float> projection_matrix; // projected_dim x vector_dim once a projection is active
+    AnisotropicQuantizer quantizer;
+    std::vector<uint8_t> pq_codes; // quantizer.code_bytes() per internal id
+    InvertedFileIndex ivf;
+    uint64_t ivf_trained_count = 0; // stored vectors when the IVF lists were last trained
+    hnswlib::HierarchicalNSW<float> *hnsw_index = nullptr; // null for IndexType::IVF
+    int records_fd = -1; // the DB file, for tiered records
+    bool lock_failure_reported = false;
+    // graph repair: a pass walks internal ids from repair_cursor and clears
+    // the tombstones that existed when it started (repair_target)
+    bool repair_active = false;
+    size_t repair_cursor = 0;
+    size_t repair_target = 0;
+    size_t repaired_tombstones = 0; // tombstones no live node links to any more
+    mutable std::mutex cache_mutex;
+    mutable RecordCache record_cache;
+    mutable std::unordered_map<VectorId, RecordCache::iterator> cached_records;
     mutable std::shared_mutex rw_mutex;
 
-    Impl(const std::string &path, const Config &cfg) : db_path(path), config(cfg), space(cfg.vector_dim)
+    Impl(const std::string &path, const Config &cfg) : db_path(path), config(cfg), space(std::make_unique<KernelSpace>(cfg)), kernels(kernels_for(cfg)), full_kernels(kernels), quantizer(cfg.vector_dim, cfg.pq_subspaces, cfg.pq_threshold), ivf(cfg.vector_dim, cfg.ivf_sq8)
+    {
+      if (config.projection == Projection::RandomOrthogonal)
+      {
+        std::mt19937 rng(config.vector_dim * 31 + config.projected_dim);
+        projection_matrix = projection::random_orthogonal(config.vector_dim, config.projected_dim, rng);
+        select_kernels();
+      }
+      if (config.index_type == IndexType::HNSW)
+        hnsw_index = new hnswlib::HierarchicalNSW<float>(space.get(), static_cast<size_t>(config.max_elements), 16, 200, true);
+      apply_memory_policy();
+    }
+    ~Impl()
+    {
+      release_memory_policy();
+      delete hnsw_index;
+      if (records_fd != -1)
+        ::close(records_fd);
+    }
+
+    size_t index_dim() const { return projection_matrix.empty() ? config.vector_dim : config.projected_dim; }
+
+    // what a search scores with: the index kernels, or kernels over a prefix
+    // of each vector's components
+    struct Scorer
+    {
+      distance::Kernels kernels;
+      size_t dim;
+    };
+
+    Scorer scorer_for(size_t prefix_dim) const
     {
-      hnsw_index = new hnswlib::HierarchicalNSW<float>(&space, static_cast<size_t>(config.max_elements), 16, 200, true);
+      if (prefix_dim == 0 || prefix_dim >= index_dim())
+        return Scorer{kernels, index_dim()};
+      Config prefix_config = config;
+      prefix_config.vector_dim = static_cast<uint32_t>(prefix_dim);
+      return Scorer{kernels_for(prefix_config), prefix_dim};
     }
-    ~Impl() { delete hnsw_index; }
 
-    void remove_from_metadata_index(VectorId id)
+    // space and kernels for what the graph stores: projected or full vectors
+    void select_kernels()
     {
-      if (storage.find(id) == storage.end())
+      Config index_config = config;
+      index_config.vector_dim = static_cast<uint32_t>(index_dim());
+      kernels = kernels_for(index_config);
+      *space = KernelSpace(index_config, kernels);
+      full_kernels = kernels_for(config);
+    }
+
+    // Level-0 memory holds the vectors and base-layer links, i.e. nearly all a
+    // query touches. hnswlib allocates it with malloc, so instead of mapping
+    // MAP_HUGETLB pages ourselves the existing mapping is advised onto
+    // transparent huge pages and/or pinned with mlock. Pinning covers the
+    // whole max_elements capacity, so it is faulted in up front.
+    void apply_memory_policy()
+    {
+#if defined(__linux__)
+      if (!hnsw_index || (!config.huge_pages && !config.lock_memory))
         return;
-      const auto &meta_to_remove = storage.at(id).metadata;
-      for (const auto &[key, value] : meta_to_remove)
+      auto &index = *hnsw_index;
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(index.data_level0_memory_);
+      const uintptr_t end = begin + index.max_elements_ * index.size_data_per_element_;
+      if (config.huge_pages)
       {
-        auto key_it = metadata_index.find(key);
-        if (key_it != metadata_index.end())
-        {
-          auto val_it = key_it->second.find(value);
-          if (val_it != key_it->second.end())
-          {
-            val_it->second.erase(id);
-            if (val_it->second.empty())
-              key_it->second.erase(val_it);
-          }
-          if (key_it->second.empty())
-            metadata_index.erase(key_it);
-        }
+        constexpr uintptr_t kHugePage = uintptr_t(2) << 20;
+        const uintptr_t huge_begin = (begin + kHugePage - 1) & ~(kHugePage - 1);
+        if (huge_begin < end && ::madvise(reinterpret_cast<void *>(huge_begin), end - huge_begin, MADV_HUGEPAGE) != 0)
+          std::cerr << "Warning: madvise(MADV_HUGEPAGE) failed: errno=" << errno << std::endl;
+      }
+      if (config.lock_memory)
+      {
+        const uintptr_t page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+        const uintptr_t lock_begin = begin & ~(page - 1);
+        lock_range(reinterpret_cast<void *>(lock_begin), end - lock_begin);
+        lock_range(index.linkLists_, index.max_elements_ * sizeof(char *));
+        for (hnswlib::tableint node = 0; node < index.cur_element_count; ++node)
+          lock_upper_links(node);
       }
+#endif
     }
 
-    bool rebuild_index(size_t new_max_elements)
+    // undoes the pinning of apply_memory_policy() before the graph is freed:
+    // free() may keep the pages mapped, and they would stay locked
+    void release_memory_policy()
     {
-      hnswlib::HierarchicalNSW<float> *new_index = nullptr;
-      try
+#if defined(__linux__)
+      if (!hnsw_index || !config.lock_memory)
+        return;
+      const auto &index = *hnsw_index;
+      const uintptr_t page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(index.data_level0_memory_) & ~(page - 1);
+      const uintptr_t end = reinterpret_cast<uintptr_t>(index.data_level0_memory_) + index.max_elements_ * index.size_data_per_element_;
+      ::munlock(reinterpret_cast<void *>(begin), end - begin);
+      ::munlock(index.linkLists_, index.max_elements_ * sizeof(char *));
+      for (hnswlib::tableint node = 0; node < index.cur_element_count; ++node)
       {
-        new_index = new hnswlib::HierarchicalNSW<float>(&space, new_max_elements, 16, 200, true);
-        for (const auto &kv : storage)
-        {
-          new_index->addPoint(kv.second.vector.data(), kv.first);
-        }
+        if (index.element_levels_[node] > 0)
+          ::munlock(index.linkLists_[node], index.size_links_per_element_ * index.element_levels_[node]);
       }
-      catch (const std::exception &e)
+#endif
+    }
+
+    // mlock failures share one cause (RLIMIT_MEMLOCK), so only the first is reported
+    bool lock_range(const void *addr, size_t length)
+    {
+#if defined(__linux__)
+      if (::mlock(addr, length) == 0)
+        return true;
+      if (!lock_failure_reported)
       {
-        delete new_index;
-        std::cerr << "Rebuild failed: " << e.what() << std::endl;
-        return false;
+        std::cerr << "Warning: mlock of graph memory failed (check RLIMIT_MEMLOCK): errno=" << errno << std::endl;
+        lock_failure_reported = true;
       }
-      delete hnsw_index;
-      hnsw_index = new_index;
-      config.max_elements = new_max_elements;
+      return false;
+#else
+      (void)addr;
+      (void)length;
       return true;
+#endif
     }
 
-    bool save()
+    void lock_upper_links(hnswlib::tableint node)
     {
-      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      const auto &index = *hnsw_index;
+      if (index.element_levels_[node] > 0)
+        lock_range(index.linkLists_[node], index.size_links_per_element_ * index.element_levels_[node]);
+    }
 
-      const std::string tmp_db_path = db_path + ".tmp";
-      const std::string tmp_hnsw_path = db_path + ".hnsw.tmp";
+    template <typename T>
+    static constexpr ElementType element_type_of()
+    {
+      if constexpr (std::is_same_v<T, int8_t>)
+        return ElementType::Int8;
+      else if constexpr (std::is_same_v<T, uint8_t>)
+        return ElementType::UInt8;
+      else if constexpr (std::is_same_v<T, std::byte>)
+        return ElementType::Binary;
+      else
+        return ElementType::Float32;
+    }
 
-      try
+    const void *raw(const VectorData &data) const
+    {
+      if (config.element_type == ElementType::Float32)
+        return data.vector.data();
+      return data.codes.data();
+    }
+
+    // what the graph indexes: the stored vector, or its projection
+    const void *index_data(const VectorData &data, std::vector<float> &projected) const
+    {
+      return index_data(data, projected, projection_matrix);
+    }
+    const void *index_data(const VectorData &data, std::vector<float> &projected, const std::vector<float> &matrix) const
+    {
+      if (matrix.empty())
+        return raw(data);
+      projected.resize(config.projected_dim);
+      projection::apply(matrix, data.vector.data(), config.vector_dim, projected.data());
+      return projected.data();
+    }
+
+    // stored units: floats, 8-bit components or bytes of packed bits
+    size_t element_count(const VectorData &data) const
+    {
+      return config.element_type == ElementType::Float32 ? data.vector.size() : data.codes.size();
+    }
+
+    // one storage record as laid out in the DB file after its id
+    void write_vector_data(std::ostream &os, const VectorData &data) const
+    {
+      uint64_t vec_len = element_count(data);
+      write_le(os, vec_len);
+      if (vec_len > 0)
+        os.write(static_cast<const char *>(raw(data)), static_cast<std::streamsize>(vec_len * distance::element_size(config.element_type)));
+      uint64_t meta_pairs = data.metadata.size();
+      write_le(os, meta_pairs);
+      for (const auto &m : data.metadata)
       {
-        hnsw_index->saveIndex(tmp_hnsw_path);
+        write_string(os, m.first);
+        write_metadata_value(os, m.second);
       }
-      catch (const std::exception &e)
+    }
+
+    VectorData read_vector_data(std::istream &is) const
+    {
+      uint64_t vec_len = 0;
+      read_le(is, vec_len);
+      VectorData data;
+      if (config.element_type == ElementType::Float32)
       {
-        std::cerr << "Failed to save HNSW index to temporary file: " << e.what() << std::endl;
-        return false;
+        data.vector.resize(static_cast<size_t>(vec_len));
+        is.read(reinterpret_cast<char *>(data.vector.data()), static_cast<std::streamsize>(vec_len * sizeof(float)));
       }
-
-      std::stringstream hnsw_stream;
-      uint64_t hnsw_size = 0;
+      else
       {
-        std::ifstream hnsw_ifs(tmp_hnsw_path, std::ios::binary);
-        if (!hnsw_ifs)
-        {
-          std::remove(tmp_hnsw_path.c_str());
-          return false;
-        }
-        hnsw_stream << hnsw_ifs.rdbuf();
-        hnsw_ifs.seekg(0, std::ios::end);
-        hnsw_size = hnsw_ifs.tellg();
+        data.codes.resize(static_cast<size_t>(vec_len));
+        is.read(reinterpret_cast<char *>(data.codes.data()), static_cast<std::streamsize>(vec_len));
       }
-      std::remove(tmp_hnsw_path.c_str());
-
-      std::ofstream ofs(tmp_db_path, std::ios::binary | std::ios::out | std::ios::trunc);
-      if (!ofs)
-        return false;
-
-      ofs.write("ORIONDB2", 8);
-      uint32_t format_version = 2;
-      write_le(ofs, format_version);
-
-      write_config(ofs, config);
-
-      uint64_t storage_count = storage.size();
-      write_le(ofs, storage_count);
-      for (const auto &kv : storage)
+      uint64_t meta_pairs = 0;
+      read_le(is, meta_pairs);
+      for (uint64_t m = 0; m < meta_pairs; ++m)
       {
-        write_le(ofs, kv.first);
-        const Vector &v = kv.second.vector;
-        uint64_t vec_len = v.size();
-        write_le(ofs, vec_len);
-        if (vec_len > 0)
-          ofs.write(reinterpret_cast<const char *>(v.data()), static_cast<std::streamsize>(vec_len * sizeof(float)));
-        const Metadata &meta = kv.second.metadata;
-        uint64_t meta_pairs = meta.size();
-        write_le(ofs, meta_pairs);
-        for (const auto &m : meta)
-        {
-          write_string(ofs, m.first);
-          write_metadata_value(ofs, m.second);
-        }
+        std::string key = read_string(is);
+        MetadataValue mv = read_metadata_value(is);
+        data.metadata.emplace(std::move(key), std::move(mv));
       }
+      return data;
+    }
 
-      std::stringstream meta_idx_stream;
-      uint64_t outer_map_size = metadata_index.size();
-      write_le(meta_idx_stream, outer_map_size);
-      for (const auto &outer : metadata_index)
+    // the entry itself when resident, else a pread of its record
+    Record record_of(const VectorData &entry) const
+    {
+      if (entry.resident())
+        return Record(Record(), &entry);
+      std::string buffer(static_cast<size_t>(entry.length), '\0');
+      size_t done = 0;
+      while (done < buffer.size())
       {
-        write_string(meta_idx_stream, outer.first);
-        uint64_t inner_map_size = outer.second.size();
-        write_le(meta_idx_stream, inner_map_size);
-        for (const auto &inner : outer.second)
-        {
-          write_metadata_value(meta_idx_stream, inner.first);
-          uint64_t id_set_size = inner.second.size();
-          write_le(meta_idx_stream, id_set_size);
-          for (auto id : inner.second)
-            write_le(meta_idx_stream, id);
-        }
+        ssize_t got = ::pread(records_fd, &buffer[done], buffer.size() - done, static_cast<off_t>(entry.offset + done));
+        if (got <= 0)
+          break;
+        done += static_cast<size_t>(got);
       }
-      meta_idx_stream.seekg(0, std::ios::end);
-      uint64_t meta_idx_size = static_cast<uint64_t>(meta_idx_stream.tellg());
-      meta_idx_stream.seekg(0, std::ios::beg);
-
-      write_le(ofs, meta_idx_size);
-      ofs << meta_idx_stream.rdbuf();
-
-      write_le(ofs, hnsw_size);
-      if (hnsw_size > 0)
-        ofs << hnsw_stream.rdbuf();
-
-      ofs.flush();
+      if (done < buffer.size())
+      {
+        // keep callers' vector arithmetic in bounds
+        std::cerr << "Failed to read a stored record: errno=" << errno << std::endl;
+        VectorData blank;
+        blank.vector.assign(config.element_type == ElementType::Float32 ? config.vector_dim : 0, 0.0f);
+        blank.codes.assign(config.element_type == ElementType::Float32 ? 0 : distance::stored_units(config.element_type, config.vector_dim), 0);
+        return std::make_shared<const VectorData>(std::move(blank));
+      }
+      std::istringstream is(std::move(buffer), std::ios::binary);
+      return std::make_shared<const VectorData>(read_vector_data(is));
+    }
 
-#if defined(_WIN32)
+    // Stored data of each id. Tiered records missing from the LRU are hinted
+    // to the kernel together, then read in file order. Caller holds a lock.
+    std::vector<Record> fetch_batch(const std::vector<VectorId> &ids) const
+    {
+      std::vector<Record> records(ids.size());
+      std::vector<size_t> misses;
       {
-        HANDLE hFile = CreateFileA(tmp_db_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (hFile != INVALID_HANDLE_VALUE)
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (size_t i = 0; i < ids.size(); ++i)
         {
-          FlushFileBuffers(hFile);
-          CloseHandle(hFile);
+          const VectorData &entry = storage.at(ids[i]);
+          auto cached = cached_records.find(ids[i]);
+          if (entry.resident())
+            records[i] = record_of(entry);
+          else if (cached != cached_records.end())
+          {
+            record_cache.splice(record_cache.begin(), record_cache, cached->second);
+            records[i] = cached->second->second;
+          }
+          else
+            misses.push_back(i);
         }
       }
-#else
-      int fd_sync = ::open(tmp_db_path.c_str(), O_RDONLY);
-      if (fd_sync != -1)
+      if (misses.empty())
+        return records;
+      std::sort(misses.begin(), misses.end(), [&](size_t a, size_t b)
+                { return storage.at(ids[a]).offset < storage.at(ids[b]).offset; });
+#if defined(POSIX_FADV_WILLNEED)
+      for (size_t i : misses)
       {
-        ::fsync(fd_sync);
-        ::close(fd_sync);
+        const VectorData &entry = storage.at(ids[i]);
+        ::posix_fadvise(records_fd, static_cast<off_t>(entry.offset), static_cast<off_t>(entry.length), POSIX_FADV_WILLNEED);
       }
 #endif
-
-      ofs.close();
-
-      if (std::rename(tmp_db_path.c_str(), db_path.c_str()) != 0)
+      for (size_t i : misses)
+        records[i] = record_of(storage.at(ids[i]));
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      for (size_t i : misses)
       {
-        std::cerr << "Error: Cannot atomically rename tmp DB file to final DB file: errno=" << errno << std::endl;
-        return false;
+        if (cached_records.count(ids[i]))
+          continue;
+        record_cache.emplace_front(ids[i], records[i]);
+        cached_records[ids[i]] = record_cache.begin();
       }
-      return true;
+      while (record_cache.size() > config.tiered_cache_size)
+      {
+        cached_records.erase(record_cache.back().first);
+        record_cache.pop_back();
+      }
+      return records;
     }
 
-    bool load()
+    Record fetch(VectorId id) const { return fetch_batch({id})[0]; }
+
+    void forget_cached(VectorId id)
     {
-      std::lock_guard<std::shared_mutex> lock(rw_mutex);
-      std::ifstream ifs(db_path, std::ios::binary | std::ios::in);
-      if (!ifs)
-        return false;
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      auto cached = cached_records.find(id);
+      if (cached == cached_records.end())
+        return;
+      record_cache.erase(cached->second);
+      cached_records.erase(cached);
+    }
 
-      char magic[8];
-      ifs.read(magic, 8);
-      if (std::memcmp(magic, "ORIONDB2", 8) != 0)
+    // after a tiered save: every record now lives at its new place in the
+    // file, so the in-memory copies are dropped
+    void spill(const std::vector<std::pair<uint64_t, uint64_t>> &placed)
+    {
+      if (records_fd != -1)
+        ::close(records_fd);
+      records_fd = ::open(db_path.c_str(), O_RDONLY);
+      size_t i = 0;
+      for (auto &kv : storage)
       {
-        std::cerr << "Invalid or unsupported DB magic." << std::endl;
+        kv.second = VectorData{};
+        kv.second.offset = placed[i].first;
+        kv.second.length = placed[i].second;
+        ++i;
+      }
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      record_cache.clear();
+      cached_records.clear();
+    }
+
+    // up to limit stored float vectors in storage order, a random subset
+    // when there are more; records keeps tiered ones alive
+    std::vector<const float *> sample_vectors(size_t limit, std::mt19937 &rng, std::vector<Record> &records) const
+    {
+      std::vector<VectorId> ids;
+      ids.reserve(storage.size());
+      for (const auto &kv : storage)
+        ids.push_back(kv.first);
+      if (ids.size() > limit)
+      {
+        std::shuffle(ids.begin(), ids.end(), rng);
+        ids.resize(limit);
+      }
+      std::vector<const float *> vectors;
+      vectors.reserve(ids.size());
+      records.clear();
+      for (VectorId id : ids)
+      {
+        records.push_back(record_of(storage.at(id)));
+        vectors.push_back(records.back()->vector.data());
+      }
+      return vectors;
+    }
+
+    void remove_from_metadata_index(VectorId id)
+    {
+      if (storage.find(id) == storage.end())
+        return;
+      const Record record = fetch(id);
+      const auto &meta_to_remove = record->metadata;
+      for (const auto &[key, value] : meta_to_remove)
+      {
+        auto key_it = metadata_index.find(key);
+        if (key_it != metadata_index.end())
+        {
+          auto val_it = key_it->second.find(value);
+          if (val_it != key_it->second.end())
+          {
+            val_it->second.erase(id);
+            if (val_it->second.empty())
+              key_it->second.erase(val_it);
+          }
+          if (key_it->second.empty())
+            metadata_index.erase(key_it);
+        }
+      }
+      remove_from_entry_points(id, meta_to_remove);
+    }
+
+    // entry points are graph nodes, so IVF databases have none
+    bool is_entry_point_key(const std::string &key) const
+    {
+      if (!hnsw_index)
         return false;
+      const auto &keys = config.entry_point_keys;
+      return std::find(keys.begin(), keys.end(), key) != keys.end();
+    }
+
+    int node_level(VectorId id) const
+    {
+      auto it = hnsw_index->label_lookup_.find(id);
+      if (it == hnsw_index->label_lookup_.end())
+        return -1;
+      return hnsw_index->element_levels_[it->second];
+    }
+
+    // the highest-level node of a partition wins, so the walk starts on its longest links
+    void offer_entry_point(const std::string &key, const MetadataValue &value, VectorId id)
+    {
+      auto [it, inserted] = entry_points[key].try_emplace(value, id);
+      if (!inserted && node_level(id) > node_level(it->second))
+        it->second = id;
+    }
+
+    void add_to_entry_points(VectorId id, const Metadata &meta)
+    {
+      for (const auto &[key, value] : meta)
+      {
+        if (is_entry_point_key(key))
+          offer_entry_point(key, value, id);
       }
-      uint32_t format_version = 0;
-      read_le(ifs, format_version);
-      read_config(ifs, config);
+    }
 
-      if (hnsw_index)
-        delete hnsw_index;
-      space = hnswlib::L2Space(config.vector_dim);
-      hnsw_index = new hnswlib::HierarchicalNSW<float>(&space, static_cast<size_t>(config.max_elements), 16, 200, true);
+    // expects id to be gone from metadata_index already, so a replacement is
+    // picked among the remaining members of the partition
+    void remove_from_entry_points(VectorId id, const Metadata &meta)
+    {
+      for (const auto &[key, value] : meta)
+      {
+        auto key_it = entry_points.find(key);
+        if (key_it == entry_points.end())
+          continue;
+        auto val_it = key_it->second.find(value);
+        if (val_it == key_it->second.end() || val_it->second != id)
+          continue;
+        key_it->second.erase(val_it);
+        auto posting_key = metadata_index.find(key);
+        if (posting_key != metadata_index.end())
+        {
+          auto posting = posting_key->second.find(value);
+          if (posting != posting_key->second.end())
+          {
+            for (VectorId other : posting->second)
+              offer_entry_point(key, value, other);
+          }
+        }
+        if (key_it->second.empty())
+          entry_points.erase(key_it);
+      }
+    }
 
-      uint64_t storage_count = 0;
-      read_le(ifs, storage_count);
-      storage.clear();
-      for (uint64_t i = 0; i < storage_count; ++i)
+    void rebuild_entry_points()
+    {
+      entry_points.clear();
+      if (!hnsw_index)
+        return;
+      for (const auto &key : config.entry_point_keys)
       {
-        VectorId id;
-        read_le(ifs, id);
-        uint64_t vec_len = 0;
-        read_le(ifs, vec_len);
-        Vector v(static_cast<size_t>(vec_len));
-        if (vec_len > 0)
-          ifs.read(reinterpret_cast<char *>(v.data()), static_cast<std::streamsize>(vec_len * sizeof(float)));
-        uint64_t meta_pairs = 0;
-        read_le(ifs, meta_pairs);
-        Metadata meta;
-        for (uint64_t m = 0; m < meta_pairs; ++m)
+        auto key_it = metadata_index.find(key);
+        if (key_it == metadata_index.end())
+          continue;
+        for (const auto &[value, ids] : key_it->second)
         {
-          std::string key = read_string(ifs);
-          MetadataValue mv = read_metadata_value(ifs);
-          meta.emplace(std::move(key), std::move(mv));
+          for (VectorId id : ids)
+            offer_entry_point(key, value, id);
         }
-        storage[id] = {v, meta};
       }
+    }
 
-      metadata_index.clear();
-      uint64_t meta_idx_size = 0;
-      read_le(ifs, meta_idx_size);
-      if (meta_idx_size > 0)
+    // entry point of the most selective declared clause in the filter
+    std::optional<VectorId> partition_entry_point(const Metadata &filter) const
+    {
+      std::optional<VectorId> entry;
+      size_t best_size = std::numeric_limits<size_t>::max();
+      for (const auto &[key, value] : filter)
       {
-        std::string meta_idx_buffer(static_cast<size_t>(meta_idx_size), '\0');
-        ifs.read(&meta_idx_buffer[0], static_cast<std::streamsize>(meta_idx_size));
-        std::stringstream meta_idx_stream(meta_idx_buffer, std::ios::binary | std::ios::in);
+        auto key_it = entry_points.find(key);
+        if (key_it == entry_points.end())
+          continue;
+        auto val_it = key_it->second.find(value);
+        if (val_it == key_it->second.end())
+          continue;
+        size_t size = metadata_index.at(key).at(value).size();
+        if (size < best_size)
+        {
+          best_size = size;
+          entry = val_it->second;
+        }
+      }
+      return entry;
+    }
 
-        uint64_t outer_map_size = 0;
-        read_le(meta_idx_stream, outer_map_size);
-        for (uint64_t i = 0; i < outer_map_size; ++i)
+    // Orion's own walk of the hnswlib graph (same algorithm as searchKnn). Each
+    // expansion gathers the unvisited neighbors first, prefetches their link
+    // lists and vectors config.prefetch_distance nodes ahead and scores them
+    // four at a time. With stay_in_partition the upper-layer descent only steps
+    // onto allowed nodes, so a walk started at a partition entry point stays there.
+    // Only the scored prefix of each vector is prefetched. A skip node is
+    // never stepped on (unless it is the entry point) nor returned. A filtered
+    // walk that still has fewer than ef matches after scoring ef full base-layer
+    // neighbor lists (ef * maxM0_ nodes) stops there, so its cost grows with ef
+    // instead of covering the whole graph; filtered_search() retries it wider.
+    std::priority_queue<std::pair<float, hnswlib::labeltype>> search_graph(hnswlib::tableint entry, const void *query_data, size_t k, hnswlib::BaseFilterFunctor *is_allowed, bool stay_in_partition, const Scorer &scorer, std::optional<hnswlib::tableint> skip = std::nullopt) const
+    {
+      using hnswlib::tableint;
+      const auto &index = *hnsw_index;
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> result;
+      if (index.cur_element_count == 0)
+        return result;
+
+      const size_t dim = scorer.dim;
+      const distance::Kernels &kernels = scorer.kernels;
+      const size_t element_bytes = index.offsetData_ + distance::vector_bytes(config.element_type, dim);
+      const size_t ahead = config.prefetch_distance;
+      auto vector_of = [&](tableint node)
+      { return static_cast<const void *>(index.getDataByInternalId(node)); };
+      auto accept = [&](tableint node)
+      { return !index.isMarkedDeleted(node) && (!is_allowed || (*is_allowed)(index.getExternalLabel(node))); };
+      auto prefetch_node = [&](tableint node)
+      { distance::prefetch_range(index.get_linklist0(node), element_bytes); };
+
+      tableint current = entry;
+      float current_dist = kernels.distance(query_data, vector_of(current), dim);
+      for (int level = index.element_levels_[current]; level > 0; --level)
+      {
+        bool changed = true;
+        while (changed)
         {
-          std::string outer_key = read_string(meta_idx_stream);
-          uint64_t inner_map_size = 0;
-          read_le(meta_idx_stream, inner_map_size);
-          for (uint64_t j = 0; j < inner_map_size; ++j)
+          changed = false;
+          hnswlib::linklistsizeint *links = index.get_linklist(current, level);
+          unsigned short size = index.getListCount(links);
+          const tableint *neighbors = reinterpret_cast<const tableint *>(links + 1);
+          for (unsigned short i = 0; i < size; ++i)
           {
-            MetadataValue mv = read_metadata_value(meta_idx_stream);
-            uint64_t id_set_size = 0;
-            read_le(meta_idx_stream, id_set_size);
-            std::set<VectorId> ids;
-            for (uint64_t k = 0; k < id_set_size; ++k)
+            if ((stay_in_partition && !accept(neighbors[i])) || neighbors[i] == skip)
+              continue;
+            float d = kernels.distance(query_data, vector_of(neighbors[i]), dim);
+            if (d < current_dist)
             {
-              VectorId id_val;
-              read_le(meta_idx_stream, id_val);
-              ids.insert(id_val);
+              current_dist = d;
+              current = neighbors[i];
+              changed = true;
             }
-            metadata_index[outer_key][mv] = std::move(ids);
           }
         }
       }
 
-      uint64_t hnsw_size = 0;
-      read_le(ifs, hnsw_size);
-      if (hnsw_size > 0)
+      using Candidate = std::pair<float, tableint>;
+      std::priority_queue<Candidate> top_candidates;
+      std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+      const size_t ef = std::max(index.ef_, k);
+      float lower_bound = std::numeric_limits<float>::max();
+
+      hnswlib::VisitedList *visited = index.visited_list_pool_->getFreeVisitedList();
+      hnswlib::vl_type *visited_array = visited->mass;
+      hnswlib::vl_type visited_tag = visited->curV;
+      if (skip)
+        visited_array[*skip] = visited_tag;
+
+      if (accept(current) && current != skip)
       {
-        std::string hnsw_buffer(static_cast<size_t>(hnsw_size), '\0');
-        ifs.read(&hnsw_buffer[0], static_cast<std::streamsize>(hnsw_size));
+        top_candidates.emplace(current_dist, current);
+        lower_bound = current_dist;
+      }
+      frontier.emplace(current_dist, current);
+      visited_array[current] = visited_tag;
 
-        const std::string tmp_hnsw_path = db_path + ".hnsw.load.tmp";
+      std::vector<tableint> pending(index.maxM0_);
+      std::vector<float> pending_dist(index.maxM0_);
+      const void *block[4];
+      const size_t scoring_budget = is_allowed ? ef * index.maxM0_ : std::numeric_limits<size_t>::max();
+      size_t scored = 0;
+      while (!frontier.empty())
+      {
+        auto [node_dist, node] = frontier.top();
+        if (node_dist > lower_bound && top_candidates.size() == ef)
+          break;
+        if (scored >= scoring_budget && top_candidates.size() < ef)
+          break;
+        frontier.pop();
+
+        hnswlib::linklistsizeint *links = index.get_linklist0(node);
+        unsigned short size = index.getListCount(links);
+        const tableint *neighbors = reinterpret_cast<const tableint *>(links + 1);
+        for (unsigned short i = 0; i < size; ++i)
+          distance::prefetch(visited_array + neighbors[i]);
+        size_t count = 0;
+        for (unsigned short i = 0; i < size; ++i)
         {
-          std::ofstream hnsw_ofs(tmp_hnsw_path, std::ios::binary);
-          hnsw_ofs.write(hnsw_buffer.data(), hnsw_buffer.size());
+          tableint candidate = neighbors[i];
+          if (visited_array[candidate] == visited_tag)
+            continue;
+          visited_array[candidate] = visited_tag;
+          pending[count++] = candidate;
         }
+        scored += count;
 
-        try
+        for (size_t p = 0; p < std::min(ahead, count); ++p)
+          prefetch_node(pending[p]);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
         {
-          hnsw_index->loadIndex(tmp_hnsw_path, &space);
+          for (size_t p = i + ahead; p < std::min(i + ahead + 4, count); ++p)
+            prefetch_node(pending[p]);
+          for (size_t j = 0; j < 4; ++j)
+            block[j] = vector_of(pending[i + j]);
+          kernels.batch4(query_data, block, dim, &pending_dist[i]);
         }
-        catch (const std::exception &e)
+        for (; i < count; ++i)
+          pending_dist[i] = kernels.distance(query_data, vector_of(pending[i]), dim);
+
+        for (size_t j = 0; j < count; ++j)
         {
-          std::cerr << "Warning: failed to load HNSW index from temp file: " << e.what() << std::endl;
+          float d = pending_dist[j];
+          if (top_candidates.size() < ef || d < lower_bound)
+          {
+            frontier.emplace(d, pending[j]);
+            if (accept(pending[j]))
+            {
+              top_candidates.emplace(d, pending[j]);
+              if (top_candidates.size() > ef)
+                top_candidates.pop();
+            }
+            if (!top_candidates.empty())
+              lower_bound = top_candidates.top().first;
+          }
         }
-        std::remove(tmp_hnsw_path.c_str());
+        // the next expansion reads this node's link list
+        if (ahead > 0 && !frontier.empty())
+          distance::prefetch(index.get_linklist0(frontier.top().second));
       }
+      index.visited_list_pool_->releaseVisitedList(visited);
 
-      for (const auto &kv : storage)
+      while (top_candidates.size() > k)
+        top_candidates.pop();
+      while (!top_candidates.empty())
       {
-        try
+        result.emplace(top_candidates.top().first, index.getExternalLabel(top_candidates.top().second));
+        top_candidates.pop();
+      }
+      return result;
+    }
+
+    bool rebuild_index(size_t new_max_elements)
+    {
+      hnswlib::HierarchicalNSW<float> *new_index = build_index(new_max_elements, *space, projection_matrix);
+      if (!new_index)
+        return false;
+      install_index(new_index, new_max_elements);
+      return true;
+    }
+
+    // a new graph over the stored vectors in target's space, projected
+    // through matrix when it is non-empty; nullptr if building fails
+    hnswlib::HierarchicalNSW<float> *build_index(size_t max_elements, KernelSpace &target, const std::vector<float> &matrix) const
+    {
+      hnswlib::HierarchicalNSW<float> *new_index = nullptr;
+      try
+      {
+        new_index = new hnswlib::HierarchicalNSW<float>(&target, max_elements, 16, 200, true);
+        std::vector<float> projected;
+        for (const auto &kv : storage)
         {
-          hnsw_index->addPoint(kv.second.vector.data(), kv.first);
+          new_index->addPoint(index_data(*record_of(kv.second), projected, matrix), kv.first);
         }
-        catch (...)
+      }
+      catch (const std::exception &e)
+      {
+        delete new_index;
+        std::cerr << "Rebuild failed: " << e.what() << std::endl;
+        return nullptr;
+      }
+      return new_index;
+    }
+
+    // replaces the graph with one from build_index() and refreshes what
+    // depends on its internal ids
+    void install_index(hnswlib::HierarchicalNSW<float> *new_index, size_t new_max_elements)
+    {
+      std::vector<uint8_t> codes;
+      if (quantizer.trained())
+        codes = remap_codes(*new_index);
+      release_memory_policy();
+      delete hnsw_index;
+      hnsw_index = new_index;
+      config.max_elements = new_max_elements;
+      repair_active = false;
+      repaired_tombstones = 0;
+      apply_memory_policy();
+      rebuild_entry_points();
+      if (quantizer.trained())
+        pq_codes.swap(codes);
+    }
+
+    // PQ codes of the current graph rearranged for target's internal ids (by
+    // label); only nodes without one are encoded
+    std::vector<uint8_t> remap_codes(const hnswlib::HierarchicalNSW<float> &target) const
+    {
+      const size_t code_bytes = quantizer.code_bytes();
+      std::vector<uint8_t> codes(target.cur_element_count * code_bytes);
+      for (hnswlib::tableint node = 0; node < target.cur_element_count; ++node)
+      {
+        uint8_t *code = &codes[node * code_bytes];
+        const uint8_t *current = nullptr;
+        if (hnsw_index)
         {
+          auto old = hnsw_index->label_lookup_.find(target.getExternalLabel(node));
+          if (old != hnsw_index->label_lookup_.end() && (old->second + 1) * code_bytes <= pq_codes.size())
+            current = &pq_codes[old->second * code_bytes];
         }
+        if (current)
+          std::memcpy(code, current, code_bytes);
+        else
+          quantizer.encode(reinterpret_cast<const float *>(target.getDataByInternalId(node)), code);
       }
-      return true;
+      return codes;
     }
 
-    bool add(VectorId id, const Vector &vec, const Metadata &meta)
+    // every graph node, breadth first over layer 0 from the entry point (then
+    // from any node not reached yet), so graph neighbors end up close together
+    std::vector<hnswlib::tableint> bfs_order() const
     {
-      if (vec.size() != config.vector_dim)
-        return false;
-      std::lock_guard<std::shared_mutex> lock(rw_mutex);
-      if (storage.count(id))
+      using hnswlib::tableint;
+      const auto &index = *hnsw_index;
+      const size_t count = index.cur_element_count;
+      std::vector<tableint> order;
+      order.reserve(count);
+      std::vector<bool> seen(count, false);
+      auto visit_from = [&](tableint root)
       {
-        remove_from_metadata_index(id);
-        try
+        seen[root] = true;
+        order.push_back(root);
+        for (size_t head = order.size() - 1; head < order.size(); ++head)
         {
-          hnsw_index->markDelete(id);
+          hnswlib::linklistsizeint *links = index.get_linklist0(order[head]);
+          unsigned short size = index.getListCount(links);
+          const tableint *neighbors = reinterpret_cast<const tableint *>(links + 1);
+          for (unsigned short i = 0; i < size; ++i)
+          {
+            if (!seen[neighbors[i]])
+            {
+              seen[neighbors[i]] = true;
+              order.push_back(neighbors[i]);
+            }
+          }
         }
-        catch (...)
+      };
+      if (count > 0)
+        visit_from(index.enterpoint_node_);
+      for (tableint node = 0; node < count; ++node)
+      {
+        if (!seen[node])
+          visit_from(node);
+      }
+      return order;
+    }
+
+    // Relabels internal ids in breadth-first order from the entry point on
+    // level 0, so graph neighbors end up in nearby level-0 slots. Unreachable
+    // nodes keep their relative order at the end. Blocks are permuted in place
+    // along cycles (one spare block of memory); then every link list, the
+    // label map and the entry point are rewritten. Caller holds the write lock.
+    void reorder_graph()
+    {
+      using hnswlib::tableint;
+      if (!hnsw_index)
+        return;
+      repair_active = false; // its cursor walks the old ids
+      auto &index = *hnsw_index;
+      const size_t count = index.cur_element_count;
+      if (count < 2)
+        return;
+
+      const std::vector<tableint> order = bfs_order(); // order[new_id] = old_id
+
+      std::vector<tableint> new_id(count);
+      for (tableint pos = 0; pos < count; ++pos)
+        new_id[order[pos]] = pos;
+
+      const size_t block_size = index.size_data_per_element_;
+      auto block = [&](tableint node)
+      { return index.data_level0_memory_ + node * block_size; };
+      std::vector<char> hold(block_size);
+      std::vector<bool> placed(count, false);
+      for (tableint start = 0; start < count; ++start)
+      {
+        if (placed[start] || order[start] == start)
+          continue;
+        std::memcpy(hold.data(), block(start), block_size);
+        tableint pos = start;
+        while (true)
         {
+          placed[pos] = true;
+          tableint src = order[pos];
+          if (src == start)
+          {
+            std::memcpy(block(pos), hold.data(), block_size);
+            break;
+          }
+          std::memcpy(block(pos), block(src), block_size);
+          pos = src;
         }
       }
-      storage[id] = {vec, meta};
-      try
+
+      std::vector<char *> link_lists(count);
+      std::vector<int> levels(count);
+      for (tableint old_node = 0; old_node < count; ++old_node)
       {
-        hnsw_index->addPoint(vec.data(), id);
+        link_lists[new_id[old_node]] = index.linkLists_[old_node];
+        levels[new_id[old_node]] = index.element_levels_[old_node];
       }
-      catch (const std::exception &e)
+      for (tableint node = 0; node < count; ++node)
       {
-        size_t proposed = std::max<size_t>(config.max_elements * 2, storage.size() + 10);
-        if (!rebuild_index(proposed))
+        index.linkLists_[node] = link_lists[node];
+        index.element_levels_[node] = levels[node];
+      }
+
+      auto remap = [&](hnswlib::linklistsizeint *links)
+      {
+        unsigned short size = index.getListCount(links);
+        tableint *neighbors = reinterpret_cast<tableint *>(links + 1);
+        for (unsigned short i = 0; i < size; ++i)
+          neighbors[i] = new_id[neighbors[i]];
+      };
+      for (tableint node = 0; node < count; ++node)
+      {
+        remap(index.get_linklist0(node));
+        for (int level = 1; level <= index.element_levels_[node]; ++level)
+          remap(index.get_linklist(node, level));
+      }
+
+      if (!pq_codes.empty())
+      {
+        const size_t code_bytes = quantizer.code_bytes();
+        std::vector<uint8_t> codes(pq_codes.size());
+        for (tableint old_node = 0; old_node < count; ++old_node)
+          std::memcpy(&codes[new_id[old_node] * code_bytes], &pq_codes[old_node * code_bytes], code_bytes);
+        pq_codes.swap(codes);
+      }
+
+      for (auto &entry : index.label_lookup_)
+        entry.second = new_id[entry.second];
+      std::unordered_set<tableint> deleted;
+      for (tableint node : index.deleted_elements)
+        deleted.insert(new_id[node]);
+      index.deleted_elements.swap(deleted);
+      index.enterpoint_node_ = new_id[index.enterpoint_node_];
+    }
+
+    // reads one byte per cache line, which faults the range in and leaves it cached
+    static uint64_t touch_range(const void *ptr, size_t bytes)
+    {
+      const volatile char *p = static_cast<const volatile char *>(ptr);
+      uint64_t sum = 0;
+      for (size_t offset = 0; offset < bytes; offset += 64)
+        sum += static_cast<unsigned char>(p[offset]);
+      return sum;
+    }
+
+    // Touches, in parallel: every upper-layer node (links and vector), then the
+    // level-0 neighborhoods of the global and partition entry points in
+    // breadth-first order until node_budget nodes are warm, then every
+    // posting list. Sample queries are replayed afterwards.
+    size_t warmup(size_t node_budget, const std::vector<Vector> &sample_queries) const
+    {
+      using hnswlib::tableint;
+      size_t touched = 0;
+      if (hnsw_index)
+      {
+        std::shared_lock<std::shared_mutex> lock(rw_mutex);
+        const auto &index = *hnsw_index;
+        const size_t count = index.cur_element_count;
+        std::vector<tableint> nodes;
+        std::vector<bool> seen(count, false);
+        auto take = [&](tableint node)
         {
-          return false;
+          if (seen[node] || nodes.size() >= node_budget)
+            return;
+          seen[node] = true;
+          nodes.push_back(node);
+        };
+        for (tableint node = 0; node < count; ++node)
+        {
+          if (index.element_levels_[node] > 0)
+            take(node);
+        }
+        std::vector<tableint> queue;
+        std::vector<bool> queued(count, false);
+        auto enqueue = [&](tableint node)
+        {
+          if (!queued[node])
+          {
+            queued[node] = true;
+            queue.push_back(node);
+          }
+        };
+        if (count > 0)
+          enqueue(index.enterpoint_node_);
+        for (const auto &[key, values] : entry_points)
+        {
+          for (const auto &[value, id] : values)
+          {
+            auto it = index.label_lookup_.find(id);
+            if (it != index.label_lookup_.end())
+              enqueue(it->second);
+          }
+        }
+        for (size_t head = 0; head < queue.size() && nodes.size() < node_budget; ++head)
+        {
+          take(queue[head]);
+          hnswlib::linklistsizeint *links = index.get_linklist0(queue[head]);
+          unsigned short size = index.getListCount(links);
+          const tableint *neighbors = reinterpret_cast<const tableint *>(links + 1);
+          for (unsigned short i = 0; i < size; ++i)
+            enqueue(neighbors[i]);
+        }
+
+        std::vector<const std::set<VectorId> *> postings;
+        for (const auto &[key, values] : metadata_index)
+        {
+          for (const auto &[value, ids] : values)
+            postings.push_back(&ids);
+        }
+
+        std::atomic<uint64_t> sink{0};
+        const size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), nodes.size() / 1024 + 1));
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+          workers.emplace_back([&, t]
+                               {
+            uint64_t local = 0;
+            const size_t begin = nodes.size() * t / threads;
+            const size_t end = nodes.size() * (t + 1) / threads;
+            for (size_t i = begin; i < end; ++i)
+            {
+              tableint node = nodes[i];
+              local += touch_range(index.get_linklist0(node), index.size_data_per_element_);
+              for (int level = 1; level <= index.element_levels_[node]; ++level)
+                local += touch_range(index.get_linklist(node, level), index.size_links_per_element_);
+            }
+            for (size_t i = t; i < postings.size(); i += threads)
+            {
+              for (VectorId id : *postings[i])
+                local += id;
+            }
+            sink.fetch_add(local, std::memory_order_relaxed); });
+        }
+        for (auto &worker : workers)
+          worker.join();
+        touched = nodes.size();
+      }
+      for (const auto &q : sample_queries)
+        query(q, 10);
+      return touched;
+    }
+
+    void encode_node(hnswlib::tableint node)
+    {
+      const size_t code_bytes = quantizer.code_bytes();
+      if (pq_codes.size() < (node + 1) * code_bytes)
+        pq_codes.resize((node + 1) * code_bytes);
+      quantizer.encode(reinterpret_cast<const float *>(hnsw_index->getDataByInternalId(node)), &pq_codes[node * code_bytes]);
+    }
+
+    void encode_all()
+    {
+      pq_codes.assign(hnsw_index->cur_element_count * quantizer.code_bytes(), 0);
+      for (hnswlib::tableint node = 0; node < hnsw_index->cur_element_count; ++node)
+        encode_node(node);
+    }
+
+    bool train_quantizer()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      if (config.pq_subspaces == 0 || config.element_type != ElementType::Float32 ||
+          config.metric != Metric::InnerProduct || !config.custom_metric.empty() || config.projection != Projection::None)
+      {
+        std::cerr << "train_quantizer() needs pq_subspaces > 0 and a float InnerProduct database without projection." << std::endl;
+        return false;
+      }
+      if (storage.empty())
+        return false;
+      constexpr size_t kMaxSample = 20000;
+      std::mt19937 rng(42);
+      std::vector<Record> records;
+      std::vector<const float *> sample = sample_vectors(kMaxSample, rng, records);
+      quantizer = AnisotropicQuantizer(config.vector_dim, config.pq_subspaces, config.pq_threshold);
+      quantizer.train(sample, 3, rng);
+      encode_all();
+      return true;
+    }
+
+    bool train_projection()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      if (config.projection != Projection::PCA)
+      {
+        std::cerr << "train_projection() needs Projection::PCA." << std::endl;
+        return false;
+      }
+      if (storage.empty())
+        return false;
+      constexpr size_t kMaxSample = 4096;
+      std::mt19937 rng(42);
+      std::vector<Record> records;
+      std::vector<const float *> sample = sample_vectors(kMaxSample, rng, records);
+      // the second moment keeps the directions inner products depend on
+      std::vector<float> matrix = projection::pca(sample, config.vector_dim, config.projected_dim, config.metric == Metric::L2, rng);
+      // the new graph gets its own space; the current graph, its space and
+      // the kernels stay as they are unless it builds
+      Config index_config = config;
+      index_config.vector_dim = config.projected_dim;
+      const distance::Kernels projected_kernels = kernels_for(index_config);
+      auto projected_space = std::make_unique<KernelSpace>(index_config, projected_kernels);
+      hnswlib::HierarchicalNSW<float> *new_index = build_index(static_cast<size_t>(config.max_elements), *projected_space, matrix);
+      if (!new_index)
+        return false;
+      projection_matrix = std::move(matrix);
+      kernels = projected_kernels;
+      // the old space outlives the old graph, deleted by install_index()
+      const std::unique_ptr<KernelSpace> old_space = std::exchange(space, std::move(projected_space));
+      install_index(new_index, static_cast<size_t>(config.max_elements));
+      return true;
+    }
+
+    // coarse quantizer, SQ8 bounds, training count and the ids of each list;
+    // the rows are rebuilt from storage on load
+    void write_ivf(std::ostream &os) const
+    {
+      uint64_t centroid_count = ivf.centroids().size();
+      write_le(os, centroid_count);
+      for (float value : ivf.centroids())
+        write_le(os, value);
+      uint64_t bound_count = ivf.bounds().size();
+      write_le(os, bound_count);
+      for (float value : ivf.bounds())
+        write_le(os, value);
+      write_le(os, ivf_trained_count);
+      uint64_t list_count = ivf.lists().size();
+      write_le(os, list_count);
+      for (const auto &list : ivf.lists())
+      {
+        uint64_t id_count = list.ids.size();
+        write_le(os, id_count);
+        for (VectorId id : list.ids)
+          write_le(os, id);
+      }
+    }
+
+    bool read_ivf(std::istream &is, std::vector<std::vector<VectorId>> &lists)
+    {
+      auto read_floats = [&is](std::vector<float> &values)
+      {
+        uint64_t count = 0;
+        read_le(is, count);
+        values.resize(static_cast<size_t>(count));
+        for (float &value : values)
+          read_le(is, value);
+      };
+      std::vector<float> centroids, bounds;
+      read_floats(centroids);
+      read_floats(bounds);
+      read_le(is, ivf_trained_count);
+      uint64_t list_count = 0;
+      read_le(is, list_count);
+      lists.resize(static_cast<size_t>(list_count));
+      for (auto &list : lists)
+      {
+        uint64_t id_count = 0;
+        read_le(is, id_count);
+        list.resize(static_cast<size_t>(id_count));
+        for (VectorId &id : list)
+          read_le(is, id);
+      }
+      if (centroids.empty())
+        return true;
+      if (!ivf.reset(std::move(centroids), std::move(bounds)) || lists.size() != ivf.lists().size())
+      {
+        std::cerr << "IVF lists do not match the configured dimension." << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    // stored vectors go back to their saved lists; any the file missed go to
+    // the nearest one
+    void fill_ivf(const std::vector<std::vector<VectorId>> &lists)
+    {
+      for (size_t list = 0; list < lists.size(); ++list)
+      {
+        for (VectorId id : lists[list])
+        {
+          auto it = storage.find(id);
+          if (it != storage.end())
+            ivf.add_to(list, id, it->second.vector.data());
+        }
+      }
+      if (ivf.size() == storage.size())
+        return;
+      for (const auto &kv : storage)
+      {
+        if (!ivf.contains(kv.first))
+          ivf.add(kv.first, kv.second.vector.data());
+      }
+    }
+
+    // Caller holds the write lock. k-means on up to 64 vectors per list, then
+    // every stored vector moves to its nearest centroid.
+    void retrain_ivf()
+    {
+      std::vector<VectorId> ids;
+      std::vector<const float *> vectors;
+      ids.reserve(storage.size());
+      vectors.reserve(storage.size());
+      for (const auto &kv : storage)
+      {
+        ids.push_back(kv.first);
+        vectors.push_back(kv.second.vector.data());
+      }
+      const size_t n = vectors.size();
+      const size_t lists = std::clamp<size_t>(config.ivf_lists ? config.ivf_lists : size_t(std::sqrt(double(n))), 1, n);
+      std::vector<const float *> sample = vectors;
+      std::mt19937 rng(42);
+      if (sample.size() > 64 * lists)
+      {
+        std::shuffle(sample.begin(), sample.end(), rng);
+        sample.resize(64 * lists);
+      }
+      ivf.train(sample, lists, rng);
+      std::vector<uint32_t> assigned(n);
+      kmeans::parallel_for(n, [&](size_t begin, size_t end)
+                           {
+        for (size_t i = begin; i < end; ++i)
+          assigned[i] = static_cast<uint32_t>(ivf.nearest_list(vectors[i])); });
+      for (size_t i = 0; i < n; ++i)
+        ivf.add_to(assigned[i], ids[i], vectors[i]);
+      ivf_trained_count = n;
+    }
+
+    bool train_ivf()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      if (hnsw_index)
+      {
+        std::cerr << "train_ivf() needs IndexType::IVF." << std::endl;
+        return false;
+      }
+      if (storage.empty())
+        return false;
+      retrain_ivf();
+      return true;
+    }
+
+    bool build_disk_index(const std::string &path, const DiskIndexConfig &disk_config) const
+    {
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      if (config.element_type != ElementType::Float32 || !config.custom_metric.empty())
+      {
+        std::cerr << "build_disk_index() needs float vectors and a built-in metric." << std::endl;
+        return false;
+      }
+      std::vector<VectorId> ids;
+      std::vector<const float *> vectors;
+      std::vector<Record> records;
+      ids.reserve(storage.size());
+      vectors.reserve(storage.size());
+      records.reserve(storage.size());
+      for (const auto &kv : storage)
+      {
+        ids.push_back(kv.first);
+        records.push_back(record_of(kv.second));
+        vectors.push_back(records.back()->vector.data());
+      }
+      return vamana::write_disk_index(path, ids, vectors, config.vector_dim, config.metric, disk_config);
+    }
+
+    Clustering cluster(size_t k, size_t iterations, size_t sample_size, const Metadata &filter) const
+    {
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      if (config.element_type != ElementType::Float32)
+      {
+        std::cerr << "cluster() needs float vectors." << std::endl;
+        return {};
+      }
+      Clustering result;
+      if (filter.empty())
+      {
+        result.ids.reserve(storage.size());
+        for (const auto &kv : storage)
+          result.ids.push_back(kv.first);
+      }
+      else
+      {
+        const std::set<VectorId> candidates = filter_candidates(filter);
+        result.ids.assign(candidates.begin(), candidates.end());
+      }
+      const size_t n = result.ids.size();
+      if (k == 0 || n == 0)
+        return {};
+      const size_t dim = config.vector_dim;
+      std::vector<Record> records;
+      records.reserve(n);
+      for (VectorId id : result.ids)
+        records.push_back(record_of(storage.at(id)));
+
+      std::mt19937 rng(42);
+      std::vector<size_t> sample(n);
+      std::iota(sample.begin(), sample.end(), 0);
+      if (sample_size && sample_size < n)
+      {
+        std::shuffle(sample.begin(), sample.end(), rng);
+        sample.resize(sample_size);
+      }
+      std::vector<float> points(sample.size() * dim);
+      for (size_t i = 0; i < sample.size(); ++i)
+        std::copy_n(records[sample[i]]->vector.data(), dim, &points[i * dim]);
+      std::vector<float> centroids = kmeans::train(points.data(), sample.size(), dim, std::min(k, sample.size()), iterations, rng);
+      points = {};
+
+      result.assignments.resize(n);
+      const distance::Kernels kernels = kmeans::l2_kernels(dim);
+      kmeans::parallel_for(n, [&](size_t begin, size_t end)
+                           {
+        for (size_t i = begin; i < end; ++i)
+          result.assignments[i] = static_cast<uint32_t>(kmeans::nearest(records[i]->vector.data(), centroids, dim, kernels)); });
+      result.centroids.resize(centroids.size() / dim);
+      for (size_t c = 0; c < result.centroids.size(); ++c)
+        result.centroids[c].assign(&centroids[c * dim], &centroids[(c + 1) * dim]);
+      return result;
+    }
+
+    // Rewrites each link list of a live node that points at tombstones. The
+    // candidates are its live neighbors plus the live nodes reached through
+    // the removed ones (following chains of removed nodes, a bounded number
+    // of hops); the HNSW heuristic picks diverse neighbors first and the
+    // nearest of the rest refill the list to the level's degree, so repaired
+    // nodes do not lose connectivity. Returns the number of lists rewritten.
+    // Caller holds the write lock.
+    size_t repair_node(hnswlib::tableint node)
+    {
+      using hnswlib::tableint;
+      using Candidate = std::pair<float, tableint>;
+      using Candidates = std::priority_queue<Candidate, std::vector<Candidate>, hnswlib::HierarchicalNSW<float>::CompareByFirst>;
+      auto &index = *hnsw_index;
+      if (index.isMarkedDeleted(node))
+        return 0;
+      const void *data = index.getDataByInternalId(node);
+      size_t rewritten = 0;
+      for (int level = 0; level <= index.element_levels_[node]; ++level)
+      {
+        hnswlib::linklistsizeint *links = index.get_linklist_at_level(node, level);
+        const unsigned short size = index.getListCount(links);
+        tableint *neighbors = reinterpret_cast<tableint *>(links + 1);
+        if (std::none_of(neighbors, neighbors + size, [&](tableint n)
+                         { return index.isMarkedDeleted(n); }))
+          continue;
+        const size_t degree = level ? index.maxM_ : index.maxM0_;
+        std::unordered_set<tableint> seen{node};
+        std::vector<Candidate> live;
+        std::vector<tableint> removed;
+        auto offer = [&](tableint n)
+        {
+          if (!seen.insert(n).second)
+            return;
+          if (index.isMarkedDeleted(n))
+            removed.push_back(n);
+          else
+            live.emplace_back(index.fstdistfunc_(data, index.getDataByInternalId(n), index.dist_func_param_), n);
+        };
+        for (unsigned short i = 0; i < size; ++i)
+          offer(neighbors[i]);
+        for (size_t r = 0; r < removed.size() && r < 2 * degree; ++r)
+        {
+          hnswlib::linklistsizeint *removed_links = index.get_linklist_at_level(removed[r], level);
+          const tableint *next = reinterpret_cast<const tableint *>(removed_links + 1);
+          for (unsigned short j = 0; j < index.getListCount(removed_links); ++j)
+            offer(next[j]);
+        }
+        std::sort(live.begin(), live.end());
+        Candidates candidates(live.begin(), live.end());
+        index.getNeighborsByHeuristic2(candidates, degree);
+        std::unordered_set<tableint> picked;
+        std::vector<tableint> kept;
+        for (; !candidates.empty(); candidates.pop())
+        {
+          picked.insert(candidates.top().second);
+          kept.push_back(candidates.top().second);
+        }
+        for (size_t i = 0; i < live.size() && kept.size() < degree; ++i)
+        {
+          if (!picked.count(live[i].second))
+            kept.push_back(live[i].second);
+        }
+        std::lock_guard<std::mutex> lock(index.link_list_locks_[node]);
+        std::copy(kept.begin(), kept.end(), neighbors);
+        index.setListCount(links, static_cast<unsigned short>(kept.size()));
+        ++rewritten;
+      }
+      return rewritten;
+    }
+
+    // Caller holds the write lock. Repairs up to budget more nodes of the
+    // current pass; without one, starts a pass once the tombstones no pass
+    // has cleared reach repair_threshold of the graph (or any, when forced).
+    // Returns the number of link lists rewritten.
+    size_t repair_step(size_t budget, bool force)
+    {
+      if (!hnsw_index)
+        return 0;
+      auto &index = *hnsw_index;
+      const size_t nodes = index.cur_element_count;
+      if (!repair_active)
+      {
+        const size_t tombstones = index.getDeletedCount();
+        const size_t pending = tombstones - std::min(tombstones, repaired_tombstones);
+        if (pending == 0 || (!force && (config.repair_threshold <= 0.0f || double(pending) < double(config.repair_threshold) * double(nodes))))
+          return 0;
+        repair_active = true;
+        repair_cursor = 0;
+        repair_target = tombstones;
+      }
+      size_t rewritten = 0;
+      const size_t end = std::min(nodes, repair_cursor + budget);
+      for (; repair_cursor < end; ++repair_cursor)
+        rewritten += repair_node(static_cast<hnswlib::tableint>(repair_cursor));
+      if (repair_cursor >= nodes)
+      {
+        repair_active = false;
+        repaired_tombstones = repair_target;
+      }
+      return rewritten;
+    }
+
+    // a fresh pass over the whole graph, one slice per write lock so queries
+    // run in between
+    size_t repair_graph()
+    {
+      constexpr size_t kSlice = 1024;
+      size_t rewritten = 0;
+      {
+        std::lock_guard<std::shared_mutex> lock(rw_mutex);
+        if (!hnsw_index)
+          return 0;
+        repair_active = false;
+        repaired_tombstones = 0;
+        rewritten += repair_step(kSlice, true);
+        if (!repair_active)
+          return rewritten;
+      }
+      while (true)
+      {
+        std::lock_guard<std::shared_mutex> lock(rw_mutex);
+        rewritten += repair_step(kSlice, true);
+        if (!repair_active)
+          return rewritten;
+      }
+    }
+
+    // Measures graph recall@k of held-out stored vectors (the graph walk for
+    // each one cannot step on or return its own node, as if it had never been
+    // added) against exact ground truth, then finds the smallest ef
+    // meeting target_recall: doubling from k until it is met, then a binary
+    // search below that. The result becomes Config::ef_search.
+    uint32_t autotune(float target_recall, size_t k, size_t sample_queries)
+    {
+      if (!hnsw_index || k == 0 || sample_queries == 0)
+        return 0;
+      const ElementType type = config.element_type;
+      const size_t units = distance::stored_units(type, config.vector_dim);
+      const size_t stride = distance::vector_bytes(type, config.vector_dim);
+      std::vector<VectorId> ids;
+      std::vector<char> data;
+      size_t live = 0;
+      bool projected = false;
+      {
+        std::shared_lock<std::shared_mutex> lock(rw_mutex);
+        live = storage.size();
+        projected = !projection_matrix.empty();
+        if (live <= k)
+          return 0;
+        std::mt19937 rng(42);
+        for (const auto &kv : storage)
+          ids.push_back(kv.first);
+        if (ids.size() > sample_queries)
+        {
+          std::shuffle(ids.begin(), ids.end(), rng);
+          ids.resize(sample_queries);
+        }
+        const std::vector<Record> records = fetch_batch(ids);
+        data.resize(ids.size() * stride);
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+          const void *src = type == ElementType::Float32 ? static_cast<const void *>(records[i]->vector.data()) : records[i]->codes.data();
+          std::memcpy(&data[i * stride], src, stride);
+        }
+      }
+      const size_t nq = ids.size();
+      // the k nearest of each query other than itself
+      auto without_self = [&](std::vector<QueryResult> results, size_t q)
+      {
+        std::vector<VectorId> kept;
+        for (const auto &r : results)
+        {
+          if (r.id != ids[q] && kept.size() < k)
+            kept.push_back(r.id);
+        }
+        return kept;
+      };
+
+      // ground truth is a brute force over the stored vectors in the original
+      // space, also when the graph indexes projections of them
+      QueryOptions exact;
+      exact.strategy = SearchStrategy::Exact;
+      std::vector<std::vector<VectorId>> truth(nq);
+      if (projected)
+      {
+        std::shared_lock<std::shared_mutex> lock(rw_mutex);
+        for (size_t q = 0; q < nq; ++q)
+          truth[q] = without_self(exact_scan_full(reinterpret_cast<const float *>(&data[q * stride]), k + 1, {}), q);
+      }
+      else if (type == ElementType::Float32)
+      {
+        std::vector<Vector> queries(nq);
+        for (size_t q = 0; q < nq; ++q)
+          queries[q].assign(reinterpret_cast<const float *>(&data[q * stride]), reinterpret_cast<const float *>(&data[q * stride]) + config.vector_dim);
+        std::vector<std::vector<QueryResult>> found = query_batch(queries, k + 1, {}, exact);
+        for (size_t q = 0; q < nq; ++q)
+          truth[q] = without_self(std::move(found[q]), q);
+      }
+      else
+      {
+        for (size_t q = 0; q < nq; ++q)
+          truth[q] = without_self(query(type, &data[q * stride], units, k + 1, {}, exact), q);
+      }
+
+      auto recall = [&](size_t ef)
+      {
+        QueryOptions options;
+        options.strategy = SearchStrategy::Graph;
+        options.ef = static_cast<uint32_t>(ef);
+        std::vector<size_t> hits(nq, 0);
+        std::atomic<size_t> next{0};
+        auto work = [&]
+        {
+          for (size_t q = next++; q < nq; q = next++)
+          {
+            for (VectorId id : without_self(query(type, &data[q * stride], units, k, {}, options, &ids[q]), q))
+              hits[q] += std::find(truth[q].begin(), truth[q].end(), id) != truth[q].end();
+          }
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < std::min<size_t>(std::thread::hardware_concurrency(), nq); ++t)
+          workers.emplace_back(work);
+        work();
+        for (auto &worker : workers)
+          worker.join();
+        size_t total = 0, wanted = 0;
+        for (size_t q = 0; q < nq; ++q)
+        {
+          total += hits[q];
+          wanted += truth[q].size();
+        }
+        return wanted ? double(total) / double(wanted) : 1.0;
+      };
+
+      const size_t max_ef = std::max<size_t>(live, k);
+      size_t low = k, high = k;
+      bool met = recall(high) >= target_recall;
+      while (!met && high < max_ef)
+      {
+        low = high + 1;
+        high = std::min(high * 2, max_ef);
+        met = recall(high) >= target_recall;
+      }
+      if (!met)
+        std::cerr << "autotune(): recall " << target_recall << " not reached; using ef " << high << "." << std::endl;
+      while (low < high)
+      {
+        const size_t mid = low + (high - low) / 2;
+        if (recall(mid) >= target_recall)
+          high = mid;
+        else
+          low = mid + 1;
+      }
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      config.ef_search = static_cast<uint32_t>(std::min<size_t>(high, std::numeric_limits<uint32_t>::max()));
+      return config.ef_search;
+    }
+
+    // Caller holds a lock. The stored ids with near neighbors next to each
+    // other: graph BFS order, IVF list by list, or storage order before the
+    // lists are trained.
+    std::vector<VectorId> locality_order() const
+    {
+      std::vector<VectorId> ids;
+      ids.reserve(storage.size());
+      if (hnsw_index)
+      {
+        const auto &index = *hnsw_index;
+        for (hnswlib::tableint node : bfs_order())
+        {
+          if (!index.isMarkedDeleted(node))
+            ids.push_back(index.getExternalLabel(node));
+        }
+      }
+      else if (ivf.size() == storage.size())
+      {
+        for (const auto &list : ivf.lists())
+          ids.insert(ids.end(), list.ids.begin(), list.ids.end());
+      }
+      else
+      {
+        for (const auto &kv : storage)
+          ids.push_back(kv.first);
+      }
+      return ids;
+    }
+
+    // Every stored vector is a query against target, in locality order. In a
+    // self-join each graph walk starts at the source's own node, already
+    // among its neighbors, so it skips the descent from the entry point and
+    // consecutive walks cover neighboring parts of the graph; a walk in
+    // another database starts at its entry point. Sources are copied out a
+    // chunk at a time under our lock; the queries then run unlocked here (the
+    // target takes its own lock, which may be ours for a self-join) with
+    // threads taking short runs of consecutive sources.
+    bool knn_join(const Impl &target, size_t k, const JoinCallback &on_result, const Metadata &filter, size_t threads) const
+    {
+      if (config.element_type != target.config.element_type || config.vector_dim != target.config.vector_dim)
+      {
+        std::cerr << "knn_join() needs databases of the same element type and dimension." << std::endl;
+        return false;
+      }
+      if (!on_result)
+        return false;
+      const bool self = &target == this;
+      std::vector<VectorId> order;
+      {
+        std::shared_lock<std::shared_mutex> lock(rw_mutex);
+        order = locality_order();
+      }
+      if (k == 0 || order.empty())
+        return true;
+      if (threads == 0)
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+      constexpr size_t kChunk = 4096;
+      constexpr size_t kRun = 32;
+      const ElementType type = config.element_type;
+      const size_t units = distance::stored_units(type, config.vector_dim);
+      const size_t stride = distance::vector_bytes(type, config.vector_dim);
+      std::mutex emit_mutex;
+      std::vector<VectorId> ids;
+      std::vector<char> data;
+      for (size_t begin = 0; begin < order.size(); begin += kChunk)
+      {
+        ids.clear();
+        {
+          std::shared_lock<std::shared_mutex> lock(rw_mutex);
+          for (size_t i = begin; i < std::min(begin + kChunk, order.size()); ++i)
+          {
+            if (storage.count(order[i]))
+              ids.push_back(order[i]);
+          }
+          const std::vector<Record> records = fetch_batch(ids);
+          data.resize(ids.size() * stride);
+          for (size_t i = 0; i < ids.size(); ++i)
+          {
+            const void *src = type == ElementType::Float32 ? static_cast<const void *>(records[i]->vector.data()) : records[i]->codes.data();
+            std::memcpy(&data[i * stride], src, stride);
+          }
+        }
+        std::atomic<size_t> next{0};
+        auto work = [&]
+        {
+          for (size_t run = next.fetch_add(kRun); run < ids.size(); run = next.fetch_add(kRun))
+          {
+            for (size_t i = run; i < std::min(run + kRun, ids.size()); ++i)
+            {
+              std::vector<QueryResult> neighbors = target.query(type, &data[i * stride], units, self ? k + 1 : k, filter, QueryOptions(), nullptr, self ? &ids[i] : nullptr);
+              if (self)
+              {
+                neighbors.erase(std::remove_if(neighbors.begin(), neighbors.end(), [&](const QueryResult &r)
+                                               { return r.id == ids[i]; }),
+                                neighbors.end());
+                if (neighbors.size() > k)
+                  neighbors.resize(k);
+              }
+              std::lock_guard<std::mutex> lock(emit_mutex);
+              on_result(ids[i], neighbors);
+            }
+          }
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < std::min(threads, (ids.size() + kRun - 1) / kRun); ++t)
+          workers.emplace_back(work);
+        work();
+        for (auto &worker : workers)
+          worker.join();
+      }
+      return true;
+    }
+
+    bool optimize_layout()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      reorder_graph();
+      return true;
+    }
+
+    bool save()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+
+      if (config.optimize_layout_on_save)
+        reorder_graph();
+
+      const std::string tmp_db_path = db_path + ".tmp";
+      const std::string tmp_hnsw_path = db_path + ".hnsw.tmp";
+
+      std::stringstream hnsw_stream;
+      uint64_t hnsw_size = 0;
+      if (hnsw_index)
+      {
+        try
+        {
+          hnsw_index->saveIndex(tmp_hnsw_path);
+        }
+        catch (const std::exception &e)
+        {
+          std::cerr << "Failed to save HNSW index to temporary file: " << e.what() << std::endl;
+          return false;
+        }
+
+        std::ifstream hnsw_ifs(tmp_hnsw_path, std::ios::binary);
+        if (!hnsw_ifs)
+        {
+          std::remove(tmp_hnsw_path.c_str());
+          return false;
+        }
+        hnsw_stream << hnsw_ifs.rdbuf();
+        hnsw_ifs.seekg(0, std::ios::end);
+        hnsw_size = hnsw_ifs.tellg();
+      }
+      std::remove(tmp_hnsw_path.c_str());
+
+      std::ofstream file(tmp_db_path, std::ios::binary | std::ios::out | std::ios::trunc);
+      if (!file)
+        return false;
+      // everything but the trailer goes through ofs, which checksums it
+      crc32c::ostreambuf checksummed(file.rdbuf());
+      std::ostream ofs(&checksummed);
+
+      ofs.write("ORIONDB2", 8);
+      uint32_t format_version = kFormatVersion;
+      write_le(ofs, format_version);
+
+      write_config(ofs, config);
+      const std::vector<float> &codebook = quantizer.codebook();
+      uint64_t codebook_size = codebook.size();
+      write_le(ofs, codebook_size);
+      for (float value : codebook)
+        write_le(ofs, value);
+      // by internal id, so they stay valid for the saved graph
+      uint64_t codes_size = quantizer.trained() ? pq_codes.size() : 0;
+      write_le(ofs, codes_size);
+      ofs.write(reinterpret_cast<const char *>(pq_codes.data()), static_cast<std::streamsize>(codes_size));
+      uint64_t matrix_size = projection_matrix.size();
+      write_le(ofs, matrix_size);
+      for (float value : projection_matrix)
+        write_le(ofs, value);
+      write_ivf(ofs);
+
+      uint64_t storage_count = storage.size();
+      write_le(ofs, storage_count);
+      std::vector<std::pair<uint64_t, uint64_t>> placed; // tiered: offset and length of each record
+      for (const auto &kv : storage)
+      {
+        write_le(ofs, kv.first);
+        const uint64_t start = static_cast<uint64_t>(ofs.tellp());
+        write_vector_data(ofs, *record_of(kv.second));
+        if (config.tiered_storage)
+          placed.emplace_back(start, static_cast<uint64_t>(ofs.tellp()) - start);
+      }
+
+      std::stringstream meta_idx_stream;
+      uint64_t outer_map_size = metadata_index.size();
+      write_le(meta_idx_stream, outer_map_size);
+      for (const auto &outer : metadata_index)
+      {
+        write_string(meta_idx_stream, outer.first);
+        uint64_t inner_map_size = outer.second.size();
+        write_le(meta_idx_stream, inner_map_size);
+        for (const auto &inner : outer.second)
+        {
+          write_metadata_value(meta_idx_stream, inner.first);
+          uint64_t id_set_size = inner.second.size();
+          write_le(meta_idx_stream, id_set_size);
+          for (auto id : inner.second)
+            write_le(meta_idx_stream, id);
+        }
+      }
+      meta_idx_stream.seekg(0, std::ios::end);
+      uint64_t meta_idx_size = static_cast<uint64_t>(meta_idx_stream.tellg());
+      meta_idx_stream.seekg(0, std::ios::beg);
+
+      write_le(ofs, meta_idx_size);
+      ofs << meta_idx_stream.rdbuf();
+
+      write_le(ofs, hnsw_size);
+      if (hnsw_size > 0)
+        ofs << hnsw_stream.rdbuf();
+
+      ofs.flush();
+      const uint32_t crc = checksummed.crc();
+      write_le(file, crc);
+      file.flush();
+      if (!ofs || !file)
+      {
+        std::cerr << "Failed to write " << tmp_db_path << std::endl;
+        return false;
+      }
+
+#if defined(_WIN32)
+      {
+        HANDLE hFile = CreateFileA(tmp_db_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+          FlushFileBuffers(hFile);
+          CloseHandle(hFile);
+        }
+      }
+#else
+      int fd_sync = ::open(tmp_db_path.c_str(), O_RDONLY);
+      if (fd_sync != -1)
+      {
+        ::fsync(fd_sync);
+        ::close(fd_sync);
+      }
+#endif
+
+      file.close();
+
+      if (std::rename(tmp_db_path.c_str(), db_path.c_str()) != 0)
+      {
+        std::cerr << "Error: Cannot atomically rename tmp DB file to final DB file: errno=" << errno << std::endl;
+        return false;
+      }
+      if (config.tiered_storage)
+        spill(placed);
+      return true;
+    }
+
+    bool load()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      std::ifstream ifs(db_path, std::ios::binary | std::ios::in);
+      if (!ifs)
+        return false;
+
+      char magic[8];
+      ifs.read(magic, 8);
+      if (std::memcmp(magic, "ORIONDB2", 8) != 0)
+      {
+        std::cerr << "Invalid or unsupported DB magic." << std::endl;
+        return false;
+      }
+      uint32_t format_version = 0;
+      read_le(ifs, format_version);
+      if (format_version > kFormatVersion)
+      {
+        std::cerr << "Unsupported DB format version " << format_version << "." << std::endl;
+        return false;
+      }
+      read_config(ifs, config, format_version);
+      if (!metric_available(config) || !projection_valid(config) || !index_valid(config))
+        return false;
+      quantizer = AnisotropicQuantizer(config.vector_dim, config.pq_subspaces, config.pq_threshold);
+      pq_codes.clear();
+      if (format_version >= 11)
+      {
+        uint64_t codebook_size = 0;
+        read_le(ifs, codebook_size);
+        std::vector<float> codebook(static_cast<size_t>(codebook_size));
+        for (float &value : codebook)
+          read_le(ifs, value);
+        if (codebook_size > 0 && !quantizer.set_codebook(std::move(codebook)))
+        {
+          std::cerr << "PQ codebook does not match the configured dimension." << std::endl;
+          return false;
+        }
+      }
+      std::vector<uint8_t> saved_codes;
+      if (format_version >= 19)
+      {
+        uint64_t codes_size = 0;
+        read_le(ifs, codes_size);
+        if (codes_size % std::max<size_t>(quantizer.code_bytes(), 1) != 0)
+        {
+          std::cerr << "PQ codes do not match the codebook." << std::endl;
+          return false;
+        }
+        saved_codes.resize(static_cast<size_t>(codes_size));
+        ifs.read(reinterpret_cast<char *>(saved_codes.data()), static_cast<std::streamsize>(codes_size));
+      }
+      projection_matrix.clear();
+      if (format_version >= 12)
+      {
+        uint64_t matrix_size = 0;
+        read_le(ifs, matrix_size);
+        if (matrix_size != 0 && matrix_size != uint64_t(config.projected_dim) * config.vector_dim)
+        {
+          std::cerr << "Projection matrix does not match the configured dimensions." << std::endl;
+          return false;
+        }
+        projection_matrix.resize(static_cast<size_t>(matrix_size));
+        for (float &value : projection_matrix)
+          read_le(ifs, value);
+      }
+      std::vector<std::vector<VectorId>> ivf_lists;
+      ivf = InvertedFileIndex(config.vector_dim, config.ivf_sq8);
+      ivf_trained_count = 0;
+      if (format_version >= 13 && !read_ivf(ifs, ivf_lists))
+        return false;
+
+      release_memory_policy();
+      delete hnsw_index;
+      hnsw_index = nullptr;
+      select_kernels();
+      if (config.index_type == IndexType::HNSW)
+        hnsw_index = new hnswlib::HierarchicalNSW<float>(space.get(), static_cast<size_t>(config.max_elements), 16, 200, true);
+
+      uint64_t storage_count = 0;
+      read_le(ifs, storage_count);
+      storage.clear();
+      for (uint64_t i = 0; i < storage_count; ++i)
+      {
+        VectorId id;
+        read_le(ifs, id);
+        const uint64_t start = static_cast<uint64_t>(ifs.tellg());
+        VectorData data = read_vector_data(ifs);
+        if (config.tiered_storage)
+        {
+          data = VectorData{};
+          data.offset = start;
+          data.length = static_cast<uint64_t>(ifs.tellg()) - start;
+        }
+        storage[id] = std::move(data);
+      }
+
+      metadata_index.clear();
+      uint64_t meta_idx_size = 0;
+      read_le(ifs, meta_idx_size);
+      if (meta_idx_size > 0)
+      {
+        std::string meta_idx_buffer(static_cast<size_t>(meta_idx_size), '\0');
+        ifs.read(&meta_idx_buffer[0], static_cast<std::streamsize>(meta_idx_size));
+        std::stringstream meta_idx_stream(meta_idx_buffer, std::ios::binary | std::ios::in);
+
+        uint64_t outer_map_size = 0;
+        read_le(meta_idx_stream, outer_map_size);
+        for (uint64_t i = 0; i < outer_map_size; ++i)
+        {
+          std::string outer_key = read_string(meta_idx_stream);
+          uint64_t inner_map_size = 0;
+          read_le(meta_idx_stream, inner_map_size);
+          for (uint64_t j = 0; j < inner_map_size; ++j)
+          {
+            MetadataValue mv = read_metadata_value(meta_idx_stream);
+            uint64_t id_set_size = 0;
+            read_le(meta_idx_stream, id_set_size);
+            std::set<VectorId> ids;
+            for (uint64_t k = 0; k < id_set_size; ++k)
+            {
+              VectorId id_val;
+              read_le(meta_idx_stream, id_val);
+              ids.insert(id_val);
+            }
+            metadata_index[outer_key][mv] = std::move(ids);
+          }
+        }
+      }
+
+      uint64_t hnsw_size = 0;
+      read_le(ifs, hnsw_size);
+      bool graph_loaded = false;
+      if (hnsw_size > 0 && hnsw_index)
+      {
+        std::string hnsw_buffer(static_cast<size_t>(hnsw_size), '\0');
+        ifs.read(&hnsw_buffer[0], static_cast<std::streamsize>(hnsw_size));
+
+        const std::string tmp_hnsw_path = db_path + ".hnsw.load.tmp";
+        {
+          std::ofstream hnsw_ofs(tmp_hnsw_path, std::ios::binary);
+          hnsw_ofs.write(hnsw_buffer.data(), hnsw_buffer.size());
+        }
+
+        try
+        {
+          hnsw_index->loadIndex(tmp_hnsw_path, space.get());
+          graph_loaded = true;
+        }
+        catch (const std::exception &e)
+        {
+          std::cerr << "Warning: failed to load HNSW index from temp file: " << e.what() << std::endl;
+        }
+        std::remove(tmp_hnsw_path.c_str());
+      }
+
+      if (records_fd != -1)
+        ::close(records_fd);
+      records_fd = config.tiered_storage ? ::open(db_path.c_str(), O_RDONLY) : -1;
+      std::vector<float> projected;
+      for (const auto &kv : storage)
+      {
+        if (!hnsw_index)
+          break;
+        // tiered records are only read for nodes the saved graph lacks
+        if (!kv.second.resident() && hnsw_index->label_lookup_.count(kv.first))
+          continue;
+        try
+        {
+          hnsw_index->addPoint(index_data(*record_of(kv.second), projected), kv.first);
+        }
+        catch (...)
+        {
+        }
+      }
+      if (ivf.trained())
+        fill_ivf(ivf_lists);
+      apply_memory_policy();
+      rebuild_entry_points();
+      if (quantizer.trained())
+      {
+        // the saved codes belong to the saved graph; only nodes added since
+        // (or all of them if the graph did not load) are encoded here
+        const size_t saved = graph_loaded ? saved_codes.size() / quantizer.code_bytes() : 0;
+        pq_codes = std::move(saved_codes);
+        for (hnswlib::tableint node = static_cast<hnswlib::tableint>(saved); node < hnsw_index->cur_element_count; ++node)
+          encode_node(node);
+        pq_codes.resize(hnsw_index->cur_element_count * quantizer.code_bytes());
+      }
+      return true;
+    }
+
+    bool add(VectorId id, const Vector &vec, const Metadata &meta)
+    {
+      if (config.element_type != ElementType::Float32)
+        return false;
+      return add(id, VectorData{vec, {}, meta});
+    }
+
+    template <typename T>
+    bool add(VectorId id, std::span<const T> vec, const Metadata &meta)
+    {
+      if (config.element_type != element_type_of<T>())
+        return false;
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *>(vec.data());
+      return add(id, VectorData{{}, std::vector<uint8_t>(bytes, bytes + vec.size()), meta});
+    }
+
+    bool add(VectorId id, VectorData data)
+    {
+      if (element_count(data) != distance::stored_units(config.element_type, config.vector_dim))
+        return false;
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      if (storage.count(id))
+      {
+        remove_from_metadata_index(id);
+        forget_cached(id);
+        try
+        {
+          if (hnsw_index)
+            hnsw_index->markDelete(id);
+        }
+        catch (...)
+        {
+        }
+      }
+      const VectorData &stored = storage[id] = std::move(data);
+      const Metadata &meta = stored.metadata;
+      if (hnsw_index && !add_to_graph(id, stored))
+        return false;
+      if (!hnsw_index && ivf.trained())
+        ivf.add(id, stored.vector.data());
+      for (const auto &[key, value] : meta)
+      {
+        metadata_index[key][value].insert(id);
+      }
+      add_to_entry_points(id, meta);
+      if (!hnsw_index)
+      {
+        // rebalance: the lists were sized for half as many vectors
+        if (storage.size() >= config.ivf_train_size && storage.size() >= 2 * ivf_trained_count)
+          retrain_ivf();
+        return true;
+      }
+      if (config.lock_memory)
+        lock_upper_links(hnsw_index->label_lookup_.at(id));
+      if (quantizer.trained())
+        encode_node(hnsw_index->label_lookup_.at(id));
+      return true;
+    }
+
+    bool add_batch(const std::vector<VectorId> &ids, const std::vector<Vector> &vectors, const std::vector<Metadata> &metas)
+    {
+      if (config.element_type != ElementType::Float32 || ids.size() != vectors.size() || (!metas.empty() && metas.size() != ids.size()))
+        return false;
+      for (const Vector &v : vectors)
+      {
+        if (v.size() != config.vector_dim)
+          return false;
+      }
+      return insert_rows(ids, [&vectors](size_t i)
+                         { return vectors[i].data(); }, metas);
+    }
+
+    // import_npy() / import_fvecs(): the matrix is mapped and validated
+    // against vector_dim, ids and metadata are read per row, and
+    // insert_rows() copies each row from the mapping into storage
+    bool import_matrix(const std::string &path, bool npy, const ImportOptions &options)
+    {
+      auto fail = [&path](const std::string &what)
+      {
+        std::cerr << "Failed to import " << path << ": " << what << std::endl;
+        return false;
+      };
+      if (config.element_type != ElementType::Float32)
+        return fail("only float databases import matrices");
+      const import::MappedFile file(path);
+      if (!file.data())
+        return fail("cannot map the file: errno=" + std::to_string(errno));
+      std::string error;
+      const std::optional<import::Matrix> matrix = npy ? import::npy_matrix(file, config.vector_dim, error) : import::fvecs_matrix(file, config.vector_dim, error);
+      if (!matrix)
+        return fail(error);
+
+      std::vector<VectorId> ids;
+      if (!options.ids_path.empty())
+      {
+        std::optional<std::vector<VectorId>> read = import::read_ids(options.ids_path, error);
+        if (!read)
+          return fail(error);
+        if (read->size() != matrix->rows)
+          return fail(std::to_string(read->size()) + " ids for " + std::to_string(matrix->rows) + " rows");
+        ids = std::move(*read);
+      }
+      else
+      {
+        ids.resize(matrix->rows);
+        std::iota(ids.begin(), ids.end(), options.id_start);
+      }
+      std::vector<Metadata> metas;
+      if (!options.metadata_path.empty())
+      {
+        std::ifstream is(options.metadata_path);
+        metas.resize(matrix->rows);
+        std::string line;
+        for (size_t i = 0; i < matrix->rows; ++i)
+        {
+          std::optional<VectorId> id;
+          if (!std::getline(is, line) || !import::parse_json_line(line, metas[i], id))
+            return fail("bad or missing metadata on line " + std::to_string(i + 1) + " of " + options.metadata_path);
+          if (id)
+            ids[i] = *id;
+        }
+      }
+      return insert_rows(ids, [&matrix](size_t i)
+                         { return matrix->row(i); }, metas);
+    }
+
+    // Storage, metadata and entry points are updated in order under the
+    // write lock, then the graph inserts run across threads (hnswlib locks
+    // each node it links). A repeated id keeps its last vector. IVF
+    // databases add one by one. row(i) points at vector_dim floats.
+    template <typename Row>
+    bool insert_rows(const std::vector<VectorId> &ids, const Row &row, const std::vector<Metadata> &metas)
+    {
+      const size_t dim = config.vector_dim;
+      if (config.index_type != IndexType::HNSW)
+      {
+        bool ok = true;
+        for (size_t i = 0; i < ids.size(); ++i)
+          ok = add(ids[i], VectorData{Vector(row(i), row(i) + dim), {}, metas.empty() ? Metadata{} : metas[i]}) && ok;
+        return ok;
+      }
+
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      std::unordered_map<VectorId, size_t> last;
+      for (size_t i = 0; i < ids.size(); ++i)
+        last[ids[i]] = i;
+      std::vector<VectorId> batch;
+      batch.reserve(last.size());
+      size_t new_nodes = 0;
+      for (size_t i = 0; i < ids.size(); ++i)
+      {
+        if (last.at(ids[i]) != i)
+          continue;
+        batch.push_back(ids[i]);
+        new_nodes += hnsw_index->label_lookup_.count(ids[i]) == 0;
+      }
+      const size_t needed = hnsw_index->cur_element_count + new_nodes;
+      if (needed > hnsw_index->max_elements_ && !rebuild_index(std::max<size_t>(config.max_elements * 2, needed + 10)))
+        return false;
+
+      std::vector<const VectorData *> records;
+      records.reserve(batch.size());
+      for (VectorId id : batch)
+      {
+        const size_t i = last.at(id);
+        if (storage.count(id))
+        {
+          remove_from_metadata_index(id);
+          forget_cached(id);
+          // addPoint() then updates the node in place
+          hnsw_index->markDelete(id);
+        }
+        const VectorData &stored = storage[id] = VectorData{Vector(row(i), row(i) + dim), {}, metas.empty() ? Metadata{} : metas[i]};
+        for (const auto &[key, value] : stored.metadata)
+          metadata_index[key][value].insert(id);
+        add_to_entry_points(id, stored.metadata);
+        records.push_back(&stored);
+      }
+
+      std::atomic<size_t> next{0}, failed{0};
+      auto work = [&]
+      {
+        std::vector<float> projected;
+        for (size_t b = next++; b < batch.size(); b = next++)
+        {
+          try
+          {
+            hnsw_index->addPoint(index_data(*records[b], projected), batch[b]);
+          }
+          catch (const std::exception &)
+          {
+            ++failed;
+          }
+        }
+      };
+      std::vector<std::thread> workers;
+      for (size_t t = 1; t < std::min<size_t>(std::thread::hardware_concurrency(), batch.size() / 64 + 1); ++t)
+        workers.emplace_back(work);
+      work();
+      for (auto &worker : workers)
+        worker.join();
+
+      for (VectorId id : batch)
+      {
+        auto node = hnsw_index->label_lookup_.find(id);
+        if (node == hnsw_index->label_lookup_.end())
+          continue;
+        if (config.lock_memory)
+          lock_upper_links(node->second);
+        if (quantizer.trained())
+          encode_node(node->second);
+      }
+      if (failed > 0)
+        std::cerr << "add_batch(): " << failed << " graph inserts failed." << std::endl;
+      return failed == 0;
+    }
+
+    // grows the index when it is full
+    bool add_to_graph(VectorId id, const VectorData &stored)
+    {
+      std::vector<float> projected;
+      try
+      {
+        hnsw_index->addPoint(index_data(stored, projected), id);
+      }
+      catch (const std::exception &e)
+      {
+        size_t proposed = std::max<size_t>(config.max_elements * 2, storage.size() + 10);
+        if (!rebuild_index(proposed))
+        {
+          return false;
+        }
+        try
+        {
+          hnsw_index->addPoint(index_data(stored, projected), id);
+        }
+        catch (const std::exception &e2)
+        {
+          std::cerr << "Failed to add point after rebuild: " << e2.what() << std::endl;
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // drains a max-heap of (distance, label) into the n closest results, nearest first
+    static std::vector<QueryResult> collect_results(std::priority_queue<std::pair<float, hnswlib::labeltype>> &result_queue, size_t n, SearchPath path)
+    {
+      while (result_queue.size() > n)
+        result_queue.pop();
+      std::vector<QueryResult> results;
+      results.reserve(result_queue.size());
+      while (!result_queue.empty())
+      {
+        results.push_back({result_queue.top().second, result_queue.top().first, path});
+        result_queue.pop();
+      }
+      std::reverse(results.begin(), results.end());
+      return results;
+    }
+
+    std::vector<QueryResult> query(const Vector &query_vec, size_t n) const
+    {
+      return query(ElementType::Float32, query_vec.data(), query_vec.size(), n, {}, QueryOptions());
+    }
+
+    // brute force over internal ids; sorted ids walk level-0 memory front to
+    // back, vectors are prefetched a few blocks ahead and scored four at a time
+    std::vector<QueryResult> scan_nodes(const void *query_data, size_t n, std::vector<hnswlib::tableint> &nodes, const Scorer &scorer) const
+    {
+      const auto &index = *hnsw_index;
+      const size_t dim = scorer.dim;
+      const distance::Kernels &kernels = scorer.kernels;
+      const size_t vector_bytes = distance::vector_bytes(config.element_type, dim);
+      constexpr size_t kLookahead = 8;
+      std::sort(nodes.begin(), nodes.end());
+
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> result_queue;
+      auto offer = [&](float d, hnswlib::tableint node)
+      {
+        if (result_queue.size() < n)
+          result_queue.emplace(d, index.getExternalLabel(node));
+        else if (d < result_queue.top().first)
+        {
+          result_queue.pop();
+          result_queue.emplace(d, index.getExternalLabel(node));
+        }
+      };
+      auto vector_of = [&](size_t i)
+      { return static_cast<const void *>(index.getDataByInternalId(nodes[i])); };
+
+      const size_t count = nodes.size();
+      for (size_t i = 0; i < std::min(kLookahead, count); ++i)
+        distance::prefetch_range(vector_of(i), vector_bytes);
+      size_t i = 0;
+      const void *block[4];
+      float dists[4];
+      for (; i + 4 <= count; i += 4)
+      {
+        for (size_t p = i + kLookahead; p < std::min(i + kLookahead + 4, count); ++p)
+          distance::prefetch_range(vector_of(p), vector_bytes);
+        for (size_t j = 0; j < 4; ++j)
+          block[j] = vector_of(i + j);
+        kernels.batch4(query_data, block, dim, dists);
+        for (size_t j = 0; j < 4; ++j)
+          offer(dists[j], nodes[i + j]);
+      }
+      for (; i < count; ++i)
+        offer(kernels.distance(query_data, vector_of(i), dim), nodes[i]);
+      return collect_results(result_queue, n, SearchPath::ExactScan);
+    }
+
+    // LUT scan over the PQ codes; the best n * pq_rerank_factor are rescored exactly
+    std::vector<QueryResult> quantized_scan(const void *query_data, size_t n, const std::vector<hnswlib::tableint> &nodes, const Scorer &scorer) const
+    {
+      std::vector<float> table;
+      quantizer.build_table(static_cast<const float *>(query_data), table);
+      const size_t keep = n * std::max<size_t>(config.pq_rerank_factor, 1);
+      const size_t code_bytes = quantizer.code_bytes();
+      std::priority_queue<std::pair<float, hnswlib::tableint>> shortlist;
+      for (hnswlib::tableint node : nodes)
+      {
+        float d = quantizer.distance(table, &pq_codes[node * code_bytes]);
+        if (shortlist.size() < keep)
+          shortlist.emplace(d, node);
+        else if (d < shortlist.top().first)
+        {
+          shortlist.pop();
+          shortlist.emplace(d, node);
+        }
+      }
+      std::vector<hnswlib::tableint> rerank;
+      rerank.reserve(shortlist.size());
+      for (; !shortlist.empty(); shortlist.pop())
+        rerank.push_back(shortlist.top().second);
+      std::vector<QueryResult> results = scan_nodes(query_data, n, rerank, scorer);
+      for (auto &r : results)
+        r.path = SearchPath::Quantized;
+      return results;
+    }
+
+    std::vector<QueryResult> scan(const void *query_data, size_t n, std::vector<hnswlib::tableint> &nodes, SearchStrategy strategy, const Scorer &scorer) const
+    {
+      if (strategy == SearchStrategy::Quantized && quantizer.trained())
+        return quantized_scan(query_data, n, nodes, scorer);
+      return scan_nodes(query_data, n, nodes, scorer);
+    }
+
+    // live internal ids of the given external ids, or of every element
+    std::vector<hnswlib::tableint> live_nodes(const std::set<VectorId> &ids) const
+    {
+      const auto &index = *hnsw_index;
+      std::vector<hnswlib::tableint> nodes;
+      nodes.reserve(ids.size());
+      for (VectorId id : ids)
+      {
+        auto it = index.label_lookup_.find(id);
+        if (it != index.label_lookup_.end() && !index.isMarkedDeleted(it->second))
+          nodes.push_back(it->second);
+      }
+      return nodes;
+    }
+
+    std::vector<hnswlib::tableint> live_nodes() const
+    {
+      const auto &index = *hnsw_index;
+      std::vector<hnswlib::tableint> nodes;
+      nodes.reserve(index.cur_element_count);
+      for (hnswlib::tableint node = 0; node < index.cur_element_count; ++node)
+      {
+        if (!index.isMarkedDeleted(node))
+          nodes.push_back(node);
+      }
+      return nodes;
+    }
+
+    std::vector<QueryResult> exact_scan(const void *query_data, size_t n, const std::set<VectorId> &candidate_ids, SearchStrategy strategy, const Scorer &scorer) const
+    {
+      std::vector<hnswlib::tableint> nodes = live_nodes(candidate_ids);
+      return scan(query_data, n, nodes, strategy, scorer);
+    }
+
+    std::vector<QueryResult> exact_scan_all(const void *query_data, size_t n, SearchStrategy strategy, const Scorer &scorer) const
+    {
+      std::vector<hnswlib::tableint> nodes = live_nodes();
+      return scan(query_data, n, nodes, strategy, scorer);
+    }
+
+    // SearchStrategy::Exact on a projected database: the stored full-dimension
+    // vectors (not the projected graph copies) are scanned, so the result is
+    // exact in the original space; tiered records are read a chunk at a time
+    std::vector<QueryResult> exact_scan_full(const float *query_vec, size_t n, const Metadata &filter) const
+    {
+      std::vector<VectorId> ids;
+      if (filter.empty())
+      {
+        ids.reserve(storage.size());
+        for (const auto &entry : storage)
+          ids.push_back(entry.first);
+      }
+      else
+      {
+        for (VectorId id : filter_candidates(filter))
+        {
+          if (storage.count(id))
+            ids.push_back(id);
+        }
+      }
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> result_queue;
+      auto offer = [&](float d, VectorId id)
+      {
+        if (result_queue.size() < n)
+          result_queue.emplace(d, id);
+        else if (d < result_queue.top().first)
+        {
+          result_queue.pop();
+          result_queue.emplace(d, id);
+        }
+      };
+      constexpr size_t kChunk = 1024;
+      std::vector<VectorId> chunk;
+      const void *block[4];
+      float dists[4];
+      for (size_t begin = 0; begin < ids.size() && n > 0; begin += kChunk)
+      {
+        chunk.assign(ids.begin() + begin, ids.begin() + std::min(begin + kChunk, ids.size()));
+        const std::vector<Record> records = fetch_batch(chunk);
+        size_t i = 0;
+        for (; i + 4 <= records.size(); i += 4)
+        {
+          for (size_t j = 0; j < 4; ++j)
+            block[j] = records[i + j]->vector.data();
+          full_kernels.batch4(query_vec, block, config.vector_dim, dists);
+          for (size_t j = 0; j < 4; ++j)
+            offer(dists[j], chunk[i + j]);
+        }
+        for (; i < records.size(); ++i)
+          offer(full_kernels.distance(query_vec, records[i]->vector.data(), config.vector_dim), chunk[i]);
+      }
+      return collect_results(result_queue, n, SearchPath::ExactScan);
+    }
+
+    // candidate list size of a graph search for n results (searching for ef
+    // results is the same as searching with ef)
+    size_t graph_ef(size_t n, const QueryOptions &options) const
+    {
+      const size_t ef = options.ef ? options.ef : config.ef_search ? config.ef_search : hnsw_index->ef_;
+      return std::max(ef, n);
+    }
+
+    // filtered HNSW can come back short even when enough candidates exist; widen
+    // ef geometrically (searching for ef results is the same as searching with
+    // ef) and fall back to an exact scan once filter_max_ef is reached
+    std::vector<QueryResult> filtered_search(const void *query_data, size_t n, const std::set<VectorId> &candidate_ids, const Metadata &filter, const QueryOptions &options, const Scorer &scorer) const
+    {
+      if (options.strategy == SearchStrategy::Exact || options.strategy == SearchStrategy::Quantized ||
+          (options.strategy == SearchStrategy::Auto && candidate_ids.size() <= config.exact_scan_threshold))
+        return exact_scan(query_data, n, candidate_ids, options.strategy, scorer);
+
+      class IdFilterFunctor : public hnswlib::BaseFilterFunctor
+      {
+        const std::set<VectorId> &allowed_ids;
+
+      public:
+        explicit IdFilterFunctor(const std::set<VectorId> &ids) : allowed_ids(ids) {}
+        bool operator()(hnswlib::labeltype id) override { return allowed_ids.count(id); }
+      };
+      IdFilterFunctor filter_functor(candidate_ids);
+      hnswlib::tableint entry_node = hnsw_index->enterpoint_node_;
+      bool in_partition = false;
+      if (std::optional<VectorId> entry = partition_entry_point(filter))
+      {
+        auto it = hnsw_index->label_lookup_.find(*entry);
+        if (it != hnsw_index->label_lookup_.end())
+        {
+          entry_node = it->second;
+          in_partition = true;
+        }
+      }
+      auto search = [&](size_t k)
+      { return search_graph(entry_node, query_data, k, &filter_functor, in_partition, scorer); };
+
+      const size_t wanted = std::min(n, candidate_ids.size());
+      size_t ef = graph_ef(n, options);
+      auto result_queue = search(ef);
+      if (result_queue.size() >= wanted)
+        return collect_results(result_queue, n, SearchPath::Graph);
+
+      const size_t factor = std::max<size_t>(config.filter_retry_factor, 2);
+      while (ef < config.filter_max_ef)
+      {
+        ef = std::min<size_t>(ef * factor, config.filter_max_ef);
+        result_queue = search(ef);
+        if (result_queue.size() >= wanted)
+          return collect_results(result_queue, n, SearchPath::GraphRetry);
+      }
+      return exact_scan(query_data, n, candidate_ids, SearchStrategy::Exact, scorer);
+    }
+
+    // ids matching every key=value clause of a non-empty filter
+    std::set<VectorId> filter_candidates(const Metadata &filter) const
+    {
+      std::set<VectorId> candidate_ids;
+      bool first = true;
+      for (const auto &[key, value] : filter)
+      {
+        auto it_key = metadata_index.find(key);
+        if (it_key == metadata_index.end())
+          return {};
+        auto it_val = it_key->second.find(value);
+        if (it_val == it_key->second.end())
+          return {};
+        const auto &ids_for_clause = it_val->second;
+        if (first)
+        {
+          candidate_ids = ids_for_clause;
+          first = false;
+        }
+        else
+        {
+          std::set<VectorId> intersection;
+          std::set_intersection(candidate_ids.begin(), candidate_ids.end(), ids_for_clause.begin(), ids_for_clause.end(), std::inserter(intersection, intersection.begin()));
+          candidate_ids = std::move(intersection);
+        }
+        if (candidate_ids.empty())
+          return {};
+      }
+      return candidate_ids;
+    }
+
+    std::vector<QueryResult> query(const Vector &query_vec, size_t n, const Metadata &filter, const QueryOptions &options) const
+    {
+      return query(ElementType::Float32, query_vec.data(), query_vec.size(), n, filter, options);
+    }
+
+    template <typename T>
+    std::vector<QueryResult> query(std::span<const T> query_vec, size_t n, const Metadata &filter, const QueryOptions &options) const
+    {
+      return query(element_type_of<T>(), query_vec.data(), query_vec.size(), n, filter, options);
+    }
+
+    // queries must match the configured element type and dimension; a
+    // held_out vector is invisible to an unfiltered graph walk (autotune()),
+    // which starts at the start vector's node instead of the entry point when
+    // one is given (self knn_join())
+    std::vector<QueryResult> query(ElementType type, const void *query_data, size_t len, size_t n, const Metadata &filter, const QueryOptions &options, const VectorId *held_out = nullptr, const VectorId *start = nullptr) const
+    {
+      if (type != config.element_type || len != distance::stored_units(type, config.vector_dim))
+        return {};
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      if (projection_matrix.empty())
+        return search(query_data, n, filter, options, held_out, start);
+      const float *full_query = static_cast<const float *>(query_data);
+      if (options.strategy == SearchStrategy::Exact)
+        return exact_scan_full(full_query, n, filter);
+      std::vector<float> projected(config.projected_dim);
+      projection::apply(projection_matrix, full_query, config.vector_dim, projected.data());
+      std::vector<QueryResult> results = search(projected.data(), n * std::max<size_t>(config.projection_rerank_factor, 1), filter, options, held_out, start);
+      std::vector<VectorId> ids;
+      ids.reserve(results.size());
+      for (const auto &r : results)
+        ids.push_back(r.id);
+      const std::vector<Record> records = fetch_batch(ids);
+      for (size_t i = 0; i < results.size(); ++i)
+        results[i].distance = full_kernels.distance(full_query, records[i]->vector.data(), config.vector_dim);
+      std::stable_sort(results.begin(), results.end(), [](const QueryResult &a, const QueryResult &b)
+                       { return a.distance < b.distance; });
+      if (results.size() > n)
+        results.resize(n);
+      return results;
+    }
+
+    std::vector<std::vector<QueryResult>> query_batch(const std::vector<Vector> &queries, size_t n, const Metadata &filter, const QueryOptions &options) const
+    {
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      const bool blocked = hnsw_index && options.strategy == SearchStrategy::Exact && config.element_type == ElementType::Float32 &&
+                           config.custom_metric.empty() && projection_matrix.empty() &&
+                           (options.prefix_dim == 0 || options.prefix_dim >= config.vector_dim);
+      std::vector<std::vector<QueryResult>> results(queries.size());
+      if (!blocked)
+      {
+        // query() takes the lock itself
+        lock.unlock();
+        for (size_t i = 0; i < queries.size(); ++i)
+          results[i] = query(queries[i], n, filter, options);
+        return results;
+      }
+      std::vector<size_t> valid;
+      for (size_t i = 0; i < queries.size(); ++i)
+      {
+        if (queries[i].size() == config.vector_dim)
+          valid.push_back(i);
+      }
+      if (valid.empty() || n == 0)
+        return results;
+      std::vector<hnswlib::tableint> nodes;
+      if (filter.empty())
+        nodes = live_nodes();
+      else
+        nodes = live_nodes(filter_candidates(filter));
+      std::vector<const float *> query_ptrs;
+      query_ptrs.reserve(valid.size());
+      for (size_t i : valid)
+        query_ptrs.push_back(queries[i].data());
+      std::vector<std::vector<QueryResult>> found = blocked_scan(query_ptrs, n, nodes);
+      for (size_t i = 0; i < valid.size(); ++i)
+        results[valid[i]] = std::move(found[i]);
+      return results;
+    }
+
+    // Exact top-n for many float queries at once, as a blocked matrix
+    // product: the nodes are cut into L2-sized blocks packed into panels
+    // (gemm.h), each block is scored against every query, and the L2
+    // distance comes from |q|^2 + |x|^2 - 2 q.x with both norms computed once.
+    // Threads take whole blocks and keep their own top-n per query; the
+    // per-thread heaps are then merged, one query per task.
+    std::vector<std::vector<QueryResult>> blocked_scan(const std::vector<const float *> &queries, size_t n, const std::vector<hnswlib::tableint> &nodes) const
+    {
+      using Heap = std::priority_queue<std::pair<float, hnswlib::labeltype>>;
+      const auto &index = *hnsw_index;
+      const size_t dim = config.vector_dim;
+      const size_t nq = queries.size();
+      const bool l2 = config.metric == Metric::L2;
+      const gemm::MicroKernel kernel = gemm::micro_kernel();
+      const size_t block = gemm::block_vectors(dim);
+      const size_t blocks = (nodes.size() + block - 1) / block;
+      const size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), std::max<size_t>(blocks, 1)));
+
+      std::vector<float> query_norms(nq, 0.0f);
+      if (l2)
+      {
+        for (size_t q = 0; q < nq; ++q)
+          query_norms[q] = projection::dot(queries[q], queries[q], dim);
+      }
+
+      std::vector<std::vector<Heap>> heaps(threads, std::vector<Heap>(nq));
+      auto work = [&](size_t t)
+      {
+        std::vector<float> panels(block * dim);
+        std::vector<float> norms(block);
+        std::vector<const float *> members(gemm::kPanel);
+        float tile[gemm::kRows * gemm::kPanel];
+        auto &local = heaps[t];
+        for (size_t b = t; b < blocks; b += threads)
+        {
+          const size_t begin = b * block;
+          const size_t count = std::min(block, nodes.size() - begin);
+          const size_t panel_count = (count + gemm::kPanel - 1) / gemm::kPanel;
+          for (size_t p = 0; p < panel_count; ++p)
+          {
+            const size_t lanes = std::min(gemm::kPanel, count - p * gemm::kPanel);
+            for (size_t j = 0; j < lanes; ++j)
+            {
+              members[j] = reinterpret_cast<const float *>(index.getDataByInternalId(nodes[begin + p * gemm::kPanel + j]));
+              norms[p * gemm::kPanel + j] = l2 ? projection::dot(members[j], members[j], dim) : 0.0f;
+            }
+            gemm::pack_panel(members.data(), lanes, dim, &panels[p * gemm::kPanel * dim]);
+          }
+          for (size_t q0 = 0; q0 < nq; q0 += gemm::kRows)
+          {
+            const size_t rows = std::min(gemm::kRows, nq - q0);
+            for (size_t p = 0; p < panel_count; ++p)
+            {
+              kernel(&queries[q0], rows, &panels[p * gemm::kPanel * dim], dim, tile);
+              const size_t lanes = std::min(gemm::kPanel, count - p * gemm::kPanel);
+              for (size_t r = 0; r < rows; ++r)
+              {
+                Heap &heap = local[q0 + r];
+                for (size_t j = 0; j < lanes; ++j)
+                {
+                  const float dot = tile[r * gemm::kPanel + j];
+                  const float d = l2 ? std::max(0.0f, query_norms[q0 + r] + norms[p * gemm::kPanel + j] - 2.0f * dot) : 1.0f - dot;
+                  if (heap.size() < n)
+                    heap.emplace(d, index.getExternalLabel(nodes[begin + p * gemm::kPanel + j]));
+                  else if (d < heap.top().first)
+                  {
+                    heap.pop();
+                    heap.emplace(d, index.getExternalLabel(nodes[begin + p * gemm::kPanel + j]));
+                  }
+                }
+              }
+            }
+          }
+        }
+      };
+
+      std::vector<std::vector<QueryResult>> results(nq);
+      auto merge = [&](size_t t)
+      {
+        for (size_t q = t; q < nq; q += threads)
+        {
+          Heap &merged = heaps[0][q];
+          for (size_t other = 1; other < threads; ++other)
+          {
+            for (Heap &heap = heaps[other][q]; !heap.empty(); heap.pop())
+            {
+              if (merged.size() < n)
+                merged.push(heap.top());
+              else if (heap.top().first < merged.top().first)
+              {
+                merged.pop();
+                merged.push(heap.top());
+              }
+            }
+          }
+          results[q] = collect_results(merged, n, SearchPath::ExactScan);
+        }
+      };
+
+      auto run = [threads](const auto &phase)
+      {
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; ++t)
+          workers.emplace_back(phase, t);
+        phase(0);
+        for (auto &worker : workers)
+          worker.join();
+      };
+      run(work);
+      run(merge);
+      return results;
+    }
+
+    // a stored vector as the index scores it
+    const void *index_vector(VectorId id) const
+    {
+      if (!hnsw_index)
+        return storage.at(id).vector.data();
+      return hnsw_index->getDataByInternalId(hnsw_index->label_lookup_.at(id));
+    }
+
+    // brute force over the stored vectors (IVF databases), restricted to
+    // allowed when given
+    std::vector<QueryResult> storage_scan(const void *query_data, size_t n, const std::set<VectorId> *allowed, const Scorer &scorer) const
+    {
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> result_queue;
+      auto offer = [&](VectorId id)
+      {
+        float d = scorer.kernels.distance(query_data, storage.at(id).vector.data(), scorer.dim);
+        if (result_queue.size() < n)
+          result_queue.emplace(d, id);
+        else if (d < result_queue.top().first)
+        {
+          result_queue.pop();
+          result_queue.emplace(d, id);
+        }
+      };
+      if (allowed)
+      {
+        for (VectorId id : *allowed)
+          offer(id);
+      }
+      else
+      {
+        for (const auto &kv : storage)
+          offer(kv.first);
+      }
+      return collect_results(result_queue, n, SearchPath::ExactScan);
+    }
+
+    // Scans the nprobe lists whose centroids are closest; SQ8 lists are
+    // scored approximately and the best n * ivf_rerank_factor rescored from
+    // the stored vectors. Exact scans answer untrained indexes, the Exact
+    // strategy, small filter candidate sets and filtered probes that come
+    // back short.
+    std::vector<QueryResult> ivf_search(const void *query_data, size_t n, const Metadata &filter, const QueryOptions &options, const Scorer &scorer) const
+    {
+      std::set<VectorId> candidate_ids;
+      const std::set<VectorId> *allowed = nullptr;
+      if (!filter.empty())
+      {
+        candidate_ids = filter_candidates(filter);
+        if (candidate_ids.empty())
+          return {};
+        allowed = &candidate_ids;
+      }
+      if (!ivf.trained() || options.strategy == SearchStrategy::Exact ||
+          (allowed && options.strategy == SearchStrategy::Auto && candidate_ids.size() <= config.exact_scan_threshold))
+        return storage_scan(query_data, n, allowed, scorer);
+
+      const float *query = static_cast<const float *>(query_data);
+      const size_t nprobe = std::max<size_t>(options.nprobe ? options.nprobe : config.ivf_nprobe, 1);
+      const size_t keep = config.ivf_sq8 ? n * std::max<size_t>(config.ivf_rerank_factor, 1) : n;
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> result_queue;
+      auto offer = [&](float d, VectorId id)
+      {
+        if (result_queue.size() < keep)
+          result_queue.emplace(d, id);
+        else if (d < result_queue.top().first)
+        {
+          result_queue.pop();
+          result_queue.emplace(d, id);
+        }
+      };
+      for (size_t list : ivf.probe(query, nprobe, scorer.kernels, scorer.dim))
+        ivf.scan(list, query, scorer.kernels, scorer.dim, allowed, offer);
+      std::vector<QueryResult> results = collect_results(result_queue, keep, SearchPath::InvertedFile);
+      if (config.ivf_sq8)
+      {
+        for (auto &r : results)
+          r.distance = scorer.kernels.distance(query_data, storage.at(r.id).vector.data(), scorer.dim);
+        std::stable_sort(results.begin(), results.end(), [](const QueryResult &a, const QueryResult &b)
+                         { return a.distance < b.distance; });
+        if (results.size() > n)
+          results.resize(n);
+      }
+      if (allowed && results.size() < std::min(n, candidate_ids.size()))
+        return storage_scan(query_data, n, allowed, scorer);
+      return results;
+    }
+
+    // query_data is at index_dim(); caller holds the read lock. With a
+    // prefix_dim the search scores prefixes and the best
+    // n * prefix_rerank_factor are rescored on every index dimension.
+    std::vector<QueryResult> search(const void *query_data, size_t n, const Metadata &filter, const QueryOptions &options, const VectorId *held_out = nullptr, const VectorId *start = nullptr) const
+    {
+      const Scorer scorer = scorer_for(options.prefix_dim);
+      if (scorer.dim == index_dim())
+        return search(query_data, n, filter, options, scorer, held_out, start);
+      std::vector<QueryResult> results = search(query_data, n * std::max<size_t>(options.prefix_rerank_factor, 1), filter, options, scorer, held_out, start);
+      for (auto &r : results)
+        r.distance = kernels.distance(query_data, index_vector(r.id), index_dim());
+      std::stable_sort(results.begin(), results.end(), [](const QueryResult &a, const QueryResult &b)
+                       { return a.distance < b.distance; });
+      if (results.size() > n)
+        results.resize(n);
+      return results;
+    }
+
+    std::vector<QueryResult> search(const void *query_data, size_t n, const Metadata &filter, const QueryOptions &options, const Scorer &scorer, const VectorId *held_out = nullptr, const VectorId *start = nullptr) const
+    {
+      if (!hnsw_index)
+        return ivf_search(query_data, n, filter, options, scorer);
+      const bool scan_all = options.strategy == SearchStrategy::Exact || options.strategy == SearchStrategy::Quantized;
+      if (filter.empty() && !scan_all)
+      {
+        if (storage.empty())
+          return {};
+        std::optional<hnswlib::tableint> skip;
+        if (held_out && hnsw_index->label_lookup_.count(*held_out))
+          skip = hnsw_index->label_lookup_.at(*held_out);
+        hnswlib::tableint entry = hnsw_index->enterpoint_node_;
+        if (start && hnsw_index->label_lookup_.count(*start))
+          entry = hnsw_index->label_lookup_.at(*start);
+        auto result_queue = search_graph(entry, query_data, graph_ef(n, options), nullptr, false, scorer, skip);
+        return collect_results(result_queue, n, SearchPath::Graph);
+      }
+      if (filter.empty())
+        return exact_scan_all(query_data, n, options.strategy, scorer);
+      std::set<VectorId> candidate_ids = filter_candidates(filter);
+      if (candidate_ids.empty())
+        return {};
+      return filtered_search(query_data, n, candidate_ids, filter, options, scorer);
+    }
+
+    std::optional<std::pair<Vector, Metadata>> get(VectorId id) const
+    {
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      if (!storage.count(id))
+        return std::nullopt;
+      const Record record = fetch(id);
+      return std::make_pair(to_float(*record), record->metadata);
+    }
+
+    // a stored vector as get() returns it
+    Vector to_float(const VectorData &record) const
+    {
+      const auto &codes = record.codes;
+      switch (config.element_type)
+      {
+      case ElementType::Int8:
+        return Vector(reinterpret_cast<const int8_t *>(codes.data()), reinterpret_cast<const int8_t *>(codes.data()) + codes.size());
+      case ElementType::UInt8:
+        return Vector(codes.begin(), codes.end());
+      case ElementType::Binary:
+      {
+        Vector bits(config.vector_dim);
+        for (size_t i = 0; i < bits.size(); ++i)
+          bits[i] = float((codes[i / 8] >> (i % 8)) & 1);
+        return bits;
+      }
+      default:
+        return record.vector;
+      }
+    }
+
+    void for_each(const RecordVisitor &visit) const
+    {
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      for (const auto &kv : storage)
+      {
+        const Record record = record_of(kv.second);
+        if (!visit(kv.first, to_float(*record), record->metadata))
+          return;
+      }
+    }
+
+    bool remove(VectorId id)
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      if (storage.find(id) == storage.end())
+        return false;
+      remove_from_metadata_index(id);
+      try
+      {
+        if (hnsw_index)
+          hnsw_index->markDelete(id);
+      }
+      catch (...)
+      {
+      }
+      ivf.remove(id);
+      forget_cached(id);
+      storage.erase(id);
+      // incremental graph repair, a slice per remove
+      repair_step(256, false);
+      return true;
+    }
+
+    // drops the tombstones by rebuilding the graph from the stored vectors
+    bool compact()
+    {
+      std::lock_guard<std::shared_mutex> lock(rw_mutex);
+      if (!hnsw_index)
+        return true;
+      return rebuild_index(std::max<size_t>(config.max_elements, storage.size()));
+    }
+
+    // Structural checks of a loaded database; each problem is reported on
+    // std::cerr (the first few of each kind). Returns the number found.
+    size_t check_integrity() const
+    {
+      std::shared_lock<std::shared_mutex> lock(rw_mutex);
+      size_t problems = 0;
+      auto report = [&problems](const std::string &what)
+      {
+        if (++problems <= 20)
+          std::cerr << "verify: " << what << std::endl;
+      };
+      if (hnsw_index)
+      {
+        const auto &index = *hnsw_index;
+        const size_t count = index.cur_element_count;
+        if (count > 0 && (index.enterpoint_node_ >= count || index.element_levels_[index.enterpoint_node_] != index.maxlevel_))
+          report("entry point " + std::to_string(index.enterpoint_node_) + " is not a top-level node");
+        size_t live = 0;
+        for (hnswlib::tableint node = 0; node < count; ++node)
+        {
+          const VectorId label = index.getExternalLabel(node);
+          if (!index.isMarkedDeleted(node))
+          {
+            ++live;
+            if (!storage.count(label))
+              report("graph node for id " + std::to_string(label) + " has no stored vector");
+          }
+          const int top = index.element_levels_[node];
+          if (top > index.maxlevel_)
+            report("node " + std::to_string(node) + " is above the top level");
+          for (int level = 0; level <= top && level <= index.maxlevel_; ++level)
+          {
+            hnswlib::linklistsizeint *links = index.get_linklist_at_level(node, level);
+            const size_t size = index.getListCount(links);
+            const hnswlib::tableint *neighbors = reinterpret_cast<const hnswlib::tableint *>(links + 1);
+            if (size > (level ? index.maxM_ : index.maxM0_))
+            {
+              report("node " + std::to_string(node) + " has " + std::to_string(size) + " links on level " + std::to_string(level));
+              continue;
+            }
+            for (size_t i = 0; i < size; ++i)
+            {
+              if (neighbors[i] >= count || neighbors[i] == node || index.element_levels_[neighbors[i]] < level)
+                report("node " + std::to_string(node) + " has a bad link to " + std::to_string(neighbors[i]) + " on level " + std::to_string(level));
+            }
+          }
         }
-        try
+        for (const auto &kv : storage)
         {
-          hnsw_index->addPoint(vec.data(), id);
+          auto it = index.label_lookup_.find(kv.first);
+          if (it == index.label_lookup_.end() || index.isMarkedDeleted(it->second))
+            report("stored id " + std::to_string(kv.first) + " is missing from the graph");
         }
-        catch (const std::exception &e2)
+        if (live != storage.size())
+          report(std::to_string(live) + " live graph nodes for " + std::to_string(storage.size()) + " stored vectors");
+      }
+      else if (ivf.trained() && ivf.size() != storage.size())
+        report(std::to_string(ivf.size()) + " vectors in the IVF lists for " + std::to_string(storage.size()) + " stored");
+      for (const auto &[key, values] : metadata_index)
+      {
+        for (const auto &[value, ids] : values)
         {
-          std::cerr << "Failed to add point after rebuild: " << e2.what() << std::endl;
-          return false;
+          for (VectorId id : ids)
+          {
+            if (!storage.count(id))
+              report("metadata key '" + key + "' lists missing id " + std::to_string(id));
+          }
         }
       }
-      for (const auto &[key, value] : meta)
+      return problems;
+    }
+
+    // read-only view of the live graph for stats::graph_stats()
+    struct LiveGraph
+    {
+      const hnswlib::HierarchicalNSW<float> &index;
+      size_t size() const { return index.cur_element_count; }
+      uint32_t entry() const { return index.enterpoint_node_; }
+      int level(size_t i) const { return index.element_levels_[i]; }
+      bool deleted(size_t i) const { return index.isMarkedDeleted(static_cast<hnswlib::tableint>(i)); }
+      std::span<const uint32_t> links(size_t i, int level) const
       {
-        metadata_index[key][value].insert(id);
+        hnswlib::linklistsizeint *list = index.get_linklist_at_level(static_cast<hnswlib::tableint>(i), level);
+        return {reinterpret_cast<const uint32_t *>(list + 1), index.getListCount(list)};
       }
-      return true;
-    }
+    };
 
-    std::vector<QueryResult> query(const Vector &query_vec, size_t n) const
+    IndexStats stats() const
     {
       std::shared_lock<std::shared_mutex> lock(rw_mutex);
-      if (query_vec.size() != config.vector_dim || storage.empty())
-        return {};
-      auto result_queue = hnsw_index->searchKnn(query_vec.data(), n);
-      std::vector<QueryResult> results;
-      results.reserve(result_queue.size());
-      while (!result_queue.empty())
+      IndexStats out;
+      out.vectors = storage.size();
+      if (hnsw_index)
       {
-        results.push_back({result_queue.top().second, result_queue.top().first});
-        result_queue.pop();
+        out.max_links = static_cast<uint32_t>(hnsw_index->maxM_);
+        out.max_links0 = static_cast<uint32_t>(hnsw_index->maxM0_);
+        stats::graph_stats(LiveGraph{*hnsw_index}, out);
       }
-      std::reverse(results.begin(), results.end());
-      return results;
+      for (const auto &list : ivf.lists())
+        out.ivf_list_sizes.push_back(list.ids.size());
+      for (const auto &[key, values] : metadata_index)
+      {
+        std::vector<uint64_t> sizes;
+        sizes.reserve(values.size());
+        for (const auto &value : values)
+          sizes.push_back(value.second.size());
+        out.postings[key] = stats::posting_stats(sizes);
+      }
+      return out;
     }
 
-    std::vector<QueryResult> query(const Vector &query_vec, size_t n, const Metadata &filter) const
+    size_t count() const
     {
-      if (filter.empty())
-        return this->query(query_vec, n);
       std::shared_lock<std::shared_mutex> lock(rw_mutex);
-      std::set<VectorId> candidate_ids;
-      bool first = true;
-      for (const auto &[key, value] : filter)
+      return storage.size();
+    }
+  };
+
+  namespace
+  {
+    // the links of a saved hnswlib section (its own native layout: a header,
+    // every node's level-0 block, then each node's upper-level lists)
+    struct FileGraph
+    {
+      uint32_t entry_node = 0;
+      size_t max_links = 0, max_links0 = 0;
+      std::vector<int> levels;
+      std::vector<uint8_t> removed;
+      std::vector<uint32_t> links0;             // per node: count, then max_links0 ids
+      std::vector<std::vector<uint32_t>> upper; // per node and level above 0: count, then max_links ids
+
+      size_t size() const { return levels.size(); }
+      uint32_t entry() const { return entry_node; }
+      int level(size_t i) const { return levels[i]; }
+      bool deleted(size_t i) const { return removed[i] != 0; }
+      std::span<const uint32_t> links(size_t i, int level) const
       {
-        auto it_key = metadata_index.find(key);
-        if (it_key == metadata_index.end())
-          return {};
-        auto it_val = it_key->second.find(value);
-        if (it_val == it_key->second.end())
-          return {};
-        const auto &ids_for_clause = it_val->second;
-        if (first)
+        const uint32_t *list = level == 0 ? &links0[i * (max_links0 + 1)] : &upper[i][(level - 1) * (max_links + 1)];
+        return {list + 1, std::min<size_t>(list[0] & 0xFFFF, level == 0 ? max_links0 : max_links)};
+      }
+
+      bool read(std::istream &is)
+      {
+        auto pod = [&is](auto &value)
+        { is.read(reinterpret_cast<char *>(&value), sizeof(value)); };
+        size_t offset_level0 = 0, max_elements = 0, count = 0, element_bytes = 0, label_offset = 0, offset_data = 0, m = 0, ef_construction = 0;
+        int max_level = 0;
+        double mult = 0.0;
+        pod(offset_level0);
+        pod(max_elements);
+        pod(count);
+        pod(element_bytes);
+        pod(label_offset);
+        pod(offset_data);
+        pod(max_level);
+        pod(entry_node);
+        pod(max_links);
+        pod(max_links0);
+        pod(m);
+        pod(mult);
+        pod(ef_construction);
+        const size_t level0_bytes = (max_links0 + 1) * sizeof(uint32_t);
+        if (!is || offset_level0 + level0_bytes > element_bytes || (count > 0 && entry_node >= count))
+          return false;
+        levels.assign(count, 0);
+        removed.assign(count, 0);
+        links0.resize(count * (max_links0 + 1));
+        upper.assign(count, {});
+        std::vector<char> block(element_bytes);
+        for (size_t i = 0; i < count && is; ++i)
         {
-          candidate_ids = ids_for_clause;
-          first = false;
+          is.read(block.data(), static_cast<std::streamsize>(element_bytes));
+          std::memcpy(&links0[i * (max_links0 + 1)], &block[offset_level0], level0_bytes);
+          removed[i] = static_cast<uint8_t>(block[offset_level0 + 2] & 0x01);
         }
-        else
+        const size_t level_bytes = (max_links + 1) * sizeof(uint32_t);
+        for (size_t i = 0; i < count && is; ++i)
         {
-          std::set<VectorId> intersection;
-          std::set_intersection(candidate_ids.begin(), candidate_ids.end(), ids_for_clause.begin(), ids_for_clause.end(), std::inserter(intersection, intersection.begin()));
-          candidate_ids = std::move(intersection);
+          uint32_t list_bytes = 0;
+          pod(list_bytes);
+          levels[i] = static_cast<int>(list_bytes / level_bytes);
+          upper[i].resize(list_bytes / sizeof(uint32_t));
+          is.read(reinterpret_cast<char *>(upper[i].data()), list_bytes);
         }
-        if (candidate_ids.empty())
-          return {};
+        return static_cast<bool>(is);
       }
-      if (candidate_ids.empty())
-        return {};
-      class IdFilterFunctor : public hnswlib::BaseFilterFunctor
-      {
-        const std::set<VectorId> &allowed_ids;
+    };
 
-      public:
-        explicit IdFilterFunctor(const std::set<VectorId> &ids) : allowed_ids(ids) {}
-        bool operator()(hnswlib::labeltype id) override { return allowed_ids.count(id); }
-      };
-      IdFilterFunctor filter_functor(candidate_ids);
-      auto result_queue = hnsw_index->searchKnn(query_vec.data(), n, &filter_functor);
-      std::vector<QueryResult> results;
-      results.reserve(result_queue.size());
-      while (!result_queue.empty())
+    // Database::inspect(): walks the file section by section, skipping
+    // vectors and id lists and keeping only the counts and the graph links
+    std::optional<IndexStats> inspect_file(const std::string &path)
+    {
+      std::ifstream is(path, std::ios::binary);
+      char magic[8];
+      if (!is || !is.read(magic, 8) || std::memcmp(magic, "ORIONDB2", 8) != 0)
       {
-        results.push_back({result_queue.top().second, result_queue.top().first});
-        result_queue.pop();
+        std::cerr << "Not an Orion database: " << path << std::endl;
+        return std::nullopt;
       }
-      std::reverse(results.begin(), results.end());
-      return results;
-    }
+      uint32_t format_version = 0;
+      read_le(is, format_version);
+      if (format_version > kFormatVersion)
+      {
+        std::cerr << "Unsupported DB format version " << format_version << "." << std::endl;
+        return std::nullopt;
+      }
+      Config config;
+      read_config(is, config, format_version);
+      auto skip = [&is](uint64_t bytes)
+      { is.seekg(static_cast<std::streamoff>(bytes), std::ios::cur); };
+      auto skip_floats = [&]
+      {
+        uint64_t count = 0;
+        read_le(is, count);
+        skip(count * sizeof(float));
+      };
 
-    std::optional<std::pair<Vector, Metadata>> get(VectorId id) const
-    {
-      std::shared_lock<std::shared_mutex> lock(rw_mutex);
-      auto it = storage.find(id);
-      if (it != storage.end())
-        return std::make_pair(it->second.vector, it->second.metadata);
-      return std::nullopt;
-    }
+      IndexStats out;
+      if (format_version >= 11)
+        skip_floats(); // PQ codebook
+      if (format_version >= 19)
+      {
+        uint64_t codes = 0;
+        read_le(is, codes);
+        skip(codes); // PQ codes
+      }
+      if (format_version >= 12)
+        skip_floats(); // projection matrix
+      if (format_version >= 13)
+      {
+        skip_floats(); // centroids
+        skip_floats(); // SQ8 bounds
+        uint64_t trained = 0, list_count = 0;
+        read_le(is, trained);
+        read_le(is, list_count);
+        for (uint64_t l = 0; l < list_count && is; ++l)
+        {
+          uint64_t ids = 0;
+          read_le(is, ids);
+          skip(ids * sizeof(VectorId));
+          out.ivf_list_sizes.push_back(ids);
+        }
+      }
 
-    bool remove(VectorId id)
-    {
-      std::lock_guard<std::shared_mutex> lock(rw_mutex);
-      if (storage.find(id) == storage.end())
-        return false;
-      remove_from_metadata_index(id);
-      try
+      read_le(is, out.vectors);
+      for (uint64_t i = 0; i < out.vectors && is; ++i)
       {
-        hnsw_index->markDelete(id);
+        uint64_t id = 0, vec_len = 0, meta_pairs = 0;
+        read_le(is, id);
+        read_le(is, vec_len);
+        skip(vec_len * distance::element_size(config.element_type));
+        read_le(is, meta_pairs);
+        for (uint64_t m = 0; m < meta_pairs; ++m)
+        {
+          read_string(is);
+          read_metadata_value(is);
+        }
       }
-      catch (...)
+
+      uint64_t meta_idx_size = 0, key_count = 0;
+      read_le(is, meta_idx_size);
+      if (meta_idx_size > 0)
+        read_le(is, key_count);
+      for (uint64_t k = 0; k < key_count && is; ++k)
       {
+        std::string key = read_string(is);
+        uint64_t value_count = 0;
+        read_le(is, value_count);
+        std::vector<uint64_t> sizes;
+        for (uint64_t v = 0; v < value_count && is; ++v)
+        {
+          read_metadata_value(is);
+          uint64_t ids = 0;
+          read_le(is, ids);
+          skip(ids * sizeof(VectorId));
+          sizes.push_back(ids);
+        }
+        out.postings[key] = stats::posting_stats(sizes);
       }
-      storage.erase(id);
-      return true;
-    }
 
-    size_t count() const
-    {
-      std::shared_lock<std::shared_mutex> lock(rw_mutex);
-      return storage.size();
+      uint64_t hnsw_size = 0;
+      read_le(is, hnsw_size);
+      if (!is)
+      {
+        std::cerr << "Truncated database file: " << path << std::endl;
+        return std::nullopt;
+      }
+      if (hnsw_size > 0)
+      {
+        FileGraph graph;
+        if (!graph.read(is))
+        {
+          std::cerr << "Unreadable graph section in " << path << std::endl;
+          return std::nullopt;
+        }
+        out.max_links = static_cast<uint32_t>(graph.max_links);
+        out.max_links0 = static_cast<uint32_t>(graph.max_links0);
+        stats::graph_stats(graph, out);
+      }
+      return out;
     }
-  };
+  } // namespace
 
   Database::Database() : pimpl(nullptr) {}
   Database::~Database() { delete pimpl; }
@@ -616,6 +3640,8 @@ namespace orion
   {
     try
     {
+      if (!metric_available(config) || !projection_valid(config) || !index_valid(config))
+        return std::nullopt;
       Database d;
       d.pimpl = new Impl(path, config);
       if (!d.pimpl->save())
@@ -627,12 +3653,15 @@ namespace orion
       return std::nullopt;
     }
   }
-  std::optional<Database> Database::load(const std::string &path)
+  std::optional<Database> Database::load(const std::string &path, const LoadOptions &options)
   {
     try
     {
       Database d;
       d.pimpl = new Impl(path, Config());
+      // applied to the loaded graph, not the empty one Impl starts with
+      d.pimpl->config.huge_pages = options.huge_pages;
+      d.pimpl->config.lock_memory = options.lock_memory;
       if (!d.pimpl->load())
         return std::nullopt;
       return d;
@@ -642,6 +3671,61 @@ namespace orion
       return std::nullopt;
     }
   }
+  bool Database::verify(const std::string &path)
+  {
+    try
+    {
+      std::ifstream is(path, std::ios::binary | std::ios::ate);
+      char magic[8];
+      const uint64_t size = is ? static_cast<uint64_t>(is.tellg()) : 0;
+      is.seekg(0);
+      uint32_t format_version = 0;
+      if (size < 12 || !is.read(magic, 8) || std::memcmp(magic, "ORIONDB2", 8) != 0)
+      {
+        std::cerr << "verify: not an Orion database: " << path << std::endl;
+        return false;
+      }
+      read_le(is, format_version);
+      if (format_version >= kFirstChecksummedVersion)
+      {
+        uint32_t stored = 0;
+        is.seekg(static_cast<std::streamoff>(size - sizeof(stored)));
+        read_le(is, stored);
+        const std::optional<uint32_t> computed = file_crc(path, size - sizeof(stored));
+        if (!is || !computed || *computed != stored)
+        {
+          std::cerr << "verify: checksum mismatch in " << path << std::endl;
+          return false;
+        }
+      }
+      else
+        std::cerr << "verify: format version " << format_version << " has no checksum" << std::endl;
+      std::optional<Database> db = load(path);
+      if (!db)
+      {
+        std::cerr << "verify: failed to load " << path << std::endl;
+        return false;
+      }
+      return db->pimpl->check_integrity() == 0;
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "verify: " << e.what() << std::endl;
+      return false;
+    }
+  }
+  std::optional<IndexStats> Database::inspect(const std::string &path)
+  {
+    try
+    {
+      return inspect_file(path);
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "Failed to inspect " << path << ": " << e.what() << std::endl;
+      return std::nullopt;
+    }
+  }
   bool Database::save()
   {
     if (!pimpl)
@@ -654,6 +3738,24 @@ namespace orion
       return false;
     return pimpl->add(id, vec, meta);
   }
+  bool Database::add(VectorId id, std::span<const int8_t> vec, const Metadata &meta)
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->add(id, vec, meta);
+  }
+  bool Database::add(VectorId id, std::span<const uint8_t> vec, const Metadata &meta)
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->add(id, vec, meta);
+  }
+  bool Database::add(VectorId id, std::span<const std::byte> bits, const Metadata &meta)
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->add(id, bits, meta);
+  }
   std::vector<QueryResult> Database::query(const Vector &query_vec, size_t n) const
   {
     if (!pimpl)
@@ -664,7 +3766,37 @@ namespace orion
   {
     if (!pimpl)
       return {};
-    return pimpl->query(query_vec, n, filter);
+    return pimpl->query(query_vec, n, filter, QueryOptions());
+  }
+  std::vector<QueryResult> Database::query(const Vector &query_vec, size_t n, const Metadata &filter, const QueryOptions &options) const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->query(query_vec, n, filter, options);
+  }
+  std::vector<std::vector<QueryResult>> Database::query_batch(const std::vector<Vector> &queries, size_t n, const Metadata &filter, const QueryOptions &options) const
+  {
+    if (!pimpl)
+      return std::vector<std::vector<QueryResult>>(queries.size());
+    return pimpl->query_batch(queries, n, filter, options);
+  }
+  std::vector<QueryResult> Database::query(std::span<const int8_t> query_vec, size_t n, const Metadata &filter, const QueryOptions &options) const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->query(query_vec, n, filter, options);
+  }
+  std::vector<QueryResult> Database::query(std::span<const uint8_t> query_vec, size_t n, const Metadata &filter, const QueryOptions &options) const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->query(query_vec, n, filter, options);
+  }
+  std::vector<QueryResult> Database::query(std::span<const std::byte> query_bits, size_t n, const Metadata &filter, const QueryOptions &options) const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->query(query_bits, n, filter, options);
   }
   std::optional<std::pair<Vector, Metadata>> Database::get(VectorId id) const
   {
@@ -678,6 +3810,101 @@ namespace orion
       return false;
     return pimpl->remove(id);
   }
+  bool Database::train_projection()
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->train_projection();
+  }
+  bool Database::train_quantizer()
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->train_quantizer();
+  }
+  bool Database::build_disk_index(const std::string &path, const DiskIndexConfig &config) const
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->build_disk_index(path, config);
+  }
+  bool Database::train_ivf()
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->train_ivf();
+  }
+  Clustering Database::cluster(size_t k, size_t iterations, size_t sample_size, const Metadata &filter) const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->cluster(k, iterations, sample_size, filter);
+  }
+  bool Database::knn_join(const Database &other, size_t k, const JoinCallback &on_result, const Metadata &filter, size_t threads) const
+  {
+    if (!pimpl || !other.pimpl)
+      return false;
+    return pimpl->knn_join(*other.pimpl, k, on_result, filter, threads);
+  }
+  size_t Database::repair_graph()
+  {
+    if (!pimpl)
+      return 0;
+    return pimpl->repair_graph();
+  }
+  uint32_t Database::autotune(float target_recall, size_t k, size_t sample_queries)
+  {
+    if (!pimpl)
+      return 0;
+    return pimpl->autotune(target_recall, k, sample_queries);
+  }
+  bool Database::add_batch(const std::vector<VectorId> &ids, const std::vector<Vector> &vectors, const std::vector<Metadata> &metas)
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->add_batch(ids, vectors, metas);
+  }
+  void Database::for_each(const RecordVisitor &visit) const
+  {
+    if (pimpl)
+      pimpl->for_each(visit);
+  }
+  bool Database::import_npy(const std::string &path, const ImportOptions &options)
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->import_matrix(path, true, options);
+  }
+  bool Database::import_fvecs(const std::string &path, const ImportOptions &options)
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->import_matrix(path, false, options);
+  }
+  bool Database::compact()
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->compact();
+  }
+  IndexStats Database::stats() const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->stats();
+  }
+  size_t Database::warmup(size_t node_budget, const std::vector<Vector> &sample_queries) const
+  {
+    if (!pimpl)
+      return 0;
+    return pimpl->warmup(node_budget, sample_queries);
+  }
+  bool Database::optimize_layout()
+  {
+    if (!pimpl)
+      return false;
+    return pimpl->optimize_layout();
+  }
   size_t Database::count() const
   {
     if (!pimpl)
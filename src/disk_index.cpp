@@ -0,0 +1,493 @@
+#include "orion/disk_index.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "distance.h"
+#include "endian.h"
+#include "kmeans.h"
+#include "vamana.h"
+
+namespace orion
+{
+  using namespace endian_helpers;
+
+  namespace
+  {
+    // File layout, little-endian:
+    //   sector 0        header (offsets in Layout::store)
+    //   sectors 1..     node slots: dim floats, u64 id, u32 degree,
+    //                   max_degree u32 neighbors. Small nodes are packed
+    //                   nodes_per_sector to a sector, large ones take
+    //                   sectors_per_node whole sectors, so a node never
+    //                   straddles a sector boundary it does not have to.
+    //   pq_offset       PQ codebook (dim * 256 floats), then count * pq_bytes codes
+    constexpr size_t kSector = 4096;
+    constexpr uint32_t kDiskFormatVersion = 1;
+    constexpr size_t kCentroids = 256;
+    constexpr char kMagic[8] = {'O', 'R', 'I', 'O', 'N', 'D', 'S', 'K'};
+
+    struct Layout
+    {
+      uint32_t dim = 0;
+      Metric metric = Metric::L2;
+      uint32_t max_degree = 0;
+      uint64_t count = 0;
+      uint32_t medoid = 0;
+      uint32_t node_bytes = 0;
+      uint32_t nodes_per_sector = 0; // 0 when a node spans sectors
+      uint32_t sectors_per_node = 0;
+      uint64_t pq_offset = 0;
+      uint32_t pq_bytes = 0;
+
+      static Layout make(uint32_t dim, uint32_t max_degree)
+      {
+        Layout layout;
+        layout.dim = dim;
+        layout.max_degree = max_degree;
+        layout.node_bytes = dim * 4 + 8 + 4 + max_degree * 4;
+        if (layout.node_bytes <= kSector)
+        {
+          layout.nodes_per_sector = static_cast<uint32_t>(kSector / layout.node_bytes);
+          layout.sectors_per_node = 1;
+        }
+        else
+          layout.sectors_per_node = static_cast<uint32_t>((layout.node_bytes + kSector - 1) / kSector);
+        return layout;
+      }
+
+      // first byte of the sector run holding node, and node's offset in it
+      uint64_t sector_offset(uint32_t node) const
+      {
+        if (nodes_per_sector > 0)
+          return (1 + uint64_t(node / nodes_per_sector)) * kSector;
+        return (1 + uint64_t(node) * sectors_per_node) * kSector;
+      }
+      size_t slot_offset(uint32_t node) const { return nodes_per_sector > 0 ? size_t(node % nodes_per_sector) * node_bytes : 0; }
+      size_t read_bytes() const { return size_t(sectors_per_node) * kSector; }
+      uint64_t node_sectors() const
+      {
+        if (nodes_per_sector > 0)
+          return (count + nodes_per_sector - 1) / nodes_per_sector;
+        return count * sectors_per_node;
+      }
+
+      void store(char *header) const
+      {
+        std::memcpy(header, kMagic, 8);
+        store_le(header + 8, kDiskFormatVersion);
+        store_le(header + 12, dim);
+        store_le(header + 16, static_cast<uint32_t>(metric));
+        store_le(header + 20, max_degree);
+        store_le(header + 24, count);
+        store_le(header + 32, medoid);
+        store_le(header + 36, node_bytes);
+        store_le(header + 40, nodes_per_sector);
+        store_le(header + 44, sectors_per_node);
+        store_le(header + 48, pq_offset);
+        store_le(header + 56, pq_bytes);
+      }
+
+      bool load(const char *header)
+      {
+        if (std::memcmp(header, kMagic, 8) != 0 || load_le<uint32_t>(header + 8) != kDiskFormatVersion)
+          return false;
+        dim = load_le<uint32_t>(header + 12);
+        uint32_t metric_value = load_le<uint32_t>(header + 16);
+        if (metric_value > static_cast<uint32_t>(Metric::InnerProduct))
+          return false;
+        metric = static_cast<Metric>(metric_value);
+        max_degree = load_le<uint32_t>(header + 20);
+        count = load_le<uint64_t>(header + 24);
+        medoid = load_le<uint32_t>(header + 32);
+        node_bytes = load_le<uint32_t>(header + 36);
+        nodes_per_sector = load_le<uint32_t>(header + 40);
+        sectors_per_node = load_le<uint32_t>(header + 44);
+        pq_offset = load_le<uint64_t>(header + 48);
+        pq_bytes = load_le<uint32_t>(header + 56);
+        const Layout expected = make(dim, max_degree);
+        return dim > 0 && pq_bytes > 0 && pq_bytes <= dim && node_bytes == expected.node_bytes &&
+               nodes_per_sector == expected.nodes_per_sector && sectors_per_node == expected.sectors_per_node &&
+               (count == 0 || medoid < count);
+      }
+    };
+
+    // 8-bit product quantizer: pq_bytes subspaces of 256 centroids each
+    struct ProductCodes
+    {
+      size_t dim = 0;
+      size_t subspaces = 0;
+      std::vector<float> codebook; // centroid c of subspace m at offset(m) * 256 + c * width(m)
+      std::vector<uint8_t> codes;
+
+      size_t offset(size_t m) const { return m * dim / subspaces; }
+      size_t width(size_t m) const { return offset(m + 1) - offset(m); }
+
+      void train(const std::vector<const float *> &vectors, std::mt19937 &rng)
+      {
+        constexpr size_t kMaxSample = 20000;
+        std::vector<const float *> sample = vectors;
+        if (sample.size() > kMaxSample)
+        {
+          std::shuffle(sample.begin(), sample.end(), rng);
+          sample.resize(kMaxSample);
+        }
+        codebook.assign(dim * kCentroids, 0.0f);
+        std::vector<float> sub;
+        for (size_t m = 0; m < subspaces; ++m)
+        {
+          const size_t w = width(m);
+          sub.resize(sample.size() * w);
+          for (size_t i = 0; i < sample.size(); ++i)
+            std::copy(sample[i] + offset(m), sample[i] + offset(m) + w, &sub[i * w]);
+          std::vector<float> centroids = kmeans::train(sub.data(), sample.size(), w, kCentroids, 10, rng);
+          std::copy(centroids.begin(), centroids.end(), codebook.begin() + offset(m) * kCentroids);
+        }
+      }
+
+      void encode(const std::vector<const float *> &vectors)
+      {
+        codes.assign(vectors.size() * subspaces, 0);
+        kmeans::parallel_for(vectors.size(), [&](size_t begin, size_t end)
+                             {
+          std::vector<float> centroids;
+          for (size_t m = 0; m < subspaces; ++m)
+          {
+            centroids.assign(codebook.begin() + offset(m) * kCentroids, codebook.begin() + offset(m + 1) * kCentroids);
+            for (size_t i = begin; i < end; ++i)
+              codes[i * subspaces + m] = static_cast<uint8_t>(kmeans::nearest(vectors[i] + offset(m), centroids, width(m)));
+          } });
+      }
+
+      // table[m * 256 + c]: the query's distance contribution from centroid c
+      // of subspace m (squared L2, or minus the dot product)
+      std::vector<float> table(const float *query, Metric metric) const
+      {
+        std::vector<float> lut(subspaces * kCentroids);
+        for (size_t m = 0; m < subspaces; ++m)
+        {
+          const size_t w = width(m);
+          const float *q = query + offset(m);
+          for (size_t c = 0; c < kCentroids; ++c)
+          {
+            const float *cen = &codebook[offset(m) * kCentroids + c * w];
+            float sum = 0.0f;
+            for (size_t d = 0; d < w; ++d)
+              sum += metric == Metric::L2 ? (q[d] - cen[d]) * (q[d] - cen[d]) : -q[d] * cen[d];
+            lut[m * kCentroids + c] = sum;
+          }
+        }
+        return lut;
+      }
+
+      float distance(const std::vector<float> &lut, uint32_t node) const
+      {
+        const uint8_t *code = &codes[size_t(node) * subspaces];
+        float sum = 0.0f;
+        for (size_t m = 0; m < subspaces; ++m)
+          sum += lut[m * kCentroids + code[m]];
+        return sum;
+      }
+    };
+
+    bool write_all(int fd, const void *data, size_t bytes, uint64_t offset)
+    {
+      const char *p = static_cast<const char *>(data);
+      while (bytes > 0)
+      {
+        ssize_t written = ::pwrite(fd, p, bytes, static_cast<off_t>(offset));
+        if (written <= 0)
+          return false;
+        p += written;
+        bytes -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+      }
+      return true;
+    }
+
+    bool read_all(int fd, void *data, size_t bytes, uint64_t offset)
+    {
+      char *p = static_cast<char *>(data);
+      while (bytes > 0)
+      {
+        ssize_t got = ::pread(fd, p, bytes, static_cast<off_t>(offset));
+        if (got <= 0)
+          return false;
+        p += got;
+        bytes -= static_cast<size_t>(got);
+        offset += static_cast<uint64_t>(got);
+      }
+      return true;
+    }
+  } // namespace
+
+  bool vamana::write_disk_index(const std::string &path, const std::vector<VectorId> &ids, const std::vector<const float *> &vectors, size_t dim, Metric metric, const DiskIndexConfig &config)
+  {
+    Layout layout = Layout::make(static_cast<uint32_t>(dim), std::max<uint32_t>(config.max_degree, 1));
+    layout.metric = metric;
+    layout.count = vectors.size();
+
+    std::mt19937 rng(42);
+    Builder builder(vectors, dim, layout.max_degree, config.build_list_size);
+    Graph graph = builder.build(config.alpha, rng);
+    layout.medoid = graph.medoid;
+
+    ProductCodes pq;
+    pq.dim = dim;
+    pq.subspaces = std::clamp<size_t>(config.pq_bytes ? config.pq_bytes : dim / 4, 1, dim);
+    layout.pq_bytes = static_cast<uint32_t>(pq.subspaces);
+    if (!vectors.empty())
+    {
+      pq.train(vectors, rng);
+      pq.encode(vectors);
+    }
+    else
+      pq.codebook.assign(dim * kCentroids, 0.0f);
+    layout.pq_offset = (1 + layout.node_sectors()) * kSector;
+
+    const std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+      std::cerr << "Cannot create disk index file " << tmp_path << ": errno=" << errno << std::endl;
+      return false;
+    }
+    bool ok = true;
+    std::vector<char> sector(kSector, 0);
+    layout.store(sector.data());
+    ok = write_all(fd, sector.data(), kSector, 0);
+
+    // fill one sector run at a time: all nodes of a packed sector, or the
+    // sectors of a single large node
+    std::vector<char> run(layout.read_bytes());
+    for (uint64_t first = 0; ok && first < layout.count;)
+    {
+      const uint64_t per_run = layout.nodes_per_sector > 0 ? layout.nodes_per_sector : 1;
+      const uint64_t last = std::min<uint64_t>(first + per_run, layout.count);
+      std::fill(run.begin(), run.end(), 0);
+      for (uint64_t node = first; node < last; ++node)
+      {
+        char *slot = run.data() + layout.slot_offset(static_cast<uint32_t>(node));
+        for (size_t d = 0; d < dim; ++d)
+          store_le(slot + d * 4, vectors[node][d]);
+        char *tail = slot + dim * 4;
+        store_le(tail, ids[node]);
+        const auto &neighbors = graph.neighbors[node];
+        store_le(tail + 8, static_cast<uint32_t>(neighbors.size()));
+        for (size_t k = 0; k < neighbors.size(); ++k)
+          store_le(tail + 12 + k * 4, neighbors[k]);
+      }
+      ok = write_all(fd, run.data(), run.size(), layout.sector_offset(static_cast<uint32_t>(first)));
+      first = last;
+    }
+
+    std::vector<char> pq_section(pq.codebook.size() * 4);
+    for (size_t i = 0; i < pq.codebook.size(); ++i)
+      store_le(&pq_section[i * 4], pq.codebook[i]);
+    pq_section.insert(pq_section.end(), pq.codes.begin(), pq.codes.end());
+    ok = ok && write_all(fd, pq_section.data(), pq_section.size(), layout.pq_offset);
+    ok = ok && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+      std::cerr << "Failed to write disk index " << path << ": errno=" << errno << std::endl;
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  class DiskIndex::Impl
+  {
+  public:
+    int fd = -1;
+    Layout layout;
+    ProductCodes pq;
+    distance::Kernels kernels{};
+    mutable std::atomic<uint64_t> sectors_read{0};
+
+    ~Impl()
+    {
+      if (fd != -1)
+        ::close(fd);
+    }
+
+    bool open(const std::string &path)
+    {
+      fd = ::open(path.c_str(), O_RDONLY);
+      if (fd == -1)
+        return false;
+      std::vector<char> header(kSector);
+      if (!read_all(fd, header.data(), kSector, 0) || !layout.load(header.data()))
+      {
+        std::cerr << "Invalid or unsupported disk index " << path << "." << std::endl;
+        return false;
+      }
+      pq.dim = layout.dim;
+      pq.subspaces = layout.pq_bytes;
+      std::vector<char> codebook(size_t(layout.dim) * kCentroids * 4);
+      pq.codes.resize(static_cast<size_t>(layout.count) * layout.pq_bytes);
+      if (!read_all(fd, codebook.data(), codebook.size(), layout.pq_offset) ||
+          !read_all(fd, pq.codes.data(), pq.codes.size(), layout.pq_offset + codebook.size()))
+      {
+        std::cerr << "Truncated disk index " << path << "." << std::endl;
+        return false;
+      }
+      pq.codebook.resize(size_t(layout.dim) * kCentroids);
+      for (size_t i = 0; i < pq.codebook.size(); ++i)
+        pq.codebook[i] = load_le<float>(&codebook[i * 4]);
+      kernels = distance::kernels_for(ElementType::Float32, layout.metric, layout.dim);
+      return true;
+    }
+
+    // Beam search: the candidate list is ordered by PQ distance; each hop
+    // takes the beam_width closest unexpanded candidates, hints all their
+    // sector runs to the kernel so the reads are in flight together, then
+    // reads and expands them. Each read node is also scored exactly, and the
+    // exact scores decide the results.
+    std::vector<QueryResult> query(const Vector &query_vec, size_t n, const DiskQueryOptions &options) const
+    {
+      if (query_vec.size() != layout.dim || layout.count == 0 || n == 0)
+        return {};
+      struct Candidate
+      {
+        float distance;
+        uint32_t node;
+        bool expanded;
+      };
+      const size_t list_size = std::max<size_t>(options.list_size, n);
+      const size_t beam = std::max<uint32_t>(options.beam_width, 1);
+      const std::vector<float> lut = pq.table(query_vec.data(), layout.metric);
+      std::vector<Candidate> list;
+      std::unordered_set<uint32_t> seen;
+      auto offer = [&](uint32_t node)
+      {
+        if (node >= layout.count || !seen.insert(node).second)
+          return;
+        Candidate c{pq.distance(lut, node), node, false};
+        if (list.size() >= list_size && c.distance >= list.back().distance)
+          return;
+        auto pos = std::upper_bound(list.begin(), list.end(), c.distance, [](float d, const Candidate &other)
+                                    { return d < other.distance; });
+        list.insert(pos, c);
+        if (list.size() > list_size)
+          list.pop_back();
+      };
+      offer(layout.medoid);
+
+      std::vector<std::pair<float, VectorId>> exact;
+      std::vector<uint32_t> batch;
+      std::vector<char> buffer;
+      std::vector<float> vec(layout.dim);
+      while (true)
+      {
+        batch.clear();
+        for (auto &c : list)
+        {
+          if (batch.size() >= beam)
+            break;
+          if (!c.expanded)
+          {
+            c.expanded = true;
+            batch.push_back(c.node);
+          }
+        }
+        if (batch.empty())
+          break;
+        const size_t run = layout.read_bytes();
+        buffer.resize(batch.size() * run);
+#if defined(POSIX_FADV_WILLNEED)
+        for (uint32_t node : batch)
+          ::posix_fadvise(fd, static_cast<off_t>(layout.sector_offset(node)), static_cast<off_t>(run), POSIX_FADV_WILLNEED);
+#endif
+        for (size_t b = 0; b < batch.size(); ++b)
+        {
+          if (!read_all(fd, &buffer[b * run], run, layout.sector_offset(batch[b])))
+            return {};
+        }
+        sectors_read.fetch_add(batch.size() * layout.sectors_per_node, std::memory_order_relaxed);
+        for (size_t b = 0; b < batch.size(); ++b)
+        {
+          const char *slot = &buffer[b * run] + layout.slot_offset(batch[b]);
+          for (size_t d = 0; d < layout.dim; ++d)
+            vec[d] = load_le<float>(slot + d * 4);
+          const char *tail = slot + size_t(layout.dim) * 4;
+          exact.emplace_back(kernels.distance(query_vec.data(), vec.data(), layout.dim), load_le<uint64_t>(tail));
+          const uint32_t degree = std::min(load_le<uint32_t>(tail + 8), layout.max_degree);
+          for (uint32_t k = 0; k < degree; ++k)
+            offer(load_le<uint32_t>(tail + 12 + k * 4));
+        }
+      }
+      const size_t keep = std::min(n, exact.size());
+      std::partial_sort(exact.begin(), exact.begin() + keep, exact.end());
+      std::vector<QueryResult> results;
+      results.reserve(keep);
+      for (size_t i = 0; i < keep; ++i)
+        results.push_back({exact[i].second, exact[i].first, SearchPath::Graph});
+      return results;
+    }
+  };
+
+  DiskIndex::DiskIndex() : pimpl(nullptr) {}
+  DiskIndex::~DiskIndex() { delete pimpl; }
+  DiskIndex::DiskIndex(DiskIndex &&other) noexcept : pimpl(other.pimpl) { other.pimpl = nullptr; }
+  DiskIndex &DiskIndex::operator=(DiskIndex &&other) noexcept
+  {
+    if (this != &other)
+    {
+      delete pimpl;
+      pimpl = other.pimpl;
+      other.pimpl = nullptr;
+    }
+    return *this;
+  }
+  std::optional<DiskIndex> DiskIndex::open(const std::string &path)
+  {
+    try
+    {
+      DiskIndex index;
+      index.pimpl = new Impl();
+      if (!index.pimpl->open(path))
+        return std::nullopt;
+      return index;
+    }
+    catch (...)
+    {
+      return std::nullopt;
+    }
+  }
+  std::vector<QueryResult> DiskIndex::query(const Vector &query_vec, size_t n, const DiskQueryOptions &options) const
+  {
+    if (!pimpl)
+      return {};
+    return pimpl->query(query_vec, n, options);
+  }
+  size_t DiskIndex::size() const
+  {
+    if (!pimpl)
+      return 0;
+    return static_cast<size_t>(pimpl->layout.count);
+  }
+  uint32_t DiskIndex::dim() const
+  {
+    if (!pimpl)
+      return 0;
+    return pimpl->layout.dim;
+  }
+  uint64_t DiskIndex::sectors_read() const
+  {
+    if (!pimpl)
+      return 0;
+    return pimpl->sectors_read.load(std::memory_order_relaxed);
+  }
+} // namespace orion
@@ -0,0 +1,547 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "orion/database.h"
+#include "orion/metric.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ORION_X86_DISPATCH 1
+#include <immintrin.h>
+#if (defined(__clang__) && __clang_major__ >= 13) || (!defined(__clang__) && __GNUC__ >= 11)
+#define ORION_HAVE_AVXVNNI 1
+#endif
+#endif
+
+namespace orion
+{
+  // distance kernels used by Orion's own scan and search loops and by the
+  // hnswlib space the graph is built with. Smaller is closer: squared L2,
+  // 1 - dot for inner product (hnswlib's InnerProductSpace convention), or
+  // the number of differing bits for binary vectors.
+  namespace distance
+  {
+    // same table as registered custom metrics; built-in kernels take vectors
+    // of the configured element type and dim counts elements (bits for
+    // binary), not bytes. batch4 shares the query loads across four vectors.
+    using Kernels = MetricKernels;
+
+    // built-in kernels ignore context
+    template <typename T, float (*F)(const T *, const T *, size_t)>
+    float erased(const void *a, const void *b, size_t dim, const void *)
+    {
+      return F(static_cast<const T *>(a), static_cast<const T *>(b), dim);
+    }
+
+    template <typename T, void (*B)(const T *, const T *const *, size_t, float *)>
+    void erased_batch4(const void *query, const void *const *vectors, size_t dim, float *out, const void *)
+    {
+      const T *typed[4] = {static_cast<const T *>(vectors[0]), static_cast<const T *>(vectors[1]),
+                           static_cast<const T *>(vectors[2]), static_cast<const T *>(vectors[3])};
+      B(static_cast<const T *>(query), typed, dim, out);
+    }
+
+    template <typename T, float (*F)(const T *, const T *, size_t)>
+    void batch4_by_one(const void *query, const void *const *vectors, size_t dim, float *out, const void *)
+    {
+      for (int j = 0; j < 4; ++j)
+        out[j] = F(static_cast<const T *>(query), static_cast<const T *>(vectors[j]), dim);
+    }
+
+    template <typename T, float (*F)(const T *, const T *, size_t)>
+    float space_adapter(const void *a, const void *b, const void *param)
+    {
+      return F(static_cast<const T *>(a), static_cast<const T *>(b), static_cast<const MetricParam *>(param)->dim);
+    }
+
+    template <typename T, float (*F)(const T *, const T *, size_t), void (*B)(const T *, const T *const *, size_t, float *)>
+    constexpr Kernels make_kernels()
+    {
+      return Kernels{erased<T, F>, erased_batch4<T, B>, space_adapter<T, F>};
+    }
+
+    template <typename T, float (*F)(const T *, const T *, size_t)>
+    constexpr Kernels make_single_kernels()
+    {
+      return Kernels{erased<T, F>, batch4_by_one<T, F>, space_adapter<T, F>};
+    }
+
+    inline void prefetch(const void *ptr)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+      __builtin_prefetch(ptr, 0, 3);
+#else
+      (void)ptr;
+#endif
+    }
+
+    // pulls every cache line of a vector towards L1
+    inline void prefetch_range(const void *ptr, size_t bytes)
+    {
+      const char *p = static_cast<const char *>(ptr);
+      for (size_t offset = 0; offset < bytes; offset += 64)
+        prefetch(p + offset);
+    }
+
+    // bytes per stored unit: a float, an 8-bit component or a byte of packed bits
+    inline size_t element_size(ElementType type)
+    {
+      return type == ElementType::Float32 ? sizeof(float) : 1;
+    }
+
+    // stored units per vector of dim components
+    inline size_t stored_units(ElementType type, size_t dim)
+    {
+      return type == ElementType::Binary ? (dim + 7) / 8 : dim;
+    }
+
+    inline size_t vector_bytes(ElementType type, size_t dim)
+    {
+      return stored_units(type, dim) * element_size(type);
+    }
+
+    // per-metric pieces shared by the float kernels
+    struct L2Op
+    {
+      static float term(float a, float b)
+      {
+        float d = a - b;
+        return d * d;
+      }
+      static float finish(float sum) { return sum; }
+    };
+
+    struct DotOp
+    {
+      static float term(float a, float b) { return a * b; }
+      static float finish(float sum) { return 1.0f - sum; }
+    };
+
+    template <typename Op>
+    float f32_scalar(const float *a, const float *b, size_t dim)
+    {
+      float sum = 0.0f;
+      for (size_t i = 0; i < dim; ++i)
+        sum += Op::term(a[i], b[i]);
+      return Op::finish(sum);
+    }
+
+    template <typename Op>
+    void f32_batch4_scalar(const float *query, const float *const *vectors, size_t dim, float *out)
+    {
+      for (int j = 0; j < 4; ++j)
+        out[j] = f32_scalar<Op>(query, vectors[j], dim);
+    }
+
+    // integer kernels accumulate exactly in int32 (fine below ~33k dims)
+    template <typename T>
+    float l2_int_scalar(const T *a, const T *b, size_t dim)
+    {
+      int32_t sum = 0;
+      for (size_t i = 0; i < dim; ++i)
+      {
+        int32_t d = int32_t(a[i]) - int32_t(b[i]);
+        sum += d * d;
+      }
+      return float(sum);
+    }
+
+    template <typename T>
+    float dot_int_scalar(const T *a, const T *b, size_t dim)
+    {
+      int32_t sum = 0;
+      for (size_t i = 0; i < dim; ++i)
+        sum += int32_t(a[i]) * int32_t(b[i]);
+      return 1.0f - float(sum);
+    }
+
+    // bits past dim in the last byte are padding and never counted
+    inline uint32_t hamming_tail(const uint8_t *a, const uint8_t *b, size_t byte_begin, size_t dim)
+    {
+      uint32_t bits = 0;
+      const size_t full_bytes = dim / 8;
+      for (size_t i = byte_begin; i < full_bytes; ++i)
+        bits += static_cast<uint32_t>(std::popcount(static_cast<uint8_t>(a[i] ^ b[i])));
+      if (dim % 8)
+        bits += static_cast<uint32_t>(std::popcount(static_cast<uint8_t>((a[full_bytes] ^ b[full_bytes]) & ((1u << (dim % 8)) - 1))));
+      return bits;
+    }
+
+    inline uint64_t load_word(const uint8_t *p)
+    {
+      uint64_t word;
+      std::memcpy(&word, p, sizeof(word));
+      return word;
+    }
+
+    inline float hamming_scalar(const uint8_t *a, const uint8_t *b, size_t dim)
+    {
+      const size_t words = dim / 64;
+      uint32_t bits = 0;
+      for (size_t w = 0; w < words; ++w)
+        bits += static_cast<uint32_t>(std::popcount(load_word(a + w * 8) ^ load_word(b + w * 8)));
+      return float(bits + hamming_tail(a, b, words * 8, dim));
+    }
+
+#ifdef ORION_X86_DISPATCH
+    // compiled for the popcnt instruction, four independent counters
+    __attribute__((target("popcnt"))) inline float hamming_popcnt(const uint8_t *a, const uint8_t *b, size_t dim)
+    {
+      const size_t words = dim / 64;
+      uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+      size_t w = 0;
+      for (; w + 4 <= words; w += 4)
+      {
+        const uint8_t *pa = a + w * 8, *pb = b + w * 8;
+        c0 += __builtin_popcountll(load_word(pa) ^ load_word(pb));
+        c1 += __builtin_popcountll(load_word(pa + 8) ^ load_word(pb + 8));
+        c2 += __builtin_popcountll(load_word(pa + 16) ^ load_word(pb + 16));
+        c3 += __builtin_popcountll(load_word(pa + 24) ^ load_word(pb + 24));
+      }
+      for (; w < words; ++w)
+        c0 += __builtin_popcountll(load_word(a + w * 8) ^ load_word(b + w * 8));
+      return float(c0 + c1 + c2 + c3 + hamming_tail(a, b, words * 8, dim));
+    }
+
+    inline bool cpu_has_popcnt()
+    {
+      static const bool supported = __builtin_cpu_supports("popcnt");
+      return supported;
+    }
+
+    __attribute__((target("avx2,fma"))) inline float hsum_avx2(__m256 v)
+    {
+      __m128 lo = _mm256_castps256_ps128(v);
+      __m128 hi = _mm256_extractf128_ps(v, 1);
+      lo = _mm_add_ps(lo, hi);
+      lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+      lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+      return _mm_cvtss_f32(lo);
+    }
+
+    __attribute__((target("avx2"))) inline int32_t hsum_epi32_avx2(__m256i v)
+    {
+      __m128i lo = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, 0x4e));
+      lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, 0xb1));
+      return _mm_cvtsi128_si32(lo);
+    }
+
+    struct L2Avx2
+    {
+      using Scalar = L2Op;
+      __attribute__((target("avx2,fma"))) static __m256 step(__m256 q, __m256 x, __m256 acc)
+      {
+        __m256 d = _mm256_sub_ps(q, x);
+        return _mm256_fmadd_ps(d, d, acc);
+      }
+    };
+
+    struct DotAvx2
+    {
+      using Scalar = DotOp;
+      __attribute__((target("avx2,fma"))) static __m256 step(__m256 q, __m256 x, __m256 acc)
+      {
+        return _mm256_fmadd_ps(q, x, acc);
+      }
+    };
+
+    template <typename Op>
+    __attribute__((target("avx2,fma"))) float f32_avx2(const float *a, const float *b, size_t dim)
+    {
+      __m256 acc0 = _mm256_setzero_ps();
+      __m256 acc1 = _mm256_setzero_ps();
+      size_t i = 0;
+      for (; i + 16 <= dim; i += 16)
+      {
+        acc0 = Op::step(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = Op::step(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+      }
+      for (; i + 8 <= dim; i += 8)
+        acc0 = Op::step(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+      float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+      for (; i < dim; ++i)
+        sum += Op::Scalar::term(a[i], b[i]);
+      return Op::Scalar::finish(sum);
+    }
+
+    template <typename Op>
+    __attribute__((target("avx2,fma"))) void f32_batch4_avx2(const float *query, const float *const *vectors, size_t dim, float *out)
+    {
+      const float *x0 = vectors[0], *x1 = vectors[1], *x2 = vectors[2], *x3 = vectors[3];
+      __m256 acc0 = _mm256_setzero_ps();
+      __m256 acc1 = _mm256_setzero_ps();
+      __m256 acc2 = _mm256_setzero_ps();
+      __m256 acc3 = _mm256_setzero_ps();
+      size_t i = 0;
+      for (; i + 8 <= dim; i += 8)
+      {
+        __m256 q = _mm256_loadu_ps(query + i);
+        acc0 = Op::step(q, _mm256_loadu_ps(x0 + i), acc0);
+        acc1 = Op::step(q, _mm256_loadu_ps(x1 + i), acc1);
+        acc2 = Op::step(q, _mm256_loadu_ps(x2 + i), acc2);
+        acc3 = Op::step(q, _mm256_loadu_ps(x3 + i), acc3);
+      }
+      float sums[4] = {hsum_avx2(acc0), hsum_avx2(acc1), hsum_avx2(acc2), hsum_avx2(acc3)};
+      for (; i < dim; ++i)
+      {
+        for (int j = 0; j < 4; ++j)
+          sums[j] += Op::Scalar::term(query[i], vectors[j][i]);
+      }
+      for (int j = 0; j < 4; ++j)
+        out[j] = Op::Scalar::finish(sums[j]);
+    }
+
+    // Dim is a compile-time multiple of 16: no tail, constant trip count,
+    // four independent accumulators
+    template <typename Op, size_t Dim>
+    __attribute__((target("avx2,fma"))) float f32_avx2_fixed(const float *a, const float *b, size_t)
+    {
+      static_assert(Dim % 16 == 0, "specialized dims must be multiples of 16");
+      __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+#pragma GCC unroll 16
+      for (size_t i = 0; i < Dim; i += 8)
+        acc[(i / 8) % 4] = Op::step(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc[(i / 8) % 4]);
+      return Op::Scalar::finish(hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3]))));
+    }
+
+    template <typename Op, size_t Dim>
+    __attribute__((target("avx2,fma"))) void f32_batch4_avx2_fixed(const float *query, const float *const *vectors, size_t, float *out)
+    {
+      static_assert(Dim % 16 == 0, "specialized dims must be multiples of 16");
+      const float *x0 = vectors[0], *x1 = vectors[1], *x2 = vectors[2], *x3 = vectors[3];
+      __m256 acc0 = _mm256_setzero_ps();
+      __m256 acc1 = _mm256_setzero_ps();
+      __m256 acc2 = _mm256_setzero_ps();
+      __m256 acc3 = _mm256_setzero_ps();
+#pragma GCC unroll 8
+      for (size_t i = 0; i < Dim; i += 8)
+      {
+        __m256 q = _mm256_loadu_ps(query + i);
+        acc0 = Op::step(q, _mm256_loadu_ps(x0 + i), acc0);
+        acc1 = Op::step(q, _mm256_loadu_ps(x1 + i), acc1);
+        acc2 = Op::step(q, _mm256_loadu_ps(x2 + i), acc2);
+        acc3 = Op::step(q, _mm256_loadu_ps(x3 + i), acc3);
+      }
+      out[0] = Op::Scalar::finish(hsum_avx2(acc0));
+      out[1] = Op::Scalar::finish(hsum_avx2(acc1));
+      out[2] = Op::Scalar::finish(hsum_avx2(acc2));
+      out[3] = Op::Scalar::finish(hsum_avx2(acc3));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i widen_avx2(const int8_t *p)
+    {
+      return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i widen_avx2(const uint8_t *p)
+    {
+      return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    }
+
+    // widened to int16 so madd never saturates: |d| <= 255, pair sums < 2^17
+    template <typename T>
+    __attribute__((target("avx2"))) float l2_int_avx2(const T *a, const T *b, size_t dim)
+    {
+      __m256i acc = _mm256_setzero_si256();
+      size_t i = 0;
+      for (; i + 16 <= dim; i += 16)
+      {
+        __m256i d = _mm256_sub_epi16(widen_avx2(a + i), widen_avx2(b + i));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+      }
+      int32_t sum = hsum_epi32_avx2(acc);
+      for (; i < dim; ++i)
+      {
+        int32_t d = int32_t(a[i]) - int32_t(b[i]);
+        sum += d * d;
+      }
+      return float(sum);
+    }
+
+    template <typename T>
+    __attribute__((target("avx2"))) float dot_int_avx2(const T *a, const T *b, size_t dim)
+    {
+      __m256i acc = _mm256_setzero_si256();
+      size_t i = 0;
+      for (; i + 16 <= dim; i += 16)
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(widen_avx2(a + i), widen_avx2(b + i)));
+      int32_t sum = hsum_epi32_avx2(acc);
+      for (; i < dim; ++i)
+        sum += int32_t(a[i]) * int32_t(b[i]);
+      return 1.0f - float(sum);
+    }
+
+#ifdef ORION_HAVE_AVXVNNI
+    // dpbusd multiplies unsigned by signed bytes straight into int32 lanes
+    // (maddubs would saturate its int16 pair sums on full-range inputs), so
+    // one side is shifted into the other's domain and corrected afterwards:
+    //   int8:  a.b = (a + 128).b - 128 * sum(b)
+    //   uint8: a.b = a.(b - 128) + 128 * sum(a)
+    __attribute__((target("avx2,avxvnni"))) inline float dot_i8_vnni(const int8_t *a, const int8_t *b, size_t dim)
+    {
+      const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+      const __m256i ones = _mm256_set1_epi8(1);
+      __m256i acc = _mm256_setzero_si256();
+      __m256i sum_b = _mm256_setzero_si256();
+      size_t i = 0;
+      for (; i + 32 <= dim; i += 32)
+      {
+        __m256i va = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)), bias);
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        acc = _mm256_dpbusd_avx_epi32(acc, va, vb);
+        sum_b = _mm256_dpbusd_avx_epi32(sum_b, ones, vb);
+      }
+      int32_t sum = hsum_epi32_avx2(acc) - 128 * hsum_epi32_avx2(sum_b);
+      for (; i < dim; ++i)
+        sum += int32_t(a[i]) * int32_t(b[i]);
+      return 1.0f - float(sum);
+    }
+
+    __attribute__((target("avx2,avxvnni"))) inline float dot_u8_vnni(const uint8_t *a, const uint8_t *b, size_t dim)
+    {
+      const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+      const __m256i ones = _mm256_set1_epi8(1);
+      __m256i acc = _mm256_setzero_si256();
+      __m256i sum_a = _mm256_setzero_si256();
+      size_t i = 0;
+      for (; i + 32 <= dim; i += 32)
+      {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)), bias);
+        acc = _mm256_dpbusd_avx_epi32(acc, va, vb);
+        sum_a = _mm256_dpbusd_avx_epi32(sum_a, va, ones);
+      }
+      int32_t sum = hsum_epi32_avx2(acc) + 128 * hsum_epi32_avx2(sum_a);
+      for (; i < dim; ++i)
+        sum += int32_t(a[i]) * int32_t(b[i]);
+      return 1.0f - float(sum);
+    }
+
+    inline bool cpu_has_avxvnni()
+    {
+      static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avxvnni");
+      return supported;
+    }
+#endif
+
+    inline bool cpu_has_avx2()
+    {
+      static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+      return supported;
+    }
+
+    template <typename Op, size_t Dim>
+    constexpr Kernels fixed_f32_kernels()
+    {
+      return make_kernels<float, f32_avx2_fixed<Op, Dim>, f32_batch4_avx2_fixed<Op, Dim>>();
+    }
+
+    // dispatch table for common embedding sizes
+    template <typename Op>
+    bool fixed_f32_kernels_for(size_t dim, Kernels &out)
+    {
+      switch (dim)
+      {
+      case 128:
+        out = fixed_f32_kernels<Op, 128>();
+        return true;
+      case 256:
+        out = fixed_f32_kernels<Op, 256>();
+        return true;
+      case 384:
+        out = fixed_f32_kernels<Op, 384>();
+        return true;
+      case 512:
+        out = fixed_f32_kernels<Op, 512>();
+        return true;
+      case 768:
+        out = fixed_f32_kernels<Op, 768>();
+        return true;
+      case 1024:
+        out = fixed_f32_kernels<Op, 1024>();
+        return true;
+      case 1536:
+        out = fixed_f32_kernels<Op, 1536>();
+        return true;
+      default:
+        return false;
+      }
+    }
+#endif
+
+    template <typename Op>
+    Kernels f32_kernels_for(size_t dim)
+    {
+#ifdef ORION_X86_DISPATCH
+      if (cpu_has_avx2())
+      {
+        using SimdOp = std::conditional_t<std::is_same_v<Op, L2Op>, L2Avx2, DotAvx2>;
+        Kernels fixed;
+        if (fixed_f32_kernels_for<SimdOp>(dim, fixed))
+          return fixed;
+        return make_kernels<float, f32_avx2<SimdOp>, f32_batch4_avx2<SimdOp>>();
+      }
+#endif
+      (void)dim;
+      return make_kernels<float, f32_scalar<Op>, f32_batch4_scalar<Op>>();
+    }
+
+    template <typename T>
+    Kernels int_kernels_for(Metric metric)
+    {
+#ifdef ORION_X86_DISPATCH
+      if (metric == Metric::InnerProduct)
+      {
+#ifdef ORION_HAVE_AVXVNNI
+        if (cpu_has_avxvnni())
+        {
+          if constexpr (std::is_same_v<T, int8_t>)
+            return make_single_kernels<T, dot_i8_vnni>();
+          else
+            return make_single_kernels<T, dot_u8_vnni>();
+        }
+#endif
+        if (cpu_has_avx2())
+          return make_single_kernels<T, dot_int_avx2<T>>();
+      }
+      else if (cpu_has_avx2())
+        return make_single_kernels<T, l2_int_avx2<T>>();
+#endif
+      if (metric == Metric::InnerProduct)
+        return make_single_kernels<T, dot_int_scalar<T>>();
+      return make_single_kernels<T, l2_int_scalar<T>>();
+    }
+
+    inline Kernels binary_kernels()
+    {
+#ifdef ORION_X86_DISPATCH
+      if (cpu_has_popcnt())
+        return make_single_kernels<uint8_t, hamming_popcnt>();
+#endif
+      return make_single_kernels<uint8_t, hamming_scalar>();
+    }
+
+    // picked at create()/load() from the element type, metric, dimension and
+    // what the CPU supports; float dims without a specialization and CPUs
+    // without AVX2 get the runtime-dimension kernels
+    inline Kernels kernels_for(ElementType type, Metric metric, size_t dim)
+    {
+      switch (type)
+      {
+      case ElementType::Int8:
+        return int_kernels_for<int8_t>(metric);
+      case ElementType::UInt8:
+        return int_kernels_for<uint8_t>(metric);
+      case ElementType::Binary:
+        return binary_kernels();
+      case ElementType::Float32:
+      default:
+        return metric == Metric::InnerProduct ? f32_kernels_for<DotOp>(dim) : f32_kernels_for<L2Op>(dim);
+      }
+    }
+  } // namespace distance
+} // namespace orion
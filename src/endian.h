@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+namespace orion
+{
+  namespace endian_helpers
+  {
+    template <typename T>
+    void write_le(std::ostream &os, const T &value)
+    {
+      if constexpr (std::endian::native == std::endian::little)
+      {
+        os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+      }
+      else
+      {
+        T le_value = value;
+        char *bytes = reinterpret_cast<char *>(&le_value);
+        std::reverse(bytes, bytes + sizeof(T));
+        os.write(bytes, sizeof(T));
+      }
+    }
+
+    template <typename T>
+    void read_le(std::istream &is, T &value)
+    {
+      is.read(reinterpret_cast<char *>(&value), sizeof(T));
+      if constexpr (std::endian::native != std::endian::little)
+      {
+        char *bytes = reinterpret_cast<char *>(&value);
+        std::reverse(bytes, bytes + sizeof(T));
+      }
+    }
+
+    // the same encoding into and out of a byte buffer (sector images)
+    template <typename T>
+    void store_le(void *dst, const T &value)
+    {
+      std::memcpy(dst, &value, sizeof(T));
+      if constexpr (std::endian::native != std::endian::little)
+      {
+        char *bytes = static_cast<char *>(dst);
+        std::reverse(bytes, bytes + sizeof(T));
+      }
+    }
+
+    template <typename T>
+    T load_le(const void *src)
+    {
+      T value;
+      std::memcpy(&value, src, sizeof(T));
+      if constexpr (std::endian::native != std::endian::little)
+      {
+        char *bytes = reinterpret_cast<char *>(&value);
+        std::reverse(bytes, bytes + sizeof(T));
+      }
+      return value;
+    }
+  } // namespace endian_helpers
+} // namespace orion
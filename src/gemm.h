@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "distance.h"
+
+namespace orion
+{
+  // Blocked query x vector inner products for batched exact search, laid out
+  // like a BLIS GEMM: database vectors are packed into panels of kPanel
+  // vectors stored component-major, so one SIMD load fetches component k of
+  // 16 vectors and a micro-kernel keeps a kRows x kPanel tile of dot
+  // products in registers while streaming k.
+  namespace gemm
+  {
+    constexpr size_t kRows = 6;
+    constexpr size_t kPanel = 16;
+
+    // packs count (<= kPanel) vectors into panel[k * kPanel + j]; missing
+    // lanes are zero
+    inline void pack_panel(const float *const *vectors, size_t count, size_t dim, float *panel)
+    {
+      if (count < kPanel)
+        std::fill(panel, panel + dim * kPanel, 0.0f);
+      for (size_t j = 0; j < count; ++j)
+      {
+        const float *v = vectors[j];
+        for (size_t k = 0; k < dim; ++k)
+          panel[k * kPanel + j] = v[k];
+      }
+    }
+
+    // out[i * kPanel + j] = queries[i] . panel vector j for the first rows queries
+    inline void micro_kernel_scalar(const float *const *queries, size_t rows, const float *panel, size_t dim, float *out)
+    {
+      float acc[kRows][kPanel] = {};
+      for (size_t k = 0; k < dim; ++k)
+      {
+        const float *p = panel + k * kPanel;
+        for (size_t i = 0; i < rows; ++i)
+        {
+          const float q = queries[i][k];
+          for (size_t j = 0; j < kPanel; ++j)
+            acc[i][j] += q * p[j];
+        }
+      }
+      for (size_t i = 0; i < rows; ++i)
+        std::memcpy(out + i * kPanel, acc[i], sizeof(acc[i]));
+    }
+
+#ifdef ORION_X86_DISPATCH
+    // 6 x 16 tile: 12 accumulators, two panel loads and one broadcast per
+    // step, which fits the 16 ymm registers without spilling
+    template <size_t Rows>
+    __attribute__((target("avx2,fma"))) void micro_kernel_avx2(const float *const *queries, const float *panel, size_t dim, float *out)
+    {
+      __m256 lo[Rows], hi[Rows];
+      for (size_t i = 0; i < Rows; ++i)
+      {
+        lo[i] = _mm256_setzero_ps();
+        hi[i] = _mm256_setzero_ps();
+      }
+      for (size_t k = 0; k < dim; ++k)
+      {
+        const __m256 p0 = _mm256_loadu_ps(panel + k * kPanel);
+        const __m256 p1 = _mm256_loadu_ps(panel + k * kPanel + 8);
+#pragma GCC unroll 6
+        for (size_t i = 0; i < Rows; ++i)
+        {
+          const __m256 q = _mm256_broadcast_ss(queries[i] + k);
+          lo[i] = _mm256_fmadd_ps(q, p0, lo[i]);
+          hi[i] = _mm256_fmadd_ps(q, p1, hi[i]);
+        }
+      }
+      for (size_t i = 0; i < Rows; ++i)
+      {
+        _mm256_storeu_ps(out + i * kPanel, lo[i]);
+        _mm256_storeu_ps(out + i * kPanel + 8, hi[i]);
+      }
+    }
+
+    inline void micro_kernel_avx2_rows(const float *const *queries, size_t rows, const float *panel, size_t dim, float *out)
+    {
+      switch (rows)
+      {
+      case 6:
+        micro_kernel_avx2<6>(queries, panel, dim, out);
+        break;
+      case 5:
+        micro_kernel_avx2<5>(queries, panel, dim, out);
+        break;
+      case 4:
+        micro_kernel_avx2<4>(queries, panel, dim, out);
+        break;
+      case 3:
+        micro_kernel_avx2<3>(queries, panel, dim, out);
+        break;
+      case 2:
+        micro_kernel_avx2<2>(queries, panel, dim, out);
+        break;
+      default:
+        micro_kernel_avx2<1>(queries, panel, dim, out);
+        break;
+      }
+    }
+#endif
+
+    using MicroKernel = void (*)(const float *const *queries, size_t rows, const float *panel, size_t dim, float *out);
+
+    inline MicroKernel micro_kernel()
+    {
+#ifdef ORION_X86_DISPATCH
+      if (distance::cpu_has_avx2())
+        return micro_kernel_avx2_rows;
+#endif
+      return micro_kernel_scalar;
+    }
+
+    // database vectors per packed block, sized so a block (~256 KiB) stays
+    // in L2 while every query streams over it
+    inline size_t block_vectors(size_t dim)
+    {
+      size_t vectors = (size_t(256) << 10) / (std::max<size_t>(dim, 1) * sizeof(float));
+      return std::max(kPanel, vectors / kPanel * kPanel);
+    }
+  } // namespace gemm
+} // namespace orion
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "orion/database.h"
+
+namespace orion
+{
+  // Input side of Database::import_npy() / import_fvecs(): the matrix file is
+  // mapped read-only and rows are handed out as pointers into the mapping,
+  // so vectors are copied once, into the database.
+  namespace import
+  {
+    class MappedFile
+    {
+    public:
+      explicit MappedFile(const std::string &path)
+      {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+          return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+          void *mapped = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+          if (mapped != MAP_FAILED)
+          {
+            data_ = static_cast<const char *>(mapped);
+            size_ = static_cast<size_t>(st.st_size);
+            // rows are read front to back, once
+            ::madvise(mapped, size_, MADV_SEQUENTIAL);
+          }
+        }
+        ::close(fd);
+      }
+      ~MappedFile()
+      {
+        if (data_)
+          ::munmap(const_cast<char *>(data_), size_);
+      }
+      MappedFile(const MappedFile &) = delete;
+      MappedFile &operator=(const MappedFile &) = delete;
+
+      const char *data() const { return data_; }
+      size_t size() const { return size_; }
+
+    private:
+      const char *data_ = nullptr;
+      size_t size_ = 0;
+    };
+
+    // rows of float32 vectors at a fixed stride inside a mapping
+    struct Matrix
+    {
+      const char *first = nullptr;
+      size_t rows = 0;
+      size_t dim = 0;
+      size_t stride = 0;
+
+      const float *row(size_t i) const { return reinterpret_cast<const float *>(first + i * stride); }
+    };
+
+    // the header dictionary of an .npy file: descr, fortran_order and shape
+    struct NpyHeader
+    {
+      std::string descr;
+      bool fortran_order = true;
+      std::vector<uint64_t> shape;
+      size_t data_offset = 0;
+    };
+
+    inline std::optional<NpyHeader> parse_npy_header(const char *data, size_t size)
+    {
+      if (size < 10 || std::memcmp(data, "\x93NUMPY", 6) != 0)
+        return std::nullopt;
+      const uint8_t major = static_cast<uint8_t>(data[6]);
+      size_t header_size = 0, offset = 0;
+      if (major == 1)
+      {
+        header_size = uint8_t(data[8]) | size_t(uint8_t(data[9])) << 8;
+        offset = 10;
+      }
+      else if ((major == 2 || major == 3) && size >= 12)
+      {
+        for (int i = 3; i >= 0; --i)
+          header_size = header_size << 8 | uint8_t(data[8 + i]);
+        offset = 12;
+      }
+      else
+        return std::nullopt;
+      if (offset + header_size > size)
+        return std::nullopt;
+      const std::string dict(data + offset, header_size);
+      NpyHeader header;
+      header.data_offset = offset + header_size;
+
+      size_t pos = dict.find("'descr':");
+      if (pos == std::string::npos || (pos = dict.find('\'', pos + 8)) == std::string::npos)
+        return std::nullopt;
+      const size_t close = dict.find('\'', pos + 1);
+      if (close == std::string::npos)
+        return std::nullopt;
+      header.descr = dict.substr(pos + 1, close - pos - 1);
+      header.fortran_order = dict.find("'fortran_order': False") == std::string::npos;
+      if ((pos = dict.find("'shape':")) == std::string::npos || (pos = dict.find('(', pos)) == std::string::npos)
+        return std::nullopt;
+      const char *p = dict.data() + pos + 1;
+      const char *end = dict.data() + dict.size();
+      while (p < end && *p != ')')
+      {
+        uint64_t value = 0;
+        auto [next, ec] = std::from_chars(p, end, value);
+        if (ec == std::errc())
+        {
+          header.shape.push_back(value);
+          p = next;
+        }
+        else
+          ++p;
+      }
+      return header;
+    }
+
+    // a C-order little-endian float32 .npy matrix of shape (rows, dim)
+    inline std::optional<Matrix> npy_matrix(const MappedFile &file, size_t dim, std::string &error)
+    {
+      const auto header = parse_npy_header(file.data(), file.size());
+      if (!header)
+      {
+        error = "not an .npy file";
+        return std::nullopt;
+      }
+      if (header->descr != "<f4" || header->fortran_order || std::endian::native != std::endian::little || header->data_offset % alignof(float) != 0)
+      {
+        error = "dtype " + header->descr + (header->fortran_order ? " (Fortran order)" : "") + " is not C-order little-endian float32";
+        return std::nullopt;
+      }
+      if (header->shape.size() != 2 || header->shape[1] != dim)
+      {
+        error = "shape is not (rows, " + std::to_string(dim) + ")";
+        return std::nullopt;
+      }
+      // divided rather than multiplied, so a huge row count cannot wrap around
+      const size_t stride = dim * sizeof(float);
+      if (header->shape[0] > (file.size() - header->data_offset) / stride)
+      {
+        error = "file is shorter than its shape";
+        return std::nullopt;
+      }
+      return Matrix{file.data() + header->data_offset, static_cast<size_t>(header->shape[0]), dim, stride};
+    }
+
+    // .fvecs: every row an int32 dimension followed by that many floats
+    inline std::optional<Matrix> fvecs_matrix(const MappedFile &file, size_t dim, std::string &error)
+    {
+      const size_t stride = sizeof(int32_t) + dim * sizeof(float);
+      if (std::endian::native != std::endian::little || file.size() % stride != 0)
+      {
+        error = "not an .fvecs file of dimension " + std::to_string(dim);
+        return std::nullopt;
+      }
+      Matrix matrix{file.data() + sizeof(int32_t), file.size() / stride, dim, stride};
+      for (size_t i = 0; i < matrix.rows; ++i)
+      {
+        int32_t row_dim;
+        std::memcpy(&row_dim, file.data() + i * stride, sizeof(row_dim));
+        if (size_t(row_dim) != dim)
+        {
+          error = "row " + std::to_string(i) + " has dimension " + std::to_string(row_dim);
+          return std::nullopt;
+        }
+      }
+      return matrix;
+    }
+
+    // one id per row: an int64/uint64 .npy vector, or text with one id per line
+    inline std::optional<std::vector<VectorId>> read_ids(const std::string &path, std::string &error)
+    {
+      std::vector<VectorId> ids;
+      MappedFile file(path);
+      if (!file.data())
+      {
+        error = "cannot read " + path;
+        return std::nullopt;
+      }
+      if (const auto header = parse_npy_header(file.data(), file.size()))
+      {
+        if ((header->descr != "<i8" && header->descr != "<u8") || header->fortran_order || header->shape.size() != 1 ||
+            header->shape[0] > (file.size() - header->data_offset) / 8 || std::endian::native != std::endian::little)
+        {
+          error = path + " is not a one-dimensional int64/uint64 .npy vector";
+          return std::nullopt;
+        }
+        ids.resize(static_cast<size_t>(header->shape[0]));
+        std::memcpy(ids.data(), file.data() + header->data_offset, ids.size() * sizeof(VectorId));
+        return ids;
+      }
+      const char *p = file.data();
+      const char *end = p + file.size();
+      while (p < end)
+      {
+        while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+          ++p;
+        if (p == end)
+          break;
+        VectorId id = 0;
+        auto [next, ec] = std::from_chars(p, end, id);
+        if (ec != std::errc())
+        {
+          error = path + ": bad id on line " + std::to_string(ids.size() + 1);
+          return std::nullopt;
+        }
+        ids.push_back(id);
+        p = next;
+      }
+      return ids;
+    }
+
+    // One flat JSON object: string, integer and floating-point values
+    // (true/false read as 1/0). An integer "id" key is returned separately.
+    inline bool parse_json_line(const std::string &line, Metadata &meta, std::optional<VectorId> &id)
+    {
+      meta.clear();
+      id.reset();
+      size_t i = 0;
+      auto skip_space = [&]
+      {
+        while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i])))
+          ++i;
+      };
+      auto parse_string = [&](std::string &out)
+      {
+        if (i >= line.size() || line[i] != '"')
+          return false;
+        for (++i; i < line.size() && line[i] != '"'; ++i)
+        {
+          if (line[i] != '\\')
+          {
+            out += line[i];
+            continue;
+          }
+          if (++i >= line.size())
+            return false;
+          switch (line[i])
+          {
+          case 'n':
+            out += '\n';
+            break;
+          case 't':
+            out += '\t';
+            break;
+          case 'r':
+            out += '\r';
+            break;
+          case 'u':
+          {
+            // code points below 0x80 only; anything else stays escaped
+            unsigned code = 0;
+            auto [p, ec] = std::from_chars(line.data() + i + 1, line.data() + std::min(line.size(), i + 5), code, 16);
+            if (ec == std::errc() && p == line.data() + i + 5 && code < 0x80)
+            {
+              out += char(code);
+              i += 4;
+            }
+            else
+              out += "\\u";
+            break;
+          }
+          default:
+            out += line[i];
+          }
+        }
+        return i++ < line.size();
+      };
+
+      skip_space();
+      if (i >= line.size() || line[i++] != '{')
+        return false;
+      skip_space();
+      if (i < line.size() && line[i] == '}')
+        return true;
+      while (i < line.size())
+      {
+        std::string key;
+        skip_space();
+        if (!parse_string(key))
+          return false;
+        skip_space();
+        if (i >= line.size() || line[i++] != ':')
+          return false;
+        skip_space();
+        if (i >= line.size())
+          return false;
+        if (line[i] == '"')
+        {
+          std::string value;
+          if (!parse_string(value))
+            return false;
+          meta[key] = std::move(value);
+        }
+        else if (line.compare(i, 4, "true") == 0 || line.compare(i, 5, "false") == 0)
+        {
+          meta[key] = int64_t(line[i] == 't');
+          i += line[i] == 't' ? 4 : 5;
+        }
+        else
+        {
+          size_t end = i;
+          while (end < line.size() && std::strchr("+-0123456789.eE", line[end]))
+            ++end;
+          int64_t integer = 0;
+          auto [p, ec] = std::from_chars(line.data() + i, line.data() + end, integer);
+          if (ec == std::errc() && p == line.data() + end)
+          {
+            if (key == "id" && integer >= 0)
+              id = VectorId(integer);
+            else
+              meta[key] = integer;
+          }
+          else
+          {
+            double real = 0;
+            auto [q, ec2] = std::from_chars(line.data() + i, line.data() + end, real);
+            if (ec2 != std::errc() || q != line.data() + end)
+              return false;
+            meta[key] = real;
+          }
+          i = end;
+        }
+        skip_space();
+        if (i < line.size() && line[i] == ',')
+        {
+          ++i;
+          continue;
+        }
+        return i < line.size() && line[i] == '}';
+      }
+      return false;
+    }
+  } // namespace import
+} // namespace orion
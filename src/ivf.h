@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "distance.h"
+#include "kmeans.h"
+
+namespace orion
+{
+  // Inverted-file index: a k-means coarse quantizer partitions the vectors
+  // into lists, each one contiguous block of rows, and a query scans only the
+  // lists whose centroids score best. Rows are the float vectors or, with
+  // SQ8, one byte per component (per-component min and step).
+  class InvertedFileIndex
+  {
+  public:
+    struct List
+    {
+      std::vector<VectorId> ids; // ids[i] owns row i
+      std::vector<uint8_t> rows;
+    };
+
+    InvertedFileIndex() = default;
+    InvertedFileIndex(size_t dim, bool sq8) : dim_(dim), sq8_(sq8) {}
+
+    bool trained() const { return !centroids_.empty(); }
+    size_t size() const { return where_.size(); }
+    bool contains(VectorId id) const { return where_.count(id) != 0; }
+    size_t row_bytes() const { return sq8_ ? dim_ : dim_ * sizeof(float); }
+    const std::vector<float> &centroids() const { return centroids_; }
+    // SQ8 only: dim minimums followed by dim steps
+    const std::vector<float> &bounds() const { return bounds_; }
+    const std::vector<List> &lists() const { return lists_; }
+
+    // installs a coarse quantizer of k x dim centroids and empties the lists
+    bool reset(std::vector<float> centroids, std::vector<float> bounds)
+    {
+      if (centroids.empty() || centroids.size() % dim_ != 0 || bounds.size() != (sq8_ ? 2 * dim_ : 0))
+        return false;
+      centroids_ = std::move(centroids);
+      bounds_ = std::move(bounds);
+      lists_.assign(centroids_.size() / dim_, List{});
+      where_.clear();
+      return true;
+    }
+
+    // k-means over the sample; the SQ8 range of each component is the
+    // sample's min..max
+    void train(const std::vector<const float *> &sample, size_t k, std::mt19937 &rng)
+    {
+      const size_t n = sample.size();
+      std::vector<float> points(n * dim_);
+      for (size_t i = 0; i < n; ++i)
+        std::copy(sample[i], sample[i] + dim_, &points[i * dim_]);
+      std::vector<float> centroids = kmeans::train(points.data(), n, dim_, std::clamp<size_t>(k, 1, n), 25, rng);
+      std::vector<float> bounds;
+      if (sq8_)
+      {
+        bounds.assign(2 * dim_, 0.0f);
+        for (size_t d = 0; d < dim_; ++d)
+        {
+          float lo = points[d], hi = points[d];
+          for (size_t i = 1; i < n; ++i)
+          {
+            lo = std::min(lo, points[i * dim_ + d]);
+            hi = std::max(hi, points[i * dim_ + d]);
+          }
+          bounds[d] = lo;
+          bounds[dim_ + d] = (hi - lo) / 255.0f;
+        }
+      }
+      reset(std::move(centroids), std::move(bounds));
+    }
+
+    size_t nearest_list(const float *x) const { return kmeans::nearest(x, centroids_, dim_); }
+
+    void add(VectorId id, const float *x) { add_to(nearest_list(x), id, x); }
+
+    void add_to(size_t list, VectorId id, const float *x)
+    {
+      remove(id);
+      List &l = lists_[list];
+      where_[id] = {list, l.ids.size()};
+      l.ids.push_back(id);
+      const size_t offset = l.rows.size();
+      l.rows.resize(offset + row_bytes());
+      encode(x, &l.rows[offset]);
+    }
+
+    // the last row of the list moves into the hole
+    bool remove(VectorId id)
+    {
+      auto it = where_.find(id);
+      if (it == where_.end())
+        return false;
+      const auto [list, row] = it->second;
+      where_.erase(it);
+      List &l = lists_[list];
+      const size_t last = l.ids.size() - 1;
+      if (row != last)
+      {
+        l.ids[row] = l.ids[last];
+        std::memcpy(&l.rows[row * row_bytes()], &l.rows[last * row_bytes()], row_bytes());
+        where_[l.ids[row]].second = row;
+      }
+      l.ids.pop_back();
+      l.rows.resize(last * row_bytes());
+      return true;
+    }
+
+    // the nprobe lists whose centroids are closest to the query under kernels
+    // (the first dim components)
+    std::vector<size_t> probe(const float *query, size_t nprobe, const distance::Kernels &kernels, size_t dim) const
+    {
+      std::vector<std::pair<float, size_t>> order(lists_.size());
+      for (size_t c = 0; c < lists_.size(); ++c)
+        order[c] = {kernels.distance(query, &centroids_[c * dim_], dim), c};
+      nprobe = std::min(nprobe, order.size());
+      std::partial_sort(order.begin(), order.begin() + nprobe, order.end());
+      std::vector<size_t> lists(nprobe);
+      for (size_t i = 0; i < nprobe; ++i)
+        lists[i] = order[i].second;
+      return lists;
+    }
+
+    // calls visit(distance, id) for each row of the list whose id is in
+    // allowed (every row when allowed is null); SQ8 rows are decoded first
+    template <typename Visit>
+    void scan(size_t list, const float *query, const distance::Kernels &kernels, size_t dim, const std::set<VectorId> *allowed, Visit &&visit) const
+    {
+      const List &l = lists_[list];
+      const size_t count = l.ids.size();
+      if (!sq8_ && !allowed)
+      {
+        const float *rows = reinterpret_cast<const float *>(l.rows.data());
+        const void *block[4];
+        float dists[4];
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+          for (size_t j = 0; j < 4; ++j)
+            block[j] = rows + (i + j) * dim_;
+          kernels.batch4(query, block, dim, dists);
+          for (size_t j = 0; j < 4; ++j)
+            visit(dists[j], l.ids[i + j]);
+        }
+        for (; i < count; ++i)
+          visit(kernels.distance(query, rows + i * dim_, dim), l.ids[i]);
+        return;
+      }
+      std::vector<float> decoded(sq8_ ? dim : 0);
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (allowed && !allowed->count(l.ids[i]))
+          continue;
+        const uint8_t *row = &l.rows[i * row_bytes()];
+        const float *x = reinterpret_cast<const float *>(row);
+        if (sq8_)
+        {
+          for (size_t d = 0; d < dim; ++d)
+            decoded[d] = bounds_[d] + float(row[d]) * bounds_[dim_ + d];
+          x = decoded.data();
+        }
+        visit(kernels.distance(query, x, dim), l.ids[i]);
+      }
+    }
+
+  private:
+    void encode(const float *x, uint8_t *row) const
+    {
+      if (!sq8_)
+      {
+        std::memcpy(row, x, dim_ * sizeof(float));
+        return;
+      }
+      for (size_t d = 0; d < dim_; ++d)
+      {
+        const float step = bounds_[dim_ + d];
+        const float level = step > 0.0f ? std::round((x[d] - bounds_[d]) / step) : 0.0f;
+        row[d] = static_cast<uint8_t>(std::clamp(level, 0.0f, 255.0f));
+      }
+    }
+
+    size_t dim_ = 0;
+    bool sq8_ = false;
+    std::vector<float> centroids_;
+    std::vector<float> bounds_;
+    std::vector<List> lists_;
+    std::unordered_map<VectorId, std::pair<size_t, size_t>> where_; // id -> (list, row)
+  };
+} // namespace orion
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+#include "distance.h"
+
+namespace orion
+{
+  // Lloyd's k-means over row-major float points, seeded with k-means++.
+  // Shared by the quantizers, the IVF lists and Database::cluster().
+  namespace kmeans
+  {
+    // squared L2 kernels (SIMD where the CPU has it) for dim-component points
+    inline distance::Kernels l2_kernels(size_t dim) { return distance::kernels_for(ElementType::Float32, Metric::L2, dim); }
+
+    inline size_t nearest(const float *point, const std::vector<float> &centroids, size_t dim, const distance::Kernels &kernels)
+    {
+      size_t best = 0;
+      float best_dist = std::numeric_limits<float>::max();
+      const size_t k = centroids.size() / dim;
+      const void *block[4];
+      float dists[4];
+      size_t c = 0;
+      for (; c + 4 <= k; c += 4)
+      {
+        for (size_t j = 0; j < 4; ++j)
+          block[j] = &centroids[(c + j) * dim];
+        kernels.batch4(point, block, dim, dists);
+        for (size_t j = 0; j < 4; ++j)
+        {
+          if (dists[j] < best_dist)
+          {
+            best_dist = dists[j];
+            best = c + j;
+          }
+        }
+      }
+      for (; c < k; ++c)
+      {
+        float d = kernels.distance(point, &centroids[c * dim], dim);
+        if (d < best_dist)
+        {
+          best_dist = d;
+          best = c;
+        }
+      }
+      return best;
+    }
+
+    inline size_t nearest(const float *point, const std::vector<float> &centroids, size_t dim) { return nearest(point, centroids, dim, l2_kernels(dim)); }
+
+    // runs body(begin, end) over [0, n) split across the hardware threads
+    template <typename Body>
+    void parallel_for(size_t n, Body &&body)
+    {
+      const size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), n / 1024 + 1));
+      std::vector<std::thread> workers;
+      for (size_t t = 1; t < threads; ++t)
+        workers.emplace_back([&, t]
+                             { body(n * t / threads, n * (t + 1) / threads); });
+      body(0, n / threads);
+      for (auto &worker : workers)
+        worker.join();
+    }
+
+    // nearest centroid of each of n row-major points
+    inline void assign(const float *points, size_t n, size_t dim, const std::vector<float> &centroids, uint32_t *out)
+    {
+      const distance::Kernels kernels = l2_kernels(dim);
+      parallel_for(n, [&](size_t begin, size_t end)
+                   {
+        for (size_t i = begin; i < end; ++i)
+          out[i] = static_cast<uint32_t>(nearest(points + i * dim, centroids, dim, kernels)); });
+    }
+
+    // k-means++: each next seed is drawn with probability proportional to its
+    // squared distance from the closest seed picked so far
+    inline std::vector<float> seed_plus_plus(const float *points, size_t n, size_t dim, size_t k, std::mt19937 &rng)
+    {
+      std::vector<float> centroids;
+      centroids.reserve(k * dim);
+      std::uniform_int_distribution<size_t> first(0, n - 1);
+      const float *seed = points + first(rng) * dim;
+      centroids.insert(centroids.end(), seed, seed + dim);
+      const distance::Kernels kernels = l2_kernels(dim);
+      std::vector<float> closest(n);
+      parallel_for(n, [&](size_t begin, size_t end)
+                   {
+        for (size_t i = begin; i < end; ++i)
+          closest[i] = kernels.distance(points + i * dim, seed, dim); });
+      while (centroids.size() < k * dim)
+      {
+        double total = 0.0;
+        for (float d : closest)
+          total += d;
+        size_t pick = 0;
+        if (total > 0.0)
+        {
+          double target = std::uniform_real_distribution<double>(0.0, total)(rng);
+          for (; pick + 1 < n; ++pick)
+          {
+            target -= closest[pick];
+            if (target <= 0.0)
+              break;
+          }
+        }
+        else
+          pick = first(rng);
+        const float *next = points + pick * dim;
+        centroids.insert(centroids.end(), next, next + dim);
+        parallel_for(n, [&](size_t begin, size_t end)
+                     {
+          for (size_t i = begin; i < end; ++i)
+            closest[i] = std::min(closest[i], kernels.distance(points + i * dim, next, dim)); });
+      }
+      return centroids;
+    }
+
+    // returns k * dim centroid coordinates; with fewer points than k the
+    // remaining centroids duplicate seeds. Empty clusters keep their centroid.
+    inline std::vector<float> train(const float *points, size_t n, size_t dim, size_t k, size_t iterations, std::mt19937 &rng, std::vector<uint32_t> *assignment = nullptr)
+    {
+      if (n == 0 || k == 0)
+        return {};
+      std::vector<float> centroids = seed_plus_plus(points, n, dim, k, rng);
+      std::vector<uint32_t> assigned(n, 0), next(n);
+      std::vector<double> sums(k * dim);
+      std::vector<size_t> counts(k);
+      for (size_t iter = 0; iter < iterations; ++iter)
+      {
+        assign(points, n, dim, centroids, next.data());
+        const bool changed = iter == 0 || next != assigned;
+        assigned.swap(next);
+        if (!changed)
+          break;
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < n; ++i)
+        {
+          ++counts[assigned[i]];
+          for (size_t d = 0; d < dim; ++d)
+            sums[assigned[i] * dim + d] += points[i * dim + d];
+        }
+        for (size_t c = 0; c < k; ++c)
+        {
+          if (counts[c] == 0)
+            continue;
+          for (size_t d = 0; d < dim; ++d)
+            centroids[c * dim + d] = static_cast<float>(sums[c * dim + d] / double(counts[c]));
+        }
+      }
+      if (assignment)
+        *assignment = std::move(assigned);
+      return centroids;
+    }
+  } // namespace kmeans
+} // namespace orion
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace orion
+{
+  // Linear dimensionality reduction for the graph. A projection is an
+  // out_dim x dim row-major matrix with orthonormal rows; it is linear, so
+  // L2 differences and inner products are projected consistently and no mean
+  // has to be stored.
+  namespace projection
+  {
+    // eight independent partial sums so the loop vectorizes without -ffast-math
+    inline float dot(const float *a, const float *b, size_t dim)
+    {
+      float acc[8] = {};
+      size_t i = 0;
+      for (; i + 8 <= dim; i += 8)
+      {
+        for (size_t j = 0; j < 8; ++j)
+          acc[j] += a[i + j] * b[i + j];
+      }
+      float sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+      for (; i < dim; ++i)
+        sum += a[i] * b[i];
+      return sum;
+    }
+
+    inline void apply(const std::vector<float> &matrix, const float *in, size_t dim, float *out)
+    {
+      const size_t out_dim = matrix.size() / dim;
+      for (size_t r = 0; r < out_dim; ++r)
+        out[r] = dot(&matrix[r * dim], in, dim);
+    }
+
+    // modified Gram-Schmidt over the rows, run twice for stability; a row
+    // that collapses is replaced by a fresh random direction
+    inline void orthonormalize(std::vector<float> &rows, size_t dim, std::mt19937 &rng)
+    {
+      const size_t count = rows.size() / dim;
+      std::normal_distribution<float> gauss;
+      for (size_t r = 0; r < count; ++r)
+      {
+        float *row = &rows[r * dim];
+        for (int attempt = 0; attempt < 4; ++attempt)
+        {
+          for (int pass = 0; pass < 2; ++pass)
+          {
+            for (size_t prev = 0; prev < r; ++prev)
+            {
+              const float *p = &rows[prev * dim];
+              float proj = dot(row, p, dim);
+              for (size_t d = 0; d < dim; ++d)
+                row[d] -= proj * p[d];
+            }
+          }
+          float norm = std::sqrt(dot(row, row, dim));
+          if (norm > 1e-6f)
+          {
+            for (size_t d = 0; d < dim; ++d)
+              row[d] /= norm;
+            break;
+          }
+          for (size_t d = 0; d < dim; ++d)
+            row[d] = gauss(rng);
+        }
+      }
+    }
+
+    inline std::vector<float> random_orthogonal(size_t dim, size_t out_dim, std::mt19937 &rng)
+    {
+      std::normal_distribution<float> gauss;
+      std::vector<float> rows(out_dim * dim);
+      for (auto &v : rows)
+        v = gauss(rng);
+      orthonormalize(rows, dim, rng);
+      return rows;
+    }
+
+    // cyclic Jacobi rotations on a symmetric n x n matrix; returns eigenvalues
+    // and leaves the eigenvectors in the columns of vectors
+    inline std::vector<double> symmetric_eigen(std::vector<double> a, size_t n, std::vector<double> &vectors)
+    {
+      vectors.assign(n * n, 0.0);
+      for (size_t i = 0; i < n; ++i)
+        vectors[i * n + i] = 1.0;
+      for (int sweep = 0; sweep < 64; ++sweep)
+      {
+        double off = 0.0;
+        for (size_t p = 0; p < n; ++p)
+        {
+          for (size_t q = p + 1; q < n; ++q)
+            off += a[p * n + q] * a[p * n + q];
+        }
+        if (off < 1e-20)
+          break;
+        for (size_t p = 0; p < n; ++p)
+        {
+          for (size_t q = p + 1; q < n; ++q)
+          {
+            if (std::fabs(a[p * n + q]) < 1e-30)
+              continue;
+            double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * a[p * n + q]);
+            double t = (theta >= 0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+            double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+            for (size_t k = 0; k < n; ++k)
+            {
+              double akp = a[k * n + p], akq = a[k * n + q];
+              a[k * n + p] = c * akp - s * akq;
+              a[k * n + q] = s * akp + c * akq;
+            }
+            for (size_t k = 0; k < n; ++k)
+            {
+              double apk = a[p * n + k], aqk = a[q * n + k];
+              a[p * n + k] = c * apk - s * aqk;
+              a[q * n + k] = s * apk + c * aqk;
+            }
+            for (size_t k = 0; k < n; ++k)
+            {
+              double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+              vectors[k * n + p] = c * vkp - s * vkq;
+              vectors[k * n + q] = s * vkp + c * vkq;
+            }
+          }
+        }
+      }
+      std::vector<double> values(n);
+      for (size_t i = 0; i < n; ++i)
+        values[i] = a[i * n + i];
+      return values;
+    }
+
+    // Top out_dim principal directions by randomized subspace iteration: a
+    // few power steps Q <- orth(C Q) on an oversampled random basis, then the
+    // exact eigen-decomposition of the small projected matrix Q^T C Q.
+    // C is the covariance (center) or the second moment, which keeps
+    // inner products (not just differences) well represented.
+    inline std::vector<float> pca(const std::vector<const float *> &points, size_t dim, size_t out_dim, bool center, std::mt19937 &rng)
+    {
+      const size_t n = points.size();
+      const size_t width = std::min(dim, out_dim + 8);
+      std::vector<float> mean(dim, 0.0f);
+      if (center && n > 0)
+      {
+        for (const float *p : points)
+        {
+          for (size_t d = 0; d < dim; ++d)
+            mean[d] += p[d];
+        }
+        for (auto &m : mean)
+          m /= float(n);
+      }
+      std::vector<float> row(dim), coeff(width);
+      // out = C * basis (row-wise), accumulating x (x . b_j) over the points
+      auto multiply = [&](const std::vector<float> &basis, std::vector<float> &out)
+      {
+        out.assign(width * dim, 0.0f);
+        for (const float *p : points)
+        {
+          for (size_t d = 0; d < dim; ++d)
+            row[d] = p[d] - mean[d];
+          for (size_t j = 0; j < width; ++j)
+            coeff[j] = dot(row.data(), &basis[j * dim], dim);
+          for (size_t j = 0; j < width; ++j)
+          {
+            float *o = &out[j * dim];
+            for (size_t d = 0; d < dim; ++d)
+              o[d] += coeff[j] * row[d];
+          }
+        }
+      };
+
+      std::vector<float> basis = random_orthogonal(dim, width, rng);
+      std::vector<float> product;
+      for (int iter = 0; iter < 4; ++iter)
+      {
+        multiply(basis, product);
+        orthonormalize(product, dim, rng);
+        basis.swap(product);
+      }
+      multiply(basis, product);
+      std::vector<double> small(width * width);
+      for (size_t i = 0; i < width; ++i)
+      {
+        for (size_t j = 0; j < width; ++j)
+          small[i * width + j] = dot(&basis[i * dim], &product[j * dim], dim);
+      }
+      for (size_t i = 0; i < width; ++i)
+      {
+        for (size_t j = i + 1; j < width; ++j)
+          small[i * width + j] = small[j * width + i] = 0.5 * (small[i * width + j] + small[j * width + i]);
+      }
+      std::vector<double> vectors;
+      std::vector<double> values = symmetric_eigen(small, width, vectors);
+      std::vector<size_t> order(width);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                { return values[a] > values[b]; });
+
+      std::vector<float> matrix(out_dim * dim, 0.0f);
+      for (size_t r = 0; r < out_dim; ++r)
+      {
+        const size_t e = order[r];
+        for (size_t j = 0; j < width; ++j)
+        {
+          const float w = float(vectors[j * width + e]);
+          for (size_t d = 0; d < dim; ++d)
+            matrix[r * dim + d] += w * basis[j * dim + d];
+        }
+      }
+      orthonormalize(matrix, dim, rng);
+      return matrix;
+    }
+  } // namespace projection
+} // namespace orion
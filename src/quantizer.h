@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+#include "kmeans.h"
+
+namespace orion
+{
+  // Score-aware product quantizer for inner-product search (ScaNN's
+  // anisotropic quantization). Vectors are split into M subspaces with 16
+  // centroids each, so a code is M 4-bit indices packed two per byte. The
+  // quantization residual r of a point x is penalized more along x than
+  // across it:
+  //   loss = |r|^2 + (eta - 1) * (r.x)^2 / |x|^2
+  // since the parallel error is what shifts the scores of the queries that
+  // actually match x. eta follows from the score threshold T (as a fraction
+  // of |x|) the accuracy matters for: eta = (d - 1) T^2 / (1 - T^2).
+  class AnisotropicQuantizer
+  {
+  public:
+    static constexpr size_t kCentroids = 16;
+
+    AnisotropicQuantizer() = default;
+    AnisotropicQuantizer(size_t dim, size_t subspaces, float threshold)
+        : dim_(dim), subspaces_(std::clamp<size_t>(subspaces, 1, std::max<size_t>(dim, 1)))
+    {
+      offsets_.resize(subspaces_ + 1);
+      for (size_t m = 0; m <= subspaces_; ++m)
+        offsets_[m] = m * dim_ / subspaces_;
+      const double t2 = double(threshold) * double(threshold);
+      // eta below 1 would favor parallel error; clamp to plain PQ instead
+      eta_ = t2 < 1.0 && dim_ > 1 ? float(std::max(1.0, double(dim_ - 1) * t2 / (1.0 - t2))) : 1.0f;
+    }
+
+    bool trained() const { return !codebook_.empty(); }
+    size_t code_bytes() const { return (subspaces_ + 1) / 2; }
+    size_t subspaces() const { return subspaces_; }
+    // dim * 16 floats: the 16 centroids of each subspace back to back, one
+    // subspace after another
+    const std::vector<float> &codebook() const { return codebook_; }
+    bool set_codebook(std::vector<float> codebook)
+    {
+      if (codebook.size() != dim_ * kCentroids)
+        return false;
+      codebook_ = std::move(codebook);
+      return true;
+    }
+
+    // seeds each subspace with isotropic k-means, then alternates anisotropic
+    // assignment with the per-centroid least-squares update for the same loss
+    void train(const std::vector<const float *> &points, size_t rounds, std::mt19937 &rng)
+    {
+      codebook_.assign(dim_ * kCentroids, 0.0f);
+      if (points.empty())
+        return;
+      const size_t n = points.size();
+      std::vector<float> sub;
+      for (size_t m = 0; m < subspaces_; ++m)
+      {
+        const size_t width = offsets_[m + 1] - offsets_[m];
+        sub.resize(n * width);
+        for (size_t i = 0; i < n; ++i)
+          std::copy(points[i] + offsets_[m], points[i] + offsets_[m + 1], &sub[i * width]);
+        std::vector<float> centroids = kmeans::train(sub.data(), n, width, kCentroids, 20, rng);
+        std::copy(centroids.begin(), centroids.end(), centroid(m, 0));
+      }
+
+      std::vector<uint8_t> codes(n * subspaces_);
+      for (size_t round = 0; round < rounds; ++round)
+      {
+        for (size_t i = 0; i < n; ++i)
+          assign(points[i], &codes[i * subspaces_]);
+        for (size_t m = 0; m < subspaces_; ++m)
+          update_subspace(points, codes, m);
+      }
+    }
+
+    void encode(const float *x, uint8_t *code) const
+    {
+      std::vector<uint8_t> indices(subspaces_);
+      assign(x, indices.data());
+      std::fill(code, code + code_bytes(), 0);
+      for (size_t m = 0; m < subspaces_; ++m)
+        code[m / 2] |= static_cast<uint8_t>(indices[m] << (4 * (m % 2)));
+    }
+
+    // table[p * 256 + byte] is the query's inner product with the two
+    // centroids a code byte selects in subspaces 2p and 2p + 1, so scoring a
+    // code is one lookup per byte
+    void build_table(const float *query, std::vector<float> &table) const
+    {
+      std::vector<float> lut(subspaces_ * kCentroids);
+      for (size_t m = 0; m < subspaces_; ++m)
+      {
+        const size_t width = offsets_[m + 1] - offsets_[m];
+        for (size_t c = 0; c < kCentroids; ++c)
+        {
+          const float *cen = centroid(m, c);
+          float dot = 0.0f;
+          for (size_t d = 0; d < width; ++d)
+            dot += query[offsets_[m] + d] * cen[d];
+          lut[m * kCentroids + c] = dot;
+        }
+      }
+      table.assign(code_bytes() * 256, 0.0f);
+      for (size_t p = 0; p < code_bytes(); ++p)
+      {
+        for (size_t byte = 0; byte < 256; ++byte)
+        {
+          float score = lut[2 * p * kCentroids + (byte & 15)];
+          if (2 * p + 1 < subspaces_)
+            score += lut[(2 * p + 1) * kCentroids + (byte >> 4)];
+          table[p * 256 + byte] = score;
+        }
+      }
+    }
+
+    // approximate 1 - q.x, the inner-product distance
+    float distance(const std::vector<float> &table, const uint8_t *code) const
+    {
+      const size_t bytes = code_bytes();
+      float s0 = 0.0f, s1 = 0.0f;
+      size_t p = 0;
+      for (; p + 2 <= bytes; p += 2)
+      {
+        s0 += table[p * 256 + code[p]];
+        s1 += table[(p + 1) * 256 + code[p + 1]];
+      }
+      if (p < bytes)
+        s0 += table[p * 256 + code[p]];
+      return 1.0f - (s0 + s1);
+    }
+
+  private:
+    float *centroid(size_t m, size_t c) { return &codebook_[offsets_[m] * kCentroids + c * (offsets_[m + 1] - offsets_[m])]; }
+    const float *centroid(size_t m, size_t c) const { return &codebook_[offsets_[m] * kCentroids + c * (offsets_[m + 1] - offsets_[m])]; }
+
+    float loss(double residual_sq, double residual_dot, double norm_sq) const
+    {
+      if (norm_sq <= 0.0)
+        return float(residual_sq);
+      return float(residual_sq + (double(eta_) - 1.0) * residual_dot * residual_dot / norm_sq);
+    }
+
+    // nearest centroids first, then coordinate descent on the anisotropic
+    // loss; |r|^2 and r.x are sums over subspaces, so each trial is O(width)
+    void assign(const float *x, uint8_t *indices) const
+    {
+      double norm_sq = 0.0;
+      for (size_t d = 0; d < dim_; ++d)
+        norm_sq += double(x[d]) * x[d];
+      std::vector<double> part_sq(subspaces_), part_dot(subspaces_);
+      auto residual = [&](size_t m, size_t c, double &sq, double &dot)
+      {
+        const float *cen = centroid(m, c);
+        sq = 0.0;
+        dot = 0.0;
+        for (size_t d = offsets_[m]; d < offsets_[m + 1]; ++d)
+        {
+          double r = double(x[d]) - cen[d - offsets_[m]];
+          sq += r * r;
+          dot += r * x[d];
+        }
+      };
+      double total_sq = 0.0, total_dot = 0.0;
+      for (size_t m = 0; m < subspaces_; ++m)
+      {
+        double best = std::numeric_limits<double>::max();
+        for (size_t c = 0; c < kCentroids; ++c)
+        {
+          double sq, dot;
+          residual(m, c, sq, dot);
+          if (sq < best)
+          {
+            best = sq;
+            indices[m] = static_cast<uint8_t>(c);
+            part_sq[m] = sq;
+            part_dot[m] = dot;
+          }
+        }
+        total_sq += part_sq[m];
+        total_dot += part_dot[m];
+      }
+      if (eta_ == 1.0f)
+        return;
+      for (int pass = 0; pass < 2; ++pass)
+      {
+        bool changed = false;
+        for (size_t m = 0; m < subspaces_; ++m)
+        {
+          const double other_sq = total_sq - part_sq[m];
+          const double other_dot = total_dot - part_dot[m];
+          float best = loss(total_sq, total_dot, norm_sq);
+          for (size_t c = 0; c < kCentroids; ++c)
+          {
+            double sq, dot;
+            residual(m, c, sq, dot);
+            float l = loss(other_sq + sq, other_dot + dot, norm_sq);
+            if (l < best)
+            {
+              best = l;
+              changed |= indices[m] != c;
+              indices[m] = static_cast<uint8_t>(c);
+              part_sq[m] = sq;
+              part_dot[m] = dot;
+            }
+          }
+          total_sq = other_sq + part_sq[m];
+          total_dot = other_dot + part_dot[m];
+        }
+        if (!changed)
+          break;
+      }
+    }
+
+    // With the other subspaces fixed, the loss of the points assigned to a
+    // centroid c is quadratic in c: setting its gradient to zero gives
+    //   sum_i (I + w_i x_i x_i^T) c = sum_i (x_i + w_i s_i x_i)
+    // with x_i the point's slice, w_i = (eta - 1) / |x|^2 and s_i the residual
+    // dot of the other subspaces plus x_i.x_i
+    void update_subspace(const std::vector<const float *> &points, const std::vector<uint8_t> &codes, size_t m)
+    {
+      const size_t width = offsets_[m + 1] - offsets_[m];
+      std::vector<double> a(kCentroids * width * width, 0.0), b(kCentroids * width, 0.0);
+      std::vector<size_t> counts(kCentroids, 0);
+      for (size_t i = 0; i < points.size(); ++i)
+      {
+        const float *x = points[i];
+        double norm_sq = 0.0, other_dot = 0.0;
+        for (size_t d = 0; d < dim_; ++d)
+          norm_sq += double(x[d]) * x[d];
+        for (size_t o = 0; o < subspaces_; ++o)
+        {
+          if (o == m)
+            continue;
+          const float *cen = centroid(o, codes[i * subspaces_ + o]);
+          for (size_t d = offsets_[o]; d < offsets_[o + 1]; ++d)
+            other_dot += (double(x[d]) - cen[d - offsets_[o]]) * x[d];
+        }
+        const float *slice = x + offsets_[m];
+        double self_dot = 0.0;
+        for (size_t d = 0; d < width; ++d)
+          self_dot += double(slice[d]) * slice[d];
+        const double w = norm_sq > 0.0 ? (double(eta_) - 1.0) / norm_sq : 0.0;
+        const double s = other_dot + self_dot;
+        const size_t c = codes[i * subspaces_ + m];
+        ++counts[c];
+        double *ac = &a[c * width * width];
+        double *bc = &b[c * width];
+        for (size_t r = 0; r < width; ++r)
+        {
+          ac[r * width + r] += 1.0;
+          bc[r] += slice[r] + w * s * slice[r];
+          for (size_t col = 0; col < width; ++col)
+            ac[r * width + col] += w * slice[r] * slice[col];
+        }
+      }
+      for (size_t c = 0; c < kCentroids; ++c)
+      {
+        if (counts[c] == 0)
+          continue;
+        std::vector<double> solution(width);
+        if (solve(&a[c * width * width], &b[c * width], width, solution))
+          std::transform(solution.begin(), solution.end(), centroid(m, c), [](double v)
+                         { return float(v); });
+      }
+    }
+
+    // Gaussian elimination with partial pivoting; a and b are overwritten
+    static bool solve(double *a, double *b, size_t n, std::vector<double> &x)
+    {
+      for (size_t col = 0; col < n; ++col)
+      {
+        size_t pivot = col;
+        for (size_t r = col + 1; r < n; ++r)
+        {
+          if (std::fabs(a[r * n + col]) > std::fabs(a[pivot * n + col]))
+            pivot = r;
+        }
+        if (std::fabs(a[pivot * n + col]) < 1e-12)
+          return false;
+        if (pivot != col)
+        {
+          for (size_t k = 0; k < n; ++k)
+            std::swap(a[col * n + k], a[pivot * n + k]);
+          std::swap(b[col], b[pivot]);
+        }
+        for (size_t r = col + 1; r < n; ++r)
+        {
+          double f = a[r * n + col] / a[col * n + col];
+          for (size_t k = col; k < n; ++k)
+            a[r * n + k] -= f * a[col * n + k];
+          b[r] -= f * b[col];
+        }
+      }
+      for (size_t r = n; r-- > 0;)
+      {
+        double sum = b[r];
+        for (size_t k = r + 1; k < n; ++k)
+          sum -= a[r * n + k] * x[k];
+        x[r] = sum / a[r * n + r];
+      }
+      return true;
+    }
+
+    size_t dim_ = 0;
+    size_t subspaces_ = 0;
+    float eta_ = 1.0f;
+    std::vector<size_t> offsets_;
+    std::vector<float> codebook_;
+  };
+} // namespace orion
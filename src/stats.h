@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <vector>
+#include "orion/database.h"
+
+namespace orion
+{
+  // Graph and posting-list figures behind Database::stats() and
+  // Database::inspect(). The graph side is written against a small accessor
+  // interface so the same code runs over the live hnswlib index and over a
+  // graph section parsed straight from a file:
+  //   size_t size(); uint32_t entry(); int level(i); bool deleted(i);
+  //   std::span<const uint32_t> links(i, level)
+  namespace stats
+  {
+    // node-parallel pass for levels, degrees and tombstones; a breadth-first
+    // walk over every level's links from the entry point for reachability
+    // (tombstones are walked through, as searches do)
+    template <typename Graph>
+    void graph_stats(const Graph &graph, IndexStats &out)
+    {
+      const size_t n = graph.size();
+      out.graph_nodes = n;
+      if (n == 0)
+        return;
+      struct Partial
+      {
+        uint64_t tombstones = 0;
+        std::vector<uint64_t> levels;
+        std::vector<std::vector<uint64_t>> degrees;
+      };
+      const size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), n / 4096 + 1));
+      std::vector<Partial> partials(threads);
+      auto work = [&](size_t t)
+      {
+        Partial &p = partials[t];
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i)
+        {
+          p.tombstones += graph.deleted(i);
+          const int top = graph.level(i);
+          if (p.levels.size() <= size_t(top))
+          {
+            p.levels.resize(top + 1, 0);
+            p.degrees.resize(top + 1);
+          }
+          ++p.levels[top];
+          for (int l = 0; l <= top; ++l)
+          {
+            const size_t degree = graph.links(i, l).size();
+            if (p.degrees[l].size() <= degree)
+              p.degrees[l].resize(degree + 1, 0);
+            ++p.degrees[l][degree];
+          }
+        }
+      };
+      std::vector<std::thread> workers;
+      for (size_t t = 1; t < threads; ++t)
+        workers.emplace_back(work, t);
+      work(0);
+      for (auto &worker : workers)
+        worker.join();
+
+      for (const Partial &p : partials)
+      {
+        out.tombstones += p.tombstones;
+        if (out.level_counts.size() < p.levels.size())
+        {
+          out.level_counts.resize(p.levels.size(), 0);
+          out.degree_histograms.resize(p.levels.size());
+        }
+        for (size_t l = 0; l < p.levels.size(); ++l)
+        {
+          out.level_counts[l] += p.levels[l];
+          auto &histogram = out.degree_histograms[l];
+          if (histogram.size() < p.degrees[l].size())
+            histogram.resize(p.degrees[l].size(), 0);
+          for (size_t d = 0; d < p.degrees[l].size(); ++d)
+            histogram[d] += p.degrees[l][d];
+        }
+      }
+      out.tombstone_fraction = double(out.tombstones) / double(n);
+
+      const uint32_t entry = graph.entry();
+      out.entry_point_level = graph.level(entry);
+      std::vector<bool> seen(n, false);
+      std::vector<uint32_t> queue{entry};
+      seen[entry] = true;
+      for (size_t head = 0; head < queue.size(); ++head)
+      {
+        const uint32_t node = queue[head];
+        for (int l = 0; l <= graph.level(node); ++l)
+        {
+          for (uint32_t next : graph.links(node, l))
+          {
+            if (next < n && !seen[next])
+            {
+              seen[next] = true;
+              queue.push_back(next);
+            }
+          }
+        }
+      }
+      for (size_t i = 0; i < n; ++i)
+        out.unreachable += !seen[i] && !graph.deleted(i);
+    }
+
+    // posting lists of one metadata key, given the size of each value's list
+    inline PostingStats posting_stats(const std::vector<uint64_t> &sizes)
+    {
+      PostingStats out;
+      out.values = sizes.size();
+      if (!sizes.empty())
+        out.smallest = *std::min_element(sizes.begin(), sizes.end());
+      for (uint64_t size : sizes)
+      {
+        out.total += size;
+        out.largest = std::max(out.largest, size);
+        const size_t bucket = size == 0 ? 0 : std::bit_width(size) - 1;
+        if (out.size_histogram.size() <= bucket)
+          out.size_histogram.resize(bucket + 1, 0);
+        ++out.size_histogram[bucket];
+      }
+      return out;
+    }
+  } // namespace stats
+} // namespace orion
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "distance.h"
+
+namespace orion
+{
+  // Vamana graph construction (DiskANN): start from a random R-regular graph,
+  // then for every node in random order run a greedy search for it from the
+  // medoid and replace its edges with a robust prune of everything the search
+  // visited, adding back-edges as it goes. The first pass prunes with
+  // alpha = 1, the second with the configured alpha, which keeps some long
+  // edges and so bounds the number of hops. The geometry is L2 whatever the
+  // search metric.
+  namespace vamana
+  {
+    struct Graph
+    {
+      std::vector<std::vector<uint32_t>> neighbors;
+      uint32_t medoid = 0;
+    };
+
+    class Builder
+    {
+    public:
+      Builder(const std::vector<const float *> &vectors, size_t dim, size_t max_degree, size_t list_size)
+          : vectors_(vectors), dim_(dim), max_degree_(std::max<size_t>(max_degree, 1)),
+            list_size_(std::max(list_size, max_degree_)), kernels_(distance::kernels_for(ElementType::Float32, Metric::L2, dim)),
+            marks_(vectors.size(), 0) {}
+
+      Graph build(float alpha, std::mt19937 &rng)
+      {
+        const size_t n = vectors_.size();
+        Graph graph;
+        graph.neighbors.resize(n);
+        if (n == 0)
+          return graph;
+        graph.medoid = medoid();
+        const size_t degree = std::min(max_degree_, n - 1);
+        std::uniform_int_distribution<uint32_t> pick(0, static_cast<uint32_t>(n - 1));
+        for (uint32_t i = 0; i < n; ++i)
+        {
+          auto &out = graph.neighbors[i];
+          while (out.size() < degree)
+          {
+            uint32_t j = pick(rng);
+            if (j != i && std::find(out.begin(), out.end(), j) == out.end())
+              out.push_back(j);
+          }
+        }
+        std::vector<uint32_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), rng);
+        for (float pass_alpha : {1.0f, std::max(alpha, 1.0f)})
+        {
+          for (uint32_t i : order)
+          {
+            std::vector<Candidate> visited = search(graph, vectors_[i]);
+            for (uint32_t j : graph.neighbors[i])
+              visited.push_back({distance(i, j), j});
+            graph.neighbors[i] = prune(i, std::move(visited), pass_alpha);
+            for (uint32_t j : graph.neighbors[i])
+            {
+              auto &back = graph.neighbors[j];
+              if (std::find(back.begin(), back.end(), i) != back.end())
+                continue;
+              if (back.size() < max_degree_)
+              {
+                back.push_back(i);
+                continue;
+              }
+              std::vector<Candidate> candidates;
+              candidates.reserve(back.size() + 1);
+              for (uint32_t k : back)
+                candidates.push_back({distance(j, k), k});
+              candidates.push_back({distance(j, i), i});
+              back = prune(j, std::move(candidates), pass_alpha);
+            }
+          }
+        }
+        return graph;
+      }
+
+    private:
+      struct Candidate
+      {
+        float distance;
+        uint32_t node;
+        bool operator<(const Candidate &other) const { return distance < other.distance || (distance == other.distance && node < other.node); }
+      };
+
+      float distance(uint32_t a, uint32_t b) const { return kernels_.distance(vectors_[a], vectors_[b], dim_); }
+
+      // the node closest to the mean
+      uint32_t medoid() const
+      {
+        std::vector<double> sum(dim_, 0.0);
+        for (const float *v : vectors_)
+        {
+          for (size_t d = 0; d < dim_; ++d)
+            sum[d] += v[d];
+        }
+        std::vector<float> mean(dim_);
+        for (size_t d = 0; d < dim_; ++d)
+          mean[d] = float(sum[d] / double(vectors_.size()));
+        uint32_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (uint32_t i = 0; i < vectors_.size(); ++i)
+        {
+          float d = kernels_.distance(mean.data(), vectors_[i], dim_);
+          if (d < best_dist)
+          {
+            best_dist = d;
+            best = i;
+          }
+        }
+        return best;
+      }
+
+      // greedy search with a list of list_size candidates; returns every
+      // expanded node
+      std::vector<Candidate> search(const Graph &graph, const float *target)
+      {
+        if (++epoch_ == 0)
+        {
+          std::fill(marks_.begin(), marks_.end(), 0);
+          epoch_ = 1;
+        }
+        std::vector<Candidate> list;
+        std::vector<bool> expanded;
+        std::vector<Candidate> visited;
+        auto offer = [&](uint32_t node)
+        {
+          if (marks_[node] == epoch_)
+            return;
+          marks_[node] = epoch_;
+          Candidate c{kernels_.distance(target, vectors_[node], dim_), node};
+          if (list.size() >= list_size_ && !(c < list.back()))
+            return;
+          auto pos = std::lower_bound(list.begin(), list.end(), c);
+          expanded.insert(expanded.begin() + (pos - list.begin()), false);
+          list.insert(pos, c);
+          if (list.size() > list_size_)
+          {
+            list.pop_back();
+            expanded.pop_back();
+          }
+        };
+        offer(graph.medoid);
+        for (size_t i = 0; i < list.size();)
+        {
+          if (expanded[i])
+          {
+            ++i;
+            continue;
+          }
+          expanded[i] = true;
+          const Candidate current = list[i];
+          visited.push_back(current);
+          for (uint32_t next : graph.neighbors[current.node])
+            offer(next);
+          // insertions may land before i; restart from the first unexpanded
+          i = 0;
+        }
+        return visited;
+      }
+
+      // robust prune: walk the candidates nearest first and keep one unless an
+      // already kept neighbor is alpha times closer to it than p is
+      std::vector<uint32_t> prune(uint32_t p, std::vector<Candidate> candidates, float alpha) const
+      {
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+                  { return a.node < b.node || (a.node == b.node && a.distance < b.distance); });
+        candidates.erase(std::unique(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+                                     { return a.node == b.node; }),
+                         candidates.end());
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [p](const Candidate &c)
+                                        { return c.node == p; }),
+                         candidates.end());
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<uint32_t> kept;
+        std::vector<bool> dropped(candidates.size(), false);
+        for (size_t i = 0; i < candidates.size() && kept.size() < max_degree_; ++i)
+        {
+          if (dropped[i])
+            continue;
+          kept.push_back(candidates[i].node);
+          for (size_t j = i + 1; j < candidates.size(); ++j)
+          {
+            if (!dropped[j] && alpha * distance(candidates[i].node, candidates[j].node) <= candidates[j].distance)
+              dropped[j] = true;
+          }
+        }
+        return kept;
+      }
+
+      const std::vector<const float *> &vectors_;
+      size_t dim_;
+      size_t max_degree_;
+      size_t list_size_;
+      distance::Kernels kernels_;
+      std::vector<uint32_t> marks_;
+      uint32_t epoch_ = 0;
+    };
+
+    // writes the DiskIndex file for ids[i] -> vectors[i] (disk_index.cpp)
+    bool write_disk_index(const std::string &path, const std::vector<VectorId> &ids, const std::vector<const float *> &vectors, size_t dim, Metric metric, const DiskIndexConfig &config);
+  } // namespace vamana
+} // namespace orion
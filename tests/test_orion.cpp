@@ -1,4 +1,7 @@
 #include "orion/database.h"
+#include "orion/metric.h"
+#include "orion/disk_index.h"
+#include "hnswlib/hnswlib.h"
 #include <gtest/gtest.h>
 #include <filesystem>
 #include <random>
@@ -6,6 +9,13 @@
 #include <vector>
 #include <chrono>
 #include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <cmath>
+#include <cstring>
+#include <optional>
 
 using namespace orion;
 namespace fs = std::filesystem;
@@ -123,7 +133,1613 @@ TEST(Concurrency, ParallelAddAndQuery)
     fs::remove(tmp, ec);
 }
 
+TEST(FilteredQuery, PartitionEntryPoints)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db3.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 8;
+    Config cfg(dim, 1024);
+    cfg.entry_point_keys = {"tenant"};
+    cfg.exact_scan_threshold = 0; // walk the graph from the partition entry points
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(77);
+    const int total = 400;
+    for (int i = 0; i < total; ++i) {
+        Metadata meta;
+        meta["tenant"] = int64_t(i % 4);
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), random_vector(dim, rng), meta));
+    }
+
+    // drop a chunk of tenant 2, including whatever node was its entry point
+    for (int i = 2; i < 200; i += 4) ASSERT_TRUE(db.remove(static_cast<VectorId>(i)));
+
+    auto check = [&](const Database &d) {
+        Vector q = random_vector(dim, rng);
+        for (int64_t tenant = 0; tenant < 4; ++tenant) {
+            auto res = d.query(q, 10, {{"tenant", tenant}});
+            ASSERT_EQ(res.size(), 10u);
+            for (const auto &r : res) {
+                auto got = d.get(r.id);
+                ASSERT_TRUE(got.has_value());
+                ASSERT_EQ(std::get<int64_t>(got->second.at("tenant")), tenant);
+            }
+        }
+    };
+    check(db);
+
+    ASSERT_TRUE(db.save());
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    check(*loaded);
+
+    fs::remove(tmp, ec);
+}
+
+TEST(FilteredQuery, FullPagesForSmallPartitions)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db4.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 8;
+    Config cfg(dim, 512);
+    cfg.exact_scan_threshold = 0; // filtered queries go through the graph first
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(91);
+    for (int i = 0; i < 300; ++i) {
+        Metadata meta;
+        meta["rare"] = int64_t(i % 50 == 0);
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), random_vector(dim, rng), meta));
+    }
+
+    Vector q = random_vector(dim, rng);
+    auto rare = db.query(q, 10, {{"rare", int64_t(1)}});
+    ASSERT_EQ(rare.size(), 6u);
+    for (size_t i = 1; i < rare.size(); ++i) {
+        ASSERT_LE(rare[i - 1].distance, rare[i].distance);
+        ASSERT_EQ(rare[i].path, rare[0].path);
+    }
+
+    auto common = db.query(q, 25, {{"rare", int64_t(0)}});
+    ASSERT_EQ(common.size(), 25u);
+
+    // 1 in 200 of 4000 vectors match: the first pass (ef 10, at most 320
+    // nodes scored) comes back short, a wider one fills the page, and with
+    // no room to widen the candidates are scanned
+    QueryOptions graph;
+    graph.strategy = SearchStrategy::Graph;
+    std::vector<Vector> data;
+    for (int i = 0; i < 4000; ++i) data.push_back(random_vector(dim, rng));
+    auto build = [&](const fs::path &path, uint64_t max_ef) {
+        Config selective(dim, 4096);
+        selective.filter_max_ef = max_ef;
+        auto made = Database::create(path.string(), selective);
+        EXPECT_TRUE(made.has_value());
+        for (int i = 0; i < 4000; ++i) EXPECT_TRUE(made->add(static_cast<VectorId>(i), data[i], {{"needle", int64_t(i % 200 == 7)}}));
+        return std::move(made.value());
+    };
+    fs::path tmp_retry = fs::temp_directory_path() / "orion_test_db4b.bin";
+    fs::path tmp_scan = fs::temp_directory_path() / "orion_test_db4c.bin";
+    Database retry = build(tmp_retry, 1024);
+    Database scan = build(tmp_scan, 10);
+    auto widened = retry.query(q, 10, {{"needle", int64_t(1)}}, graph);
+    ASSERT_EQ(widened.size(), 10u);
+    for (const auto &r : widened) {
+        EXPECT_EQ(r.id % 200, 7u);
+        EXPECT_EQ(r.path, SearchPath::GraphRetry);
+    }
+    auto scanned = scan.query(q, 10, {{"needle", int64_t(1)}}, graph);
+    ASSERT_EQ(scanned.size(), 10u);
+    for (size_t i = 0; i < scanned.size(); ++i) {
+        EXPECT_EQ(scanned[i].path, SearchPath::ExactScan);
+        EXPECT_EQ(scanned[i].id, widened[i].id);
+    }
+
+    fs::remove(tmp, ec);
+    fs::remove(tmp_retry, ec);
+    fs::remove(tmp_scan, ec);
+}
+
+TEST(ExactScan, MatchesBruteForce)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db5.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 13; // exercises the SIMD tail handling
+    Config cfg(dim, 1024);
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(5);
+    std::vector<Vector> data;
+    for (int i = 0; i < 500; ++i) {
+        data.push_back(random_vector(dim, rng));
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), data.back(), {{"bucket", int64_t(i % 7)}}));
+    }
+    ASSERT_TRUE(db.remove(3));
+
+    Vector q = random_vector(dim, rng);
+    auto brute = [&](int64_t bucket) {
+        std::vector<std::pair<float, VectorId>> all;
+        for (int i = 0; i < 500; ++i) {
+            if (i == 3 || (bucket >= 0 && i % 7 != bucket)) continue;
+            float d = 0;
+            for (uint32_t k = 0; k < dim; ++k) d += (q[k] - data[i][k]) * (q[k] - data[i][k]);
+            all.emplace_back(d, static_cast<VectorId>(i));
+        }
+        std::sort(all.begin(), all.end());
+        all.resize(10);
+        return all;
+    };
+
+    QueryOptions exact;
+    exact.strategy = SearchStrategy::Exact;
+    auto everything = db.query(q, 10, {}, exact);
+    auto expected = brute(-1);
+    ASSERT_EQ(everything.size(), 10u);
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_EQ(everything[i].id, expected[i].second);
+        ASSERT_NEAR(everything[i].distance, expected[i].first, 1e-4);
+        ASSERT_EQ(everything[i].path, SearchPath::ExactScan);
+    }
+
+    // 71 candidates is under the default threshold, so Auto scans exactly
+    auto bucket = db.query(q, 10, {{"bucket", int64_t(3)}});
+    expected = brute(3);
+    ASSERT_EQ(bucket.size(), 10u);
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_EQ(bucket[i].id, expected[i].second);
+        ASSERT_EQ(bucket[i].path, SearchPath::ExactScan);
+    }
+
+    QueryOptions graph;
+    graph.strategy = SearchStrategy::Graph;
+    auto walked = db.query(q, 10, {{"bucket", int64_t(3)}}, graph);
+    ASSERT_EQ(walked.size(), 10u);
+    ASSERT_NE(walked[0].path, SearchPath::ExactScan);
+
+    fs::remove(tmp, ec);
+}
+
+TEST(GraphSearch, MatchesHnswlibSearchKnn)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db5b.bin";
+    fs::path graph_path = fs::temp_directory_path() / "orion_test_db5b.hnsw";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 24;
+    Config cfg(dim, 4096);
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+    std::mt19937 rng(79);
+    for (int i = 0; i < 3000; ++i)
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), random_vector(dim, rng), {}));
+    ASSERT_TRUE(db.save());
+
+    // the saved file ends with the hnswlib blob, its uint64 size in front of
+    // it, and the 4-byte checksum
+    std::ifstream in(tmp, std::ios::binary);
+    const std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t blob = 0;
+    for (size_t offset = 0; offset + 12 <= file.size(); ++offset) {
+        uint64_t size = 0;
+        std::memcpy(&size, file.data() + offset, sizeof(size));
+        if (size > 0 && size == file.size() - 4 - offset - 8) {
+            blob = offset + 8;
+            break;
+        }
+    }
+    ASSERT_GT(blob, 0u);
+    {
+        std::ofstream out(graph_path, std::ios::binary);
+        out.write(file.data() + blob, std::streamsize(file.size() - 4 - blob));
+    }
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> index(&space, graph_path.string());
+    ASSERT_EQ(index.cur_element_count, 3000u);
+
+    // same graph, same ef: Orion's prefetching walk finds what searchKnn finds
+    size_t same = 0, total = 0;
+    for (uint32_t ef : {16u, 64u}) {
+        index.setEf(ef);
+        QueryOptions graph;
+        graph.strategy = SearchStrategy::Graph;
+        graph.ef = ef;
+        for (int q = 0; q < 50; ++q) {
+            Vector query = random_vector(dim, rng);
+            auto reference = index.searchKnn(query.data(), 10);
+            std::vector<std::pair<float, VectorId>> expected;
+            for (; !reference.empty(); reference.pop())
+                expected.emplace_back(reference.top().first, VectorId(reference.top().second));
+            std::reverse(expected.begin(), expected.end());
+            auto walked = db.query(query, 10, {}, graph);
+            ASSERT_EQ(walked.size(), expected.size());
+            for (size_t i = 0; i < walked.size(); ++i) {
+                EXPECT_EQ(walked[i].path, SearchPath::Graph);
+                EXPECT_NEAR(walked[i].distance, expected[i].first, 1e-4f * expected[i].first + 1e-5f);
+                same += walked[i].id == expected[i].second;
+                ++total;
+            }
+        }
+    }
+    // distance ties may order differently; everything else is identical
+    EXPECT_GE(double(same) / double(total), 0.99);
+
+    fs::remove(tmp, ec);
+    fs::remove(graph_path, ec);
+}
+
+TEST(Layout, OptimizeLayoutPreservesResults)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db6.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 16;
+    Config cfg(dim, 1024);
+    cfg.entry_point_keys = {"group"};
+    cfg.optimize_layout_on_save = true;
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(8);
+    for (int i = 0; i < 600; ++i)
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), random_vector(dim, rng), {{"group", int64_t(i % 3)}}));
+    for (int i = 0; i < 600; i += 17) ASSERT_TRUE(db.remove(static_cast<VectorId>(i)));
+
+    std::vector<Vector> queries;
+    for (int i = 0; i < 20; ++i) queries.push_back(random_vector(dim, rng));
+    std::vector<std::vector<QueryResult>> before;
+    for (const auto &q : queries) before.push_back(db.query(q, 10));
+
+    ASSERT_TRUE(db.optimize_layout());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        auto after = db.query(queries[i], 10);
+        ASSERT_EQ(after.size(), before[i].size());
+        for (size_t j = 0; j < after.size(); ++j) ASSERT_EQ(after[j].id, before[i][j].id);
+    }
+    auto got = db.get(42);
+    ASSERT_TRUE(got.has_value());
+    ASSERT_TRUE(db.add(1000, random_vector(dim, rng), {{"group", int64_t(1)}}));
+    ASSERT_EQ(db.query(queries[0], 10, {{"group", int64_t(1)}}).size(), 10u);
+
+    ASSERT_TRUE(db.save());
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        auto res = loaded->query(queries[i], 10);
+        ASSERT_EQ(res.size(), 10u);
+        for (const auto &r : res) ASSERT_NE(r.id % 17, 0u);
+    }
+
+    fs::remove(tmp, ec);
+}
+
+TEST(Memory, HugePagesAndLockedMemory)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db7.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 8;
+    Config cfg(dim, 64); // small capacity so the rebuild path re-applies the policy
+    cfg.huge_pages = true;
+    cfg.lock_memory = true;
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(81);
+    for (int i = 0; i < 200; ++i)
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), random_vector(dim, rng), {}));
+    ASSERT_EQ(db.query(random_vector(dim, rng), 5).size(), 5u);
+
+    ASSERT_TRUE(db.save());
+    // the memory policy is chosen per load, not read from the file
+    LoadOptions options;
+    options.huge_pages = true;
+    options.lock_memory = true;
+    for (const LoadOptions &load_options : {LoadOptions(), options}) {
+        auto loaded = Database::load(tmp.string(), load_options);
+        ASSERT_TRUE(loaded.has_value());
+        ASSERT_EQ(loaded->count(), 200u);
+        ASSERT_EQ(loaded->query(random_vector(dim, rng), 5).size(), 5u);
+        // rebuilding past capacity releases the old graph's pinned memory
+        for (int i = 200; i < 400; ++i)
+            ASSERT_TRUE(loaded->add(static_cast<VectorId>(i), random_vector(dim, rng), {}));
+    }
+
+    fs::remove(tmp, ec);
+}
+
+TEST(Memory, WarmupTouchesHotRegions)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db8.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 8;
+    Config cfg(dim, 512);
+    cfg.entry_point_keys = {"shard"};
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(82);
+    for (int i = 0; i < 300; ++i)
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), random_vector(dim, rng), {{"shard", int64_t(i % 5)}}));
+    ASSERT_TRUE(db.save());
+
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    ASSERT_EQ(loaded->warmup(0), 0u);
+    size_t partial = loaded->warmup(100);
+    ASSERT_GT(partial, 0u);
+    ASSERT_LE(partial, 100u);
+    std::vector<Vector> sample = {random_vector(dim, rng), random_vector(dim, rng)};
+    ASSERT_EQ(loaded->warmup(1000000, sample), 300u);
+    ASSERT_EQ(loaded->query(sample[0], 5).size(), 5u);
+
+    fs::remove(tmp, ec);
+}
+
+TEST(ExactScan, SpecializedDimensionsMatchBruteForce)
+{
+    for (uint32_t dim : {128u, 384u, 136u}) {
+        fs::path tmp = fs::temp_directory_path() / "orion_test_db9.bin";
+        std::error_code ec;
+        fs::remove(tmp, ec);
+
+        auto created = Database::create(tmp.string(), Config(dim, 256));
+        ASSERT_TRUE(created.has_value());
+        Database db = std::move(created.value());
+
+        std::mt19937 rng(dim);
+        std::vector<Vector> data;
+        for (int i = 0; i < 100; ++i) {
+            data.push_back(random_vector(dim, rng));
+            ASSERT_TRUE(db.add(static_cast<VectorId>(i), data.back(), {}));
+        }
+
+        Vector q = random_vector(dim, rng);
+        QueryOptions exact;
+        exact.strategy = SearchStrategy::Exact;
+        auto res = db.query(q, 100, {}, exact);
+        ASSERT_EQ(res.size(), 100u);
+        for (const auto &r : res) {
+            float d = 0;
+            for (uint32_t k = 0; k < dim; ++k) d += (q[k] - data[r.id][k]) * (q[k] - data[r.id][k]);
+            ASSERT_NEAR(r.distance, d, 1e-3f * d);
+        }
+
+        fs::remove(tmp, ec);
+    }
+}
+
+TEST(ElementTypes, QuantizedVectorsMatchIntegerBruteForce)
+{
+    const uint32_t dim = 100; // exercises the SIMD bodies and their scalar tails
+    for (ElementType type : {ElementType::Int8, ElementType::UInt8}) {
+        for (Metric metric : {Metric::L2, Metric::InnerProduct}) {
+            fs::path tmp = fs::temp_directory_path() / "orion_test_db10.bin";
+            std::error_code ec;
+            fs::remove(tmp, ec);
+
+            Config cfg(dim, 256);
+            cfg.element_type = type;
+            cfg.metric = metric;
+            auto created = Database::create(tmp.string(), cfg);
+            ASSERT_TRUE(created.has_value());
+            Database db = std::move(created.value());
+
+            // full-range components, where saturating 8-bit products would overflow
+            std::mt19937 rng(7);
+            std::uniform_int_distribution<int> byte(0, 255);
+            std::vector<std::vector<uint8_t>> data(80, std::vector<uint8_t>(dim));
+            for (size_t i = 0; i < data.size(); ++i) {
+                for (auto &b : data[i]) b = static_cast<uint8_t>(byte(rng));
+                bool added = type == ElementType::Int8
+                                 ? db.add(i, std::span<const int8_t>(reinterpret_cast<const int8_t *>(data[i].data()), dim), {})
+                                 : db.add(i, std::span<const uint8_t>(data[i]), {});
+                ASSERT_TRUE(added);
+            }
+            EXPECT_FALSE(db.add(999, Vector(dim, 0.0f), {}));
+            ASSERT_TRUE(db.save());
+
+            auto loaded = Database::load(tmp.string());
+            ASSERT_TRUE(loaded.has_value());
+            Database db2 = std::move(loaded.value());
+
+            auto value = [&](uint8_t b) { return type == ElementType::Int8 ? int32_t(int8_t(b)) : int32_t(b); };
+            auto got = db2.get(3);
+            ASSERT_TRUE(got.has_value());
+            for (uint32_t k = 0; k < dim; ++k) ASSERT_EQ(got->first[k], float(value(data[3][k])));
+
+            std::vector<uint8_t> q(dim);
+            for (auto &b : q) b = static_cast<uint8_t>(byte(rng));
+            QueryOptions exact;
+            exact.strategy = SearchStrategy::Exact;
+            auto res = type == ElementType::Int8
+                           ? db2.query(std::span<const int8_t>(reinterpret_cast<const int8_t *>(q.data()), dim), data.size(), {}, exact)
+                           : db2.query(std::span<const uint8_t>(q), data.size(), {}, exact);
+            ASSERT_EQ(res.size(), data.size());
+            for (const auto &r : res) {
+                int32_t acc = 0;
+                for (uint32_t k = 0; k < dim; ++k) {
+                    int32_t a = value(q[k]), b = value(data[r.id][k]);
+                    acc += metric == Metric::L2 ? (a - b) * (a - b) : a * b;
+                }
+                ASSERT_EQ(r.distance, metric == Metric::L2 ? float(acc) : 1.0f - float(acc));
+            }
+            EXPECT_FALSE(db2.query(Vector(dim, 0.0f), 5).size());
+
+            fs::remove(tmp, ec);
+        }
+    }
+}
+
+TEST(ElementTypes, BinaryVectorsUseHammingDistance)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db11.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t bits = 300; // not a multiple of 8 or 64
+    Config cfg(bits, 256);
+    cfg.element_type = ElementType::Binary;
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(11);
+    std::vector<BitVector> data(120, BitVector((bits + 7) / 8));
+    for (size_t i = 0; i < data.size(); ++i) {
+        for (auto &b : data[i]) b = static_cast<std::byte>(rng());
+        ASSERT_TRUE(db.add(i, data[i], {{"even", int64_t(i % 2 == 0)}}));
+    }
+    EXPECT_FALSE(db.add(999, BitVector(bits / 8), {}));
+    ASSERT_TRUE(db.save());
+
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    Database db2 = std::move(loaded.value());
+
+    auto bit = [](const BitVector &v, size_t i) { return (std::to_integer<int>(v[i / 8]) >> (i % 8)) & 1; };
+    auto got = db2.get(5);
+    ASSERT_TRUE(got.has_value());
+    ASSERT_EQ(got->first.size(), bits);
+    for (size_t i = 0; i < bits; ++i) ASSERT_EQ(got->first[i], float(bit(data[5], i)));
+
+    // padding bits past the last component are ignored
+    BitVector q = data[7];
+    q.back() ^= std::byte{0xf0};
+    auto graph = db2.query(q, 1);
+    ASSERT_EQ(graph.size(), 1u);
+    EXPECT_EQ(graph[0].id, 7u);
+    EXPECT_EQ(graph[0].distance, 0.0f);
+
+    QueryOptions exact;
+    exact.strategy = SearchStrategy::Exact;
+    auto res = db2.query(data[0], data.size(), {}, exact);
+    ASSERT_EQ(res.size(), data.size());
+    for (const auto &r : res) {
+        int differing = 0;
+        for (size_t i = 0; i < bits; ++i) differing += bit(data[0], i) != bit(data[r.id], i);
+        ASSERT_EQ(r.distance, float(differing));
+    }
+    for (const auto &r : db2.query(data[1], 10, {{"even", int64_t(0)}}))
+        EXPECT_EQ(r.id % 2, 1u);
+
+    fs::remove(tmp, ec);
+}
+
+struct WeightedL2
+{
+    std::vector<float> weights;
+    float operator()(const float *a, const float *b, size_t dim) const
+    {
+        float sum = 0;
+        for (size_t i = 0; i < dim; ++i) sum += weights[i] * (a[i] - b[i]) * (a[i] - b[i]);
+        return sum;
+    }
+};
+
+TEST(CustomMetric, RegisteredMetricIsUsedAndRecorded)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db12.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 24;
+    WeightedL2 metric;
+    for (uint32_t i = 0; i < dim; ++i) metric.weights.push_back(i < 4 ? 10.0f : 0.1f);
+    ASSERT_TRUE(register_metric("weighted_l2/v1", metric));
+
+    Config cfg(dim, 256);
+    cfg.custom_metric = "weighted_l2/v0";
+    EXPECT_FALSE(Database::create(tmp.string(), cfg).has_value());
+    cfg.custom_metric = "weighted_l2/v1";
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(12);
+    std::vector<Vector> data;
+    for (int i = 0; i < 150; ++i) {
+        data.push_back(random_vector(dim, rng));
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), data.back(), {}));
+    }
+    ASSERT_TRUE(db.save());
+
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    Vector q = random_vector(dim, rng);
+    QueryOptions exact;
+    exact.strategy = SearchStrategy::Exact;
+    auto res = loaded->query(q, data.size(), {}, exact);
+    ASSERT_EQ(res.size(), data.size());
+    for (const auto &r : res) ASSERT_FLOAT_EQ(r.distance, metric(q.data(), data[r.id].data(), dim));
+    auto graph = loaded->query(data[9], 1);
+    ASSERT_EQ(graph.size(), 1u);
+    EXPECT_EQ(graph[0].id, 9u);
+
+    // each registration keeps its own functor, even of the same type
+    WeightedL2 flat{std::vector<float>(dim, 1.0f)};
+    ASSERT_TRUE(register_metric("weighted_l2/flat", flat));
+    cfg.custom_metric = "weighted_l2/flat";
+    fs::path tmp_flat = fs::temp_directory_path() / "orion_test_db12b.bin";
+    auto flat_db = Database::create(tmp_flat.string(), cfg);
+    ASSERT_TRUE(flat_db.has_value());
+    for (int i = 0; i < 20; ++i) ASSERT_TRUE(flat_db->add(static_cast<VectorId>(i), data[i], {}));
+    for (const auto &r : flat_db->query(q, 20, {}, exact)) ASSERT_FLOAT_EQ(r.distance, flat(q.data(), data[r.id].data(), dim));
+    // registering a name again leaves databases already open on the old functor
+    ASSERT_TRUE(register_metric("weighted_l2/v1", flat));
+    for (const auto &r : loaded->query(q, 20, {}, exact)) ASSERT_FLOAT_EQ(r.distance, metric(q.data(), data[r.id].data(), dim));
+    ASSERT_TRUE(register_metric("weighted_l2/v1", metric));
+    fs::remove(tmp_flat, ec);
+
+    // a file naming a metric this process has not registered is refused
+    std::string bytes;
+    {
+        std::ifstream in(tmp, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    bytes.replace(bytes.find("weighted_l2/v1"), 14, "weighted_l2/v2");
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out << bytes;
+    }
+    EXPECT_FALSE(Database::load(tmp.string()).has_value());
+
+    fs::remove(tmp, ec);
+}
+
+TEST(Quantization, AnisotropicCodesWithExactRerank)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db13.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 32;
+    Config cfg(dim, 2048);
+    cfg.metric = Metric::InnerProduct;
+    cfg.pq_subspaces = 8;
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(13);
+    std::normal_distribution<float> gauss;
+    std::vector<Vector> centers(10, Vector(dim));
+    for (auto &c : centers)
+        for (auto &x : c) x = gauss(rng);
+    auto sample = [&](size_t cluster) {
+        Vector v(dim);
+        float norm = 0;
+        for (uint32_t d = 0; d < dim; ++d) {
+            v[d] = centers[cluster % centers.size()][d] + 0.7f * gauss(rng);
+            norm += v[d] * v[d];
+        }
+        for (auto &x : v) x /= std::sqrt(norm);
+        return v;
+    };
+    for (int i = 0; i < 1000; ++i)
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), sample(i), {{"cluster", int64_t(i % 10)}}));
+
+    QueryOptions exact, quantized;
+    exact.strategy = SearchStrategy::Exact;
+    quantized.strategy = SearchStrategy::Quantized;
+    Vector probe = sample(3);
+    auto untrained = db.query(probe, 5, {}, quantized);
+    ASSERT_FALSE(untrained.empty());
+    EXPECT_EQ(untrained[0].path, SearchPath::ExactScan);
+
+    ASSERT_TRUE(db.train_quantizer());
+    for (int i = 1000; i < 1100; ++i) // encoded on insert
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), sample(i), {{"cluster", int64_t(i % 10)}}));
+    ASSERT_TRUE(db.save());
+
+    std::vector<Vector> queries;
+    for (int q = 0; q < 50; ++q) queries.push_back(sample(q));
+    size_t hits = 0;
+    std::vector<std::vector<QueryResult>> before;
+    for (const auto &q : queries) {
+        auto truth = db.query(q, 10, {}, exact);
+        auto approx = db.query(q, 10, {}, quantized);
+        ASSERT_EQ(approx.size(), 10u);
+        std::set<VectorId> ids;
+        for (const auto &r : truth) ids.insert(r.id);
+        for (const auto &r : approx) {
+            hits += ids.count(r.id);
+            EXPECT_EQ(r.path, SearchPath::Quantized);
+            float dot = 0;
+            auto stored = db.get(r.id);
+            for (uint32_t d = 0; d < dim; ++d) dot += q[d] * stored->first[d];
+            EXPECT_NEAR(r.distance, 1.0f - dot, 1e-5f); // reranked with exact scores
+        }
+        before.push_back(approx);
+    }
+    EXPECT_GE(double(hits) / (queries.size() * 10), 0.85);
+
+    auto filtered = db.query(queries[0], 10, {{"cluster", int64_t(4)}}, quantized);
+    ASSERT_EQ(filtered.size(), 10u);
+    for (const auto &r : filtered) EXPECT_EQ(r.id % 10, 4u);
+
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        auto after = loaded->query(queries[q], 10, {}, quantized);
+        ASSERT_EQ(after.size(), before[q].size());
+        for (size_t i = 0; i < after.size(); ++i) EXPECT_EQ(after[i].id, before[q][i].id);
+    }
+    // a rebuilt graph carries the codes over by id
+    ASSERT_TRUE(loaded->remove(1099));
+    ASSERT_TRUE(loaded->compact());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        auto after = loaded->query(queries[q], 10, {}, quantized);
+        std::vector<VectorId> expected;
+        for (const auto &r : before[q])
+            if (r.id != 1099) expected.push_back(r.id);
+        ASSERT_GE(after.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) EXPECT_EQ(after[i].id, expected[i]);
+    }
+
+    fs::remove(tmp, ec);
+}
+
+TEST(Projection, ReducedGraphWithFullDimensionRerank)
+{
+    const uint32_t dim = 64, latent = 8;
+    std::mt19937 rng(14);
+    std::normal_distribution<float> gauss;
+    // data close to an 8-dimensional subspace, so PCA to 8 dims loses little
+    std::vector<Vector> basis(latent, Vector(dim));
+    for (auto &b : basis)
+        for (auto &x : b) x = gauss(rng);
+    auto sample = [&] {
+        Vector v(dim, 0.0f);
+        for (uint32_t l = 0; l < latent; ++l) {
+            float c = gauss(rng);
+            for (uint32_t d = 0; d < dim; ++d) v[d] += c * basis[l][d];
+        }
+        for (auto &x : v) x += 0.01f * gauss(rng);
+        return v;
+    };
+    std::vector<Vector> data, queries;
+    for (int i = 0; i < 600; ++i) data.push_back(sample());
+    for (int q = 0; q < 30; ++q) queries.push_back(sample());
+
+    for (Projection projection : {Projection::PCA, Projection::RandomOrthogonal}) {
+        fs::path tmp = fs::temp_directory_path() / "orion_test_db14.bin";
+        std::error_code ec;
+        fs::remove(tmp, ec);
+
+        Config cfg(dim, 1024);
+        cfg.projection = projection;
+        cfg.projected_dim = projection == Projection::PCA ? latent : 32;
+        auto created = Database::create(tmp.string(), cfg);
+        ASSERT_TRUE(created.has_value());
+        Database db = std::move(created.value());
+        for (size_t i = 0; i < data.size(); ++i) ASSERT_TRUE(db.add(i, data[i], {}));
+        if (projection == Projection::PCA)
+            ASSERT_TRUE(db.train_projection());
+        else
+            EXPECT_FALSE(db.train_projection());
+        ASSERT_TRUE(db.save());
+
+        auto loaded = Database::load(tmp.string());
+        ASSERT_TRUE(loaded.has_value());
+        size_t hits = 0;
+        for (const auto &q : queries) {
+            std::vector<std::pair<float, VectorId>> truth;
+            for (size_t i = 0; i < data.size(); ++i) {
+                float d = 0;
+                for (uint32_t k = 0; k < dim; ++k) d += (q[k] - data[i][k]) * (q[k] - data[i][k]);
+                truth.emplace_back(d, i);
+            }
+            std::sort(truth.begin(), truth.end());
+            std::set<VectorId> ids;
+            for (size_t i = 0; i < 10; ++i) ids.insert(truth[i].second);
+
+            auto res = loaded->query(q, 10);
+            ASSERT_EQ(res.size(), 10u);
+            for (const auto &r : res) {
+                hits += ids.count(r.id);
+                float d = 0;
+                for (uint32_t k = 0; k < dim; ++k) d += (q[k] - data[r.id][k]) * (q[k] - data[r.id][k]);
+                EXPECT_NEAR(r.distance, d, 1e-3f * d + 1e-4f); // full-dimension rerank
+            }
+            // Exact scans the stored full-dimension vectors, not the projected graph
+            QueryOptions exact;
+            exact.strategy = SearchStrategy::Exact;
+            auto exact_res = loaded->query(q, 10, {}, exact);
+            ASSERT_EQ(exact_res.size(), 10u);
+            for (size_t i = 0; i < 10; ++i) {
+                EXPECT_EQ(exact_res[i].path, SearchPath::ExactScan);
+                EXPECT_NEAR(exact_res[i].distance, truth[i].first, 1e-3f * truth[i].first + 1e-4f);
+            }
+        }
+        EXPECT_GE(double(hits) / (queries.size() * 10), 0.8);
+        // tuned against full-dimension ground truth
+        EXPECT_GE(loaded->autotune(0.9f, 10, 50), 10u);
+        auto stored = loaded->get(5);
+        ASSERT_TRUE(stored.has_value());
+        EXPECT_EQ(stored->first, data[5]);
+
+        fs::remove(tmp, ec);
+    }
+}
+
+TEST(Matryoshka, PrefixDimensionSearchWithFullRerank)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db15.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 128, prefix = 32;
+    auto created = Database::create(tmp.string(), Config(dim, 2048));
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    // leading components carry most of the variance, like a Matryoshka embedding
+    std::mt19937 rng(15);
+    std::normal_distribution<float> gauss;
+    auto sample = [&] {
+        Vector v(dim);
+        for (uint32_t d = 0; d < dim; ++d) v[d] = gauss(rng) * (d < prefix ? 1.0f : 0.1f);
+        return v;
+    };
+    std::vector<Vector> data;
+    for (int i = 0; i < 1000; ++i) {
+        data.push_back(sample());
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), data.back(), {{"half", int64_t(i % 2)}}));
+    }
+
+    QueryOptions full_exact, prefix_exact, prefix_graph;
+    full_exact.strategy = SearchStrategy::Exact;
+    prefix_exact.strategy = SearchStrategy::Exact;
+    prefix_exact.prefix_dim = prefix;
+    prefix_graph.prefix_dim = prefix;
+    size_t exact_hits = 0, graph_hits = 0;
+    for (int q = 0; q < 30; ++q) {
+        Vector query = sample();
+        auto truth = db.query(query, 10, {}, full_exact);
+        std::set<VectorId> ids;
+        for (const auto &r : truth) ids.insert(r.id);
+        auto scanned = db.query(query, 10, {}, prefix_exact);
+        auto walked = db.query(query, 10, {}, prefix_graph);
+        ASSERT_EQ(scanned.size(), 10u);
+        ASSERT_EQ(walked.size(), 10u);
+        for (const auto &r : scanned) {
+            exact_hits += ids.count(r.id);
+            float d = 0;
+            for (uint32_t k = 0; k < dim; ++k) d += (query[k] - data[r.id][k]) * (query[k] - data[r.id][k]);
+            EXPECT_NEAR(r.distance, d, 1e-3f * d); // rescored on all dimensions
+        }
+        for (const auto &r : walked) graph_hits += ids.count(r.id);
+        EXPECT_TRUE(std::is_sorted(walked.begin(), walked.end(), [](const QueryResult &a, const QueryResult &b) { return a.distance < b.distance; }));
+        for (const auto &r : db.query(query, 5, {{"half", int64_t(1)}}, prefix_graph)) EXPECT_EQ(r.id % 2, 1u);
+    }
+    EXPECT_GE(double(exact_hits) / 300, 0.9);
+    EXPECT_GE(double(graph_hits) / 300, 0.6);
+
+    fs::remove(tmp, ec);
+}
+
+TEST(BatchQuery, BlockedExactMatchesPerQueryScan)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db16.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    for (Metric metric : {Metric::L2, Metric::InnerProduct}) {
+        fs::remove(tmp, ec);
+        const uint32_t dim = 100; // not a multiple of the SIMD width
+        Config cfg(dim, 4096);
+        cfg.metric = metric;
+        auto created = Database::create(tmp.string(), cfg);
+        ASSERT_TRUE(created.has_value());
+        Database db = std::move(created.value());
+
+        std::mt19937 rng(16);
+        std::normal_distribution<float> gauss;
+        auto sample = [&] {
+            Vector v(dim);
+            for (auto &x : v) x = gauss(rng);
+            return v;
+        };
+        // several packed blocks, the last one partial
+        for (int i = 0; i < 3001; ++i)
+            ASSERT_TRUE(db.add(static_cast<VectorId>(i), sample(), {{"third", int64_t(i % 3)}}));
+        ASSERT_TRUE(db.remove(7));
+
+        // 13 queries: two full 6-row tiles and a remainder row, plus one of the wrong size
+        std::vector<Vector> queries;
+        for (int q = 0; q < 13; ++q) queries.push_back(sample());
+        queries.push_back(Vector(dim - 1, 0.0f));
+
+        QueryOptions exact;
+        exact.strategy = SearchStrategy::Exact;
+        for (const Metadata &filter : {Metadata{}, Metadata{{"third", int64_t(1)}}}) {
+            auto batch = db.query_batch(queries, 10, filter, exact);
+            ASSERT_EQ(batch.size(), queries.size());
+            EXPECT_TRUE(batch.back().empty());
+            for (size_t q = 0; q + 1 < queries.size(); ++q) {
+                auto single = db.query(queries[q], 10, filter, exact);
+                ASSERT_EQ(batch[q].size(), single.size());
+                for (size_t r = 0; r < single.size(); ++r) {
+                    EXPECT_EQ(batch[q][r].id, single[r].id);
+                    EXPECT_NEAR(batch[q][r].distance, single[r].distance, 1e-3f * std::max(1.0f, std::fabs(single[r].distance)));
+                    EXPECT_EQ(batch[q][r].path, SearchPath::ExactScan);
+                    EXPECT_NE(batch[q][r].id, 7u);
+                    if (!filter.empty()) {
+                        EXPECT_EQ(batch[q][r].id % 3, 1u);
+                    }
+                }
+            }
+        }
+        // other strategies go through query() one by one
+        auto graph = db.query_batch(queries, 5);
+        ASSERT_EQ(graph.size(), queries.size());
+        EXPECT_EQ(graph[0].size(), 5u);
+    }
+
+    fs::remove(tmp, ec);
+}
+
+TEST(InvertedFile, ProbedListsMatchExactScan)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db17.bin";
+    std::error_code ec;
+
+    Config bad(16);
+    bad.index_type = IndexType::IVF;
+    bad.element_type = ElementType::Int8;
+    EXPECT_FALSE(Database::create(tmp.string(), bad).has_value());
+
+    for (bool sq8 : {false, true}) {
+        fs::remove(tmp, ec);
+        const uint32_t dim = 32;
+        Config cfg(dim);
+        cfg.index_type = IndexType::IVF;
+        cfg.ivf_sq8 = sq8;
+        auto created = Database::create(tmp.string(), cfg);
+        ASSERT_TRUE(created.has_value());
+        Database db = std::move(created.value());
+
+        // clustered data, so a few lists hold each query's neighbors
+        std::mt19937 rng(17);
+        std::normal_distribution<float> gauss;
+        std::vector<Vector> centers(40, Vector(dim));
+        for (auto &c : centers)
+            for (auto &x : c) x = gauss(rng) * 4.0f;
+        auto sample = [&] {
+            Vector v = centers[rng() % centers.size()];
+            for (auto &x : v) x += gauss(rng);
+            return v;
+        };
+        for (int i = 0; i < 3000; ++i)
+            ASSERT_TRUE(db.add(static_cast<VectorId>(i), sample(), {{"half", int64_t(i % 2)}}));
+        ASSERT_TRUE(db.remove(11));
+
+        QueryOptions exact, probe;
+        exact.strategy = SearchStrategy::Exact;
+        probe.nprobe = 6;
+        std::vector<Vector> queries;
+        for (int q = 0; q < 30; ++q) queries.push_back(sample());
+        auto recall = [&](Database &d) {
+            size_t hits = 0;
+            for (const auto &query : queries) {
+                auto truth = d.query(query, 10, {}, exact);
+                std::set<VectorId> ids;
+                for (const auto &r : truth) ids.insert(r.id);
+                auto found = d.query(query, 10, {}, probe);
+                EXPECT_EQ(found.size(), 10u);
+                for (const auto &r : found) {
+                    EXPECT_EQ(r.path, SearchPath::InvertedFile);
+                    EXPECT_NE(r.id, 11u);
+                    hits += ids.count(r.id);
+                }
+                for (const auto &r : d.query(query, 5, {{"half", int64_t(1)}}, probe)) EXPECT_EQ(r.id % 2, 1u);
+            }
+            return double(hits) / 300;
+        };
+        const double before = recall(db);
+        EXPECT_GE(before, 0.9);
+        if (sq8) {
+            // SQ8 candidates are rescored from the float vectors
+            auto found = db.query(queries[0], 3, {}, probe);
+            auto truth = db.query(queries[0], 3, {}, exact);
+            EXPECT_NEAR(found[0].distance, truth[0].distance, 1e-3f * truth[0].distance);
+        }
+
+        ASSERT_TRUE(db.save());
+        auto loaded = Database::load(tmp.string());
+        ASSERT_TRUE(loaded.has_value());
+        EXPECT_EQ(loaded->count(), 2999u);
+        EXPECT_DOUBLE_EQ(recall(*loaded), before);
+        EXPECT_TRUE(loaded->train_ivf());
+        EXPECT_GE(recall(*loaded), 0.9);
+    }
+
+    fs::remove(tmp, ec);
+}
+
+TEST(DiskIndex, VamanaBeamSearchMatchesExactScan)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db18.bin";
+    fs::path disk = fs::temp_directory_path() / "orion_test_db18.disk";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    // 268-byte nodes pack 15 to a sector; 1100 dimensions span two sectors
+    for (uint32_t dim : {32u, 1100u}) {
+        fs::remove(tmp, ec);
+        auto created = Database::create(tmp.string(), Config(dim, 4096));
+        ASSERT_TRUE(created.has_value());
+        Database db = std::move(created.value());
+        std::mt19937 rng(18);
+        std::normal_distribution<float> gauss;
+        std::vector<Vector> centers(30, Vector(dim));
+        for (auto &c : centers)
+            for (auto &x : c) x = gauss(rng) * 3.0f;
+        auto sample = [&] {
+            Vector v = centers[rng() % centers.size()];
+            for (auto &x : v) x += gauss(rng);
+            return v;
+        };
+        const int count = dim == 32 ? 3000 : 400;
+        for (int i = 0; i < count; ++i)
+            ASSERT_TRUE(db.add(static_cast<VectorId>(1000 + i), sample(), {}));
+
+        DiskIndexConfig cfg;
+        cfg.max_degree = 24;
+        ASSERT_TRUE(db.build_disk_index(disk.string(), cfg));
+        auto index = DiskIndex::open(disk.string());
+        ASSERT_TRUE(index.has_value());
+        EXPECT_EQ(index->size(), size_t(count));
+        EXPECT_EQ(index->dim(), dim);
+
+        QueryOptions exact;
+        exact.strategy = SearchStrategy::Exact;
+        size_t hits = 0;
+        for (int q = 0; q < 20; ++q) {
+            Vector query = sample();
+            std::set<VectorId> ids;
+            for (const auto &r : db.query(query, 10, {}, exact)) ids.insert(r.id);
+            auto found = index->query(query, 10);
+            ASSERT_EQ(found.size(), 10u);
+            EXPECT_TRUE(std::is_sorted(found.begin(), found.end(), [](const QueryResult &a, const QueryResult &b) { return a.distance < b.distance; }));
+            for (const auto &r : found) hits += ids.count(r.id);
+        }
+        EXPECT_GE(double(hits) / 200, 0.9);
+        EXPECT_GT(index->sectors_read(), 0u);
+        EXPECT_TRUE(index->query(Vector(dim + 1), 10).empty());
+    }
+    EXPECT_FALSE(DiskIndex::open(tmp.string()).has_value()); // not a disk index
+
+    fs::remove(tmp, ec);
+    fs::remove(disk, ec);
+}
+
+TEST(TieredStorage, RecordsReadFromDiskAfterSave)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db19.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 64;
+    Config cfg(dim, 4096);
+    cfg.projection = Projection::RandomOrthogonal; // graph on 16 dims, full vectors reranked from disk
+    cfg.projected_dim = 16;
+    cfg.tiered_storage = true;
+    cfg.tiered_cache_size = 64;
+    auto created = Database::create(tmp.string(), cfg);
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    std::mt19937 rng(19);
+    std::normal_distribution<float> gauss;
+    auto sample = [&] {
+        Vector v(dim);
+        for (auto &x : v) x = gauss(rng);
+        return v;
+    };
+    std::vector<Vector> data;
+    for (int i = 0; i < 1500; ++i) {
+        data.push_back(sample());
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), data.back(), {{"tag", std::string(i % 2 ? "odd" : "even")}, {"i", int64_t(i)}}));
+    }
+    std::vector<Vector> queries;
+    for (int q = 0; q < 10; ++q) queries.push_back(sample());
+    std::vector<std::vector<QueryResult>> before;
+    for (const auto &q : queries) before.push_back(db.query(q, 10));
+
+    ASSERT_TRUE(db.save()); // records now live only in the file
+    auto same = [](const std::vector<QueryResult> &a, const std::vector<QueryResult> &b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (a[i].id != b[i].id || std::fabs(a[i].distance - b[i].distance) > 1e-4f) return false;
+        return true;
+    };
+    for (size_t q = 0; q < queries.size(); ++q) EXPECT_TRUE(same(db.query(queries[q], 10), before[q]));
+    auto got = db.get(7);
+    ASSERT_TRUE(got.has_value());
+    EXPECT_EQ(got->first, data[7]);
+    EXPECT_EQ(std::get<int64_t>(got->second.at("i")), 7);
+
+    // replacing, removing and adding after the save
+    ASSERT_TRUE(db.add(3, data[3], {{"tag", std::string("moved")}}));
+    ASSERT_TRUE(db.remove(5));
+    for (const auto &r : db.query(queries[0], 20, {{"tag", std::string("odd")}})) {
+        EXPECT_NE(r.id, 3u);
+        EXPECT_NE(r.id, 5u);
+    }
+    Vector fresh = sample();
+    ASSERT_TRUE(db.add(5000, fresh, {}));
+    auto hit = db.query(fresh, 1);
+    ASSERT_EQ(hit.size(), 1u);
+    EXPECT_EQ(hit[0].id, 5000u);
+
+    ASSERT_TRUE(db.save());
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->count(), 1500u);
+    EXPECT_EQ(loaded->get(5000)->first, fresh);
+    EXPECT_EQ(std::get<std::string>(loaded->get(3)->second.at("tag")), "moved");
+    for (size_t q = 1; q < queries.size(); ++q) EXPECT_TRUE(same(loaded->query(queries[q], 10), db.query(queries[q], 10)));
+
+    fs::remove(tmp, ec);
+}
+
+TEST(Clustering, RecoversSeparatedBlobs)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db20.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 16;
+    auto created = Database::create(tmp.string(), Config(dim, 4096));
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+
+    // four tight blobs far apart; blob b is tagged "b<b>"
+    std::mt19937 rng(20);
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+    for (int i = 0; i < 2000; ++i) {
+        const int blob = i % 4;
+        Vector v(dim);
+        for (uint32_t d = 0; d < dim; ++d) v[d] = noise(rng) + (d % 4 == uint32_t(blob) ? 10.0f : 0.0f);
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), v, {{"blob", int64_t(blob)}, {"half", int64_t(i < 1000)}}));
+    }
+
+    Clustering all = db.cluster(4, 25, 500);
+    ASSERT_EQ(all.centroids.size(), 4u);
+    ASSERT_EQ(all.ids.size(), 2000u);
+    ASSERT_EQ(all.assignments.size(), 2000u);
+    std::map<int, std::set<uint32_t>> seen; // blob -> clusters its members went to
+    for (size_t i = 0; i < all.ids.size(); ++i) seen[int(all.ids[i] % 4)].insert(all.assignments[i]);
+    std::set<uint32_t> used;
+    for (const auto &[blob, clusters] : seen) {
+        EXPECT_EQ(clusters.size(), 1u) << "blob " << blob << " was split";
+        used.insert(clusters.begin(), clusters.end());
+    }
+    EXPECT_EQ(used.size(), 4u);
+    for (size_t i = 0; i < all.ids.size(); i += 97) {
+        const Vector &c = all.centroids[all.assignments[i]];
+        EXPECT_NEAR(c[all.ids[i] % 4], 10.0f, 0.1f);
+    }
+
+    Clustering filtered = db.cluster(2, 25, 0, {{"half", int64_t(1)}, {"blob", int64_t(2)}});
+    EXPECT_EQ(filtered.ids.size(), 250u);
+    for (VectorId id : filtered.ids) EXPECT_EQ(id % 4, 2u);
+    EXPECT_TRUE(db.cluster(0).ids.empty());
+    EXPECT_TRUE(db.cluster(3, 25, 0, {{"blob", int64_t(9)}}).ids.empty());
+
+    fs::remove(tmp, ec);
+}
+
+TEST(KnnJoin, SelfAndCrossJoinMatchExactNeighbors)
+{
+    fs::path tmp_a = fs::temp_directory_path() / "orion_test_db21a.bin";
+    fs::path tmp_b = fs::temp_directory_path() / "orion_test_db21b.bin";
+    std::error_code ec;
+    fs::remove(tmp_a, ec);
+    fs::remove(tmp_b, ec);
+
+    const uint32_t dim = 24;
+    auto created_a = Database::create(tmp_a.string(), Config(dim, 4096));
+    auto created_b = Database::create(tmp_b.string(), Config(dim, 4096));
+    ASSERT_TRUE(created_a.has_value() && created_b.has_value());
+    Database a = std::move(created_a.value());
+    Database b = std::move(created_b.value());
+
+    std::mt19937 rng(21);
+    std::normal_distribution<float> gauss;
+    auto sample = [&] {
+        Vector v(dim);
+        for (auto &x : v) x = gauss(rng);
+        return v;
+    };
+    for (int i = 0; i < 1500; ++i) ASSERT_TRUE(a.add(static_cast<VectorId>(i), sample(), {{"even", int64_t(i % 2 == 0)}}));
+    for (int i = 0; i < 300; ++i) ASSERT_TRUE(b.add(static_cast<VectorId>(10000 + i), sample(), {}));
+    ASSERT_TRUE(a.remove(7));
+
+    const size_t k = 5;
+    QueryOptions exact;
+    exact.strategy = SearchStrategy::Exact;
+
+    // self-join: every live vector once, never its own neighbor
+    std::map<VectorId, std::vector<QueryResult>> self;
+    ASSERT_TRUE(a.knn_join(a, k, [&](VectorId id, const std::vector<QueryResult> &neighbors) {
+        EXPECT_TRUE(self.emplace(id, neighbors).second) << "source " << id << " emitted twice";
+    }, {}, 4));
+    ASSERT_EQ(self.size(), 1499u);
+    EXPECT_EQ(self.count(7), 0u);
+    size_t hits = 0;
+    for (const auto &[id, neighbors] : self) {
+        ASSERT_EQ(neighbors.size(), k);
+        auto v = a.get(id)->first;
+        std::set<VectorId> truth;
+        for (const auto &r : a.query(v, k + 1, {}, exact))
+            if (r.id != id) truth.insert(r.id);
+        for (const auto &r : neighbors) {
+            EXPECT_NE(r.id, id);
+            hits += truth.count(r.id);
+        }
+    }
+    EXPECT_GE(double(hits) / double(self.size() * k), 0.9);
+
+    // cross join with a filter on the target
+    size_t emitted = 0;
+    ASSERT_TRUE(b.knn_join(a, k, [&](VectorId id, const std::vector<QueryResult> &neighbors) {
+        ++emitted;
+        auto v = b.get(id)->first;
+        std::set<VectorId> truth;
+        for (const auto &r : a.query(v, k, {{"even", int64_t(1)}}, exact)) truth.insert(r.id);
+        size_t found = 0;
+        for (const auto &r : neighbors) {
+            EXPECT_EQ(r.id % 2, 0u);
+            found += truth.count(r.id);
+        }
+        EXPECT_GE(found, k - 2);
+    }, {{"even", int64_t(1)}}));
+    EXPECT_EQ(emitted, 300u);
+
+    Config other_dim(dim + 1, 16);
+    fs::path tmp_c = fs::temp_directory_path() / "orion_test_db21c.bin";
+    auto c = Database::create(tmp_c.string(), other_dim);
+    ASSERT_TRUE(c.has_value());
+    EXPECT_FALSE(a.knn_join(*c, k, [](VectorId, const std::vector<QueryResult> &) {}));
+
+    fs::remove(tmp_a, ec);
+    fs::remove(tmp_b, ec);
+    fs::remove(tmp_c, ec);
+}
+
+TEST(GraphRepair, ReconnectsAroundRemovedVectors)
+{
+    const uint32_t dim = 16;
+    std::mt19937 rng(22);
+    std::normal_distribution<float> gauss;
+    std::vector<Vector> data(3000, Vector(dim));
+    for (auto &v : data)
+        for (auto &x : v) x = gauss(rng);
+
+    // identical databases with the same 60% removed; one repairs as it goes
+    auto build = [&](const fs::path &path, float threshold) {
+        std::error_code ec;
+        fs::remove(path, ec);
+        Config cfg(dim, 4096);
+        cfg.repair_threshold = threshold;
+        auto created = Database::create(path.string(), cfg);
+        EXPECT_TRUE(created.has_value());
+        Database db = std::move(created.value());
+        for (size_t i = 0; i < data.size(); ++i) EXPECT_TRUE(db.add(static_cast<VectorId>(i), data[i], {}));
+        for (size_t i = 0; i < data.size(); ++i) {
+            if (i % 5 < 3) {
+                EXPECT_TRUE(db.remove(static_cast<VectorId>(i)));
+            }
+        }
+        return db;
+    };
+    fs::path tmp_manual = fs::temp_directory_path() / "orion_test_db22a.bin";
+    fs::path tmp_auto = fs::temp_directory_path() / "orion_test_db22b.bin";
+    Database manual = build(tmp_manual, 0.0f);
+    Database automatic = build(tmp_auto, 0.1f);
+
+    std::vector<Vector> queries(50, Vector(dim));
+    for (auto &q : queries)
+        for (auto &x : q) x = gauss(rng);
+    QueryOptions graph, exact;
+    graph.strategy = SearchStrategy::Graph;
+    exact.strategy = SearchStrategy::Exact;
+    auto recall = [&](const Database &db) {
+        size_t hits = 0;
+        for (const auto &q : queries) {
+            std::set<VectorId> truth;
+            for (const auto &r : db.query(q, 10, {}, exact)) truth.insert(r.id);
+            for (const auto &r : db.query(q, 10, {}, graph)) {
+                EXPECT_GE(r.id % 5, 3u) << "removed vector returned";
+                hits += truth.count(r.id);
+            }
+        }
+        return double(hits) / double(queries.size() * 10);
+    };
+
+    // remove() already repaired most of the automatic database's graph
+    const double unrepaired = recall(manual);
+    const size_t manual_rewrites = manual.repair_graph();
+    EXPECT_GT(manual_rewrites, 0u);
+    EXPECT_EQ(manual.repair_graph(), 0u); // nothing left pointing at tombstones
+    EXPECT_LT(automatic.repair_graph(), manual_rewrites);
+    EXPECT_GE(recall(manual), std::max(unrepaired, 0.9));
+    EXPECT_GE(recall(automatic), 0.9);
+
+    // queries keep running while a repair pass holds the lock slice by slice
+    Database &db = manual;
+    for (size_t i = 0; i < data.size(); ++i) {
+        if (i % 5 == 3) {
+            ASSERT_TRUE(db.remove(static_cast<VectorId>(i)));
+        }
+    }
+    std::atomic<bool> done{false};
+    std::thread repairer([&] {
+        db.repair_graph();
+        done = true;
+    });
+    size_t answered = 0;
+    while (!done) answered += db.query(queries[answered % queries.size()], 5).size() == 5;
+    repairer.join();
+    for (const auto &q : queries)
+        for (const auto &r : db.query(q, 5, {}, graph)) EXPECT_EQ(r.id % 5, 4u);
+
+    std::error_code ec;
+    fs::remove(tmp_manual, ec);
+    fs::remove(tmp_auto, ec);
+}
+
+TEST(Autotune, PicksSmallestEfMeetingTargetRecall)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db23.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 32;
+    auto created = Database::create(tmp.string(), Config(dim, 8192));
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+    std::mt19937 rng(23);
+    std::normal_distribution<float> gauss;
+    auto sample = [&] {
+        Vector v(dim);
+        for (auto &x : v) x = gauss(rng);
+        return v;
+    };
+    for (int i = 0; i < 4000; ++i) ASSERT_TRUE(db.add(static_cast<VectorId>(i), sample(), {}));
+
+    QueryOptions exact;
+    exact.strategy = SearchStrategy::Exact;
+    std::vector<Vector> queries;
+    for (int q = 0; q < 100; ++q) queries.push_back(sample());
+    auto recall = [&](const Database &d, uint32_t ef) {
+        QueryOptions graph;
+        graph.strategy = SearchStrategy::Graph;
+        graph.ef = ef;
+        size_t hits = 0;
+        for (const auto &q : queries) {
+            std::set<VectorId> truth;
+            for (const auto &r : d.query(q, 10, {}, exact)) truth.insert(r.id);
+            for (const auto &r : d.query(q, 10, {}, graph)) hits += truth.count(r.id);
+        }
+        return double(hits) / double(queries.size() * 10);
+    };
+
+    const uint32_t ef = db.autotune(0.95f, 10, 200);
+    ASSERT_GE(ef, 10u);
+    EXPECT_LT(ef, 4000u);
+    EXPECT_GE(recall(db, ef), 0.92); // fresh queries, not the tuning sample
+    if (ef > 10) {
+        EXPECT_LT(recall(db, ef / 2), recall(db, ef));
+    }
+
+    // the tuned ef is the saved default
+    ASSERT_TRUE(db.save());
+    auto loaded = Database::load(tmp.string());
+    ASSERT_TRUE(loaded.has_value());
+    QueryOptions tuned;
+    tuned.ef = ef;
+    for (const auto &q : queries) {
+        auto by_default = loaded->query(q, 10);
+        auto explicit_ef = loaded->query(q, 10, {}, tuned);
+        ASSERT_EQ(by_default.size(), explicit_ef.size());
+        for (size_t i = 0; i < by_default.size(); ++i) EXPECT_EQ(by_default[i].id, explicit_ef[i].id);
+    }
+    EXPECT_EQ(db.autotune(0.95f, 5000), 0u); // not enough vectors
+
+    fs::remove(tmp, ec);
+}
+
+TEST(Stats, GraphAndPostingFiguresMatchInspectedFile)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db24.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 16;
+    auto created = Database::create(tmp.string(), Config(dim, 4096));
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+    std::mt19937 rng(24);
+    std::normal_distribution<float> gauss;
+    for (int i = 0; i < 2000; ++i) {
+        Vector v(dim);
+        for (auto &x : v) x = gauss(rng);
+        Metadata meta{{"bucket", int64_t(i % 10)}};
+        if (i % 500 == 1) meta["rare"] = std::string("yes");
+        ASSERT_TRUE(db.add(static_cast<VectorId>(i), v, meta));
+    }
+    for (int i = 0; i < 100; ++i) ASSERT_TRUE(db.remove(static_cast<VectorId>(i * 20)));
+
+    IndexStats stats = db.stats();
+    EXPECT_EQ(stats.vectors, 1900u);
+    EXPECT_EQ(stats.graph_nodes, 2000u);
+    EXPECT_EQ(stats.tombstones, 100u);
+    EXPECT_DOUBLE_EQ(stats.tombstone_fraction, 0.05);
+    EXPECT_LT(stats.unreachable, 20u);
+    ASSERT_FALSE(stats.level_counts.empty());
+    EXPECT_EQ(stats.entry_point_level, int(stats.level_counts.size()) - 1);
+    EXPECT_GT(stats.level_counts[0], stats.level_counts.back());
+    uint64_t nodes = 0;
+    for (uint64_t c : stats.level_counts) nodes += c;
+    EXPECT_EQ(nodes, 2000u);
+    ASSERT_EQ(stats.degree_histograms.size(), stats.level_counts.size());
+    uint64_t level0 = 0;
+    for (uint64_t c : stats.degree_histograms[0]) level0 += c;
+    EXPECT_EQ(level0, 2000u);
+    EXPECT_LE(stats.degree_histograms[0].size(), size_t(stats.max_links0) + 1);
+    EXPECT_EQ(stats.postings.at("bucket").values, 10u);
+    EXPECT_EQ(stats.postings.at("bucket").total, 1900u);
+    EXPECT_EQ(stats.postings.at("bucket").smallest, 100u); // the removed ids were all in bucket 0
+    EXPECT_EQ(stats.postings.at("rare").total, 4u);
+    EXPECT_EQ(stats.postings.at("rare").size_histogram, std::vector<uint64_t>({0, 0, 1}));
+
+    // the same figures straight from the file
+    ASSERT_TRUE(db.save());
+    auto inspected = Database::inspect(tmp.string());
+    ASSERT_TRUE(inspected.has_value());
+    EXPECT_EQ(inspected->vectors, stats.vectors);
+    EXPECT_EQ(inspected->graph_nodes, stats.graph_nodes);
+    EXPECT_EQ(inspected->tombstones, stats.tombstones);
+    EXPECT_EQ(inspected->unreachable, stats.unreachable);
+    EXPECT_EQ(inspected->entry_point_level, stats.entry_point_level);
+    EXPECT_EQ(inspected->max_links, stats.max_links);
+    EXPECT_EQ(inspected->level_counts, stats.level_counts);
+    EXPECT_EQ(inspected->degree_histograms, stats.degree_histograms);
+    EXPECT_EQ(inspected->postings.at("bucket").size_histogram, stats.postings.at("bucket").size_histogram);
+    EXPECT_EQ(inspected->postings.at("rare").total, 4u);
+    EXPECT_FALSE(Database::inspect((fs::temp_directory_path() / "orion_missing.bin").string()).has_value());
+
+    fs::remove(tmp, ec);
+}
+
+TEST(BulkTools, AddBatchForEachCompactAndVerify)
+{
+    fs::path tmp = fs::temp_directory_path() / "orion_test_db25.bin";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 16;
+    // starts small so the batch has to grow the graph
+    auto created = Database::create(tmp.string(), Config(dim, 100));
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+    std::mt19937 rng(25);
+    std::normal_distribution<float> gauss;
+    std::vector<VectorId> ids;
+    std::vector<Vector> vectors;
+    std::vector<Metadata> metas;
+    for (int i = 0; i < 1500; ++i) {
+        Vector v(dim);
+        for (auto &x : v) x = gauss(rng);
+        ids.push_back(static_cast<VectorId>(i));
+        vectors.push_back(v);
+        metas.push_back({{"parity", int64_t(i % 2)}});
+    }
+    // a repeated id keeps its last vector
+    ids.push_back(7);
+    vectors.push_back(vectors[8]);
+    metas.push_back({{"parity", int64_t(2)}});
+    ASSERT_TRUE(db.add_batch(ids, vectors, metas));
+    EXPECT_FALSE(db.add_batch({1}, {Vector(dim - 1)}));
+    EXPECT_EQ(db.count(), 1500u);
+    EXPECT_EQ(db.get(7)->first, vectors[8]);
+    EXPECT_EQ(std::get<int64_t>(db.get(7)->second.at("parity")), 2);
+
+    size_t found = 0;
+    for (size_t i = 0; i < 1500; i += 10) {
+        auto results = db.query(vectors[i], 1);
+        found += !results.empty() && results[0].id == i;
+    }
+    EXPECT_GE(found, 145u);
+
+    // updates through the batch path replace the node in place
+    ASSERT_TRUE(db.add_batch({3, 5000}, {vectors[4], vectors[5]}));
+    EXPECT_EQ(db.count(), 1501u);
+    EXPECT_TRUE(db.get(3)->second.empty());
+
+    std::vector<VectorId> visited;
+    db.for_each([&](VectorId id, const Vector &vec, const Metadata &) {
+        if (id == 3) {
+            EXPECT_EQ(vec, vectors[4]);
+        }
+        visited.push_back(id);
+        return visited.size() < 1000;
+    });
+    EXPECT_EQ(visited.size(), 1000u);
+    EXPECT_TRUE(std::is_sorted(visited.begin(), visited.end()));
+
+    for (VectorId id = 0; id < 300; ++id) ASSERT_TRUE(db.remove(id));
+    EXPECT_EQ(db.stats().tombstones, 300u);
+    ASSERT_TRUE(db.compact());
+    EXPECT_EQ(db.stats().tombstones, 0u);
+    EXPECT_EQ(db.count(), 1201u);
+    EXPECT_EQ(db.query(vectors[600], 1)[0].id, 600u);
+
+    ASSERT_TRUE(db.save());
+    EXPECT_TRUE(Database::verify(tmp.string()));
+    // flip one byte in the middle of the file
+    {
+        std::fstream f(tmp, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekg(fs::file_size(tmp) / 2);
+        char c = 0;
+        f.read(&c, 1);
+        c ^= 0x10;
+        f.seekp(fs::file_size(tmp) / 2);
+        f.write(&c, 1);
+    }
+    EXPECT_FALSE(Database::verify(tmp.string()));
+    EXPECT_FALSE(Database::verify((fs::temp_directory_path() / "orion_missing.bin").string()));
+
+    fs::remove(tmp, ec);
+}
+
+// a version 1 .npy file of float32 rows whose header claims dtype descr
+// and, if given, claimed_rows rows
+static void write_npy(const fs::path &path, const std::vector<Vector> &rows, size_t dim, const std::string &descr = "<f4",
+                      std::optional<uint64_t> claimed_rows = std::nullopt)
+{
+    std::string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" +
+                         std::to_string(claimed_rows.value_or(rows.size())) + ", " + std::to_string(dim) + "), }";
+    header.resize((header.size() + 11 + 63) / 64 * 64 - 11, ' ');
+    header += '\n';
+    std::ofstream out(path, std::ios::binary);
+    out.write("\x93NUMPY\x01\x00", 8);
+    const uint16_t size = uint16_t(header.size());
+    out.write(reinterpret_cast<const char *>(&size), 2);
+    out << header;
+    for (const Vector &row : rows) out.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(float));
+}
+
+TEST(Import, MapsNpyAndFvecsWithIdsAndMetadata)
+{
+    const fs::path dir = fs::temp_directory_path();
+    fs::path tmp = dir / "orion_test_db26.bin";
+    const fs::path npy = dir / "orion_test_db26.npy", fvecs = dir / "orion_test_db26.fvecs", ids = dir / "orion_test_db26.ids",
+                   meta = dir / "orion_test_db26.jsonl";
+    std::error_code ec;
+    fs::remove(tmp, ec);
+
+    const uint32_t dim = 8;
+    std::mt19937 rng(26);
+    std::normal_distribution<float> gauss;
+    std::vector<Vector> rows(600, Vector(dim));
+    for (auto &row : rows)
+        for (auto &x : row) x = gauss(rng);
+    write_npy(npy, rows, dim);
+    {
+        std::ofstream id_out(ids), meta_out(meta), fvecs_out(fvecs, std::ios::binary);
+        for (size_t i = 0; i < rows.size(); ++i) {
+            id_out << 10 * i << "\n";
+            meta_out << "{\"name\": \"row " << i << "\", \"score\": " << i << ".5, \"even\": " << (i % 2 ? "false" : "true") << "}\n";
+            const int32_t d = dim;
+            fvecs_out.write(reinterpret_cast<const char *>(&d), sizeof(d));
+            fvecs_out.write(reinterpret_cast<const char *>(rows[i].data()), dim * sizeof(float));
+        }
+    }
+
+    auto created = Database::create(tmp.string(), Config(dim, 100));
+    ASSERT_TRUE(created.has_value());
+    Database db = std::move(created.value());
+    ImportOptions options;
+    options.ids_path = ids.string();
+    options.metadata_path = meta.string();
+    ASSERT_TRUE(db.import_npy(npy.string(), options));
+    EXPECT_EQ(db.count(), 600u);
+    auto got = db.get(10 * 123);
+    ASSERT_TRUE(got.has_value());
+    EXPECT_EQ(got->first, rows[123]);
+    EXPECT_EQ(std::get<std::string>(got->second.at("name")), "row 123");
+    EXPECT_DOUBLE_EQ(std::get<double>(got->second.at("score")), 123.5);
+    EXPECT_EQ(std::get<int64_t>(got->second.at("even")), 0);
+    EXPECT_EQ(db.query(rows[42], 1)[0].id, 420u);
+
+    ImportOptions offset;
+    offset.id_start = 100000;
+    ASSERT_TRUE(db.import_fvecs(fvecs.string(), offset));
+    EXPECT_EQ(db.count(), 1200u);
+    EXPECT_EQ(db.get(100000 + 599)->first, rows[599]);
+    EXPECT_TRUE(db.get(100000 + 599)->second.empty());
+
+    // shape, dtype and id count are checked before anything is added
+    write_npy(npy, rows, dim, "<f8");
+    EXPECT_FALSE(db.import_npy(npy.string()));
+    // 2^62 rows of 32 bytes: the size check must not wrap around to 0
+    write_npy(npy, rows, dim, "<f4", uint64_t(1) << 62);
+    EXPECT_FALSE(db.import_npy(npy.string()));
+    std::vector<Vector> wide(10, Vector(dim + 1, 1.0f));
+    write_npy(npy, wide, dim + 1);
+    EXPECT_FALSE(db.import_npy(npy.string()));
+    EXPECT_FALSE(db.import_fvecs(npy.string()));
+    write_npy(npy, std::vector<Vector>(rows.begin(), rows.begin() + 10), dim);
+    EXPECT_FALSE(db.import_npy(npy.string(), options));
+    // an ids .npy claiming 2^61 entries of 8 bytes
+    {
+        std::ofstream id_out(ids, std::ios::binary);
+        std::string header = "{'descr': '<i8', 'fortran_order': False, 'shape': (" + std::to_string(uint64_t(1) << 61) + ",), }";
+        header.resize((header.size() + 11 + 63) / 64 * 64 - 11, ' ');
+        header += '\n';
+        const uint16_t size = uint16_t(header.size());
+        id_out.write("\x93NUMPY\x01\x00", 8);
+        id_out.write(reinterpret_cast<const char *>(&size), 2);
+        id_out << header;
+        const int64_t id = 7;
+        id_out.write(reinterpret_cast<const char *>(&id), sizeof(id));
+    }
+    EXPECT_FALSE(db.import_npy(npy.string(), options));
+    EXPECT_FALSE(db.import_npy((dir / "orion_missing.npy").string()));
+    EXPECT_EQ(db.count(), 1200u);
+    ASSERT_TRUE(db.import_npy(npy.string()));
+    EXPECT_EQ(db.count(), 1209u); // id 0 came from the ids file and is replaced
+    EXPECT_TRUE(db.get(0)->second.empty());
+
+    for (const auto &path : {tmp, npy, fvecs, ids, meta}) fs::remove(path, ec);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-}
\ No newline at end of file
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "orion/database.h"
+
+// File formats of the orion tool: float32 matrices as .npy (C order, '<f4')
+// or .fvecs (each row an int32 dimension followed by the floats), and
+// metadata as JSON Lines holding one flat object per vector. Imports go
+// through Database::import_npy() / import_fvecs(), which map the file.
+
+static bool has_suffix(const std::string &path, const std::string &suffix)
+{
+    return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// reads rows of a .npy or .fvecs file in order
+class MatrixReader {
+public:
+    bool open(const std::string &path)
+    {
+        in_.open(path, std::ios::binary | std::ios::ate);
+        if (!in_) {
+            std::cerr << "Cannot open " << path << "\n";
+            return false;
+        }
+        const uint64_t size = static_cast<uint64_t>(in_.tellg());
+        in_.seekg(0);
+        fvecs_ = has_suffix(path, ".fvecs");
+        if (fvecs_) {
+            int32_t dim = 0;
+            if (!in_.read(reinterpret_cast<char *>(&dim), sizeof(dim)) || dim <= 0 || size % (4 + 4 * uint64_t(dim)) != 0) {
+                std::cerr << path << " is not an fvecs file\n";
+                return false;
+            }
+            dim_ = uint32_t(dim);
+            rows_ = size / (4 + 4 * uint64_t(dim));
+            in_.seekg(0);
+            return true;
+        }
+        if (!read_npy_header(path))
+            return false;
+        // divided rather than multiplied, so a huge row count cannot wrap around
+        const uint64_t data_start = uint64_t(in_.tellg());
+        if (size < data_start || rows_ > (size - data_start) / (uint64_t(dim_) * 4)) {
+            std::cerr << path << " is truncated\n";
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t rows() const { return rows_; }
+    uint32_t dim() const { return dim_; }
+
+    // the next count rows (fewer at the end)
+    bool read(size_t count, std::vector<orion::Vector> &out)
+    {
+        out.clear();
+        for (; count > 0 && next_ < rows_; --count, ++next_) {
+            if (fvecs_) {
+                int32_t dim = 0;
+                in_.read(reinterpret_cast<char *>(&dim), sizeof(dim));
+                if (uint32_t(dim) != dim_) {
+                    std::cerr << "Row " << next_ << " has dimension " << dim << "\n";
+                    return false;
+                }
+            }
+            orion::Vector &row = out.emplace_back(dim_);
+            if (!in_.read(reinterpret_cast<char *>(row.data()), std::streamsize(dim_) * 4))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    bool read_npy_header(const std::string &path)
+    {
+        char magic[8];
+        if (!in_.read(magic, 8) || std::memcmp(magic, "\x93NUMPY", 6) != 0) {
+            std::cerr << path << " is not an npy file\n";
+            return false;
+        }
+        uint32_t header_size = 0;
+        if (magic[6] == 1) {
+            uint16_t size16 = 0;
+            in_.read(reinterpret_cast<char *>(&size16), 2);
+            header_size = size16;
+        } else {
+            in_.read(reinterpret_cast<char *>(&header_size), 4);
+        }
+        std::string header(header_size, '\0');
+        if (!in_.read(header.data(), header_size))
+            return false;
+        const auto shape = parse_npy_shape(header);
+        if (header.find("'<f4'") == std::string::npos || header.find("'fortran_order': False") == std::string::npos || !shape) {
+            std::cerr << path << ": only C-order float32 ('<f4') matrices are supported\n";
+            return false;
+        }
+        rows_ = shape->first;
+        dim_ = uint32_t(shape->second);
+        return true;
+    }
+
+    // (rows, columns) of a two-dimensional 'shape' entry
+    static std::optional<std::pair<uint64_t, uint64_t>> parse_npy_shape(const std::string &header)
+    {
+        size_t pos = header.find("'shape':");
+        if (pos == std::string::npos || (pos = header.find('(', pos)) == std::string::npos)
+            return std::nullopt;
+        std::vector<uint64_t> dims;
+        const char *p = header.c_str() + pos + 1;
+        const char *end = header.c_str() + header.size();
+        while (p < end && *p != ')') {
+            uint64_t value = 0;
+            auto [next, ec] = std::from_chars(p, end, value);
+            if (ec == std::errc()) {
+                dims.push_back(value);
+                p = next;
+            } else {
+                ++p;
+            }
+        }
+        if (dims.size() != 2 || dims[1] == 0 || dims[1] > UINT32_MAX)
+            return std::nullopt;
+        return std::make_pair(dims[0], dims[1]);
+    }
+
+    std::ifstream in_;
+    bool fvecs_ = false;
+    uint64_t rows_ = 0;
+    uint64_t next_ = 0;
+    uint32_t dim_ = 0;
+};
+
+// writes rows to a .npy or .fvecs file; the npy shape is filled in by close()
+class MatrixWriter {
+public:
+    bool open(const std::string &path, uint32_t dim)
+    {
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        fvecs_ = has_suffix(path, ".fvecs");
+        dim_ = dim;
+        if (!fvecs_)
+            write_npy_header();
+        return bool(out_);
+    }
+
+    void write(const orion::Vector &row)
+    {
+        if (fvecs_) {
+            const int32_t dim = int32_t(row.size());
+            out_.write(reinterpret_cast<const char *>(&dim), sizeof(dim));
+        }
+        out_.write(reinterpret_cast<const char *>(row.data()), std::streamsize(row.size()) * 4);
+        ++rows_;
+    }
+
+    bool close()
+    {
+        if (!fvecs_) {
+            out_.seekp(0);
+            write_npy_header();
+        }
+        out_.close();
+        return !out_.fail();
+    }
+
+private:
+    // version 1 header padded to a fixed 128 bytes so it can be rewritten
+    void write_npy_header()
+    {
+        std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + std::to_string(rows_) + ", " +
+                             std::to_string(dim_) + "), }";
+        header.resize(128 - 10 - 1, ' ');
+        header += '\n';
+        const uint16_t size = uint16_t(header.size());
+        out_.write("\x93NUMPY\x01\x00", 8);
+        out_.write(reinterpret_cast<const char *>(&size), 2);
+        out_.write(header.data(), std::streamsize(header.size()));
+    }
+
+    std::ofstream out_;
+    bool fvecs_ = false;
+    uint64_t rows_ = 0;
+    uint32_t dim_ = 0;
+};
+
+static void write_json_string(std::ostream &out, const std::string &s)
+{
+    out << '"';
+    for (char c : s) {
+        switch (c) {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        case '\r': out << "\\r"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out << buf;
+            } else {
+                out << c;
+            }
+        }
+    }
+    out << '"';
+}
+
+// {"id": id, ...meta}; doubles keep a '.' or exponent so they read back as doubles
+static void write_json_line(std::ostream &out, orion::VectorId id, const orion::Metadata &meta)
+{
+    out << "{\"id\": " << id;
+    for (const auto &[key, value] : meta) {
+        out << ", ";
+        write_json_string(out, key);
+        out << ": ";
+        if (const auto *s = std::get_if<std::string>(&value)) {
+            write_json_string(out, *s);
+        } else if (const auto *n = std::get_if<int64_t>(&value)) {
+            out << *n;
+        } else {
+            char buf[32];
+            auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), std::get<double>(value));
+            std::string text(buf, end);
+            if (text.find_first_of(".en") == std::string::npos)
+                text += ".0";
+            out << text;
+        }
+    }
+    out << "}\n";
+}
@@ -0,0 +1,19 @@
+#include <iostream>
+#include "orion/database.h"
+#include "print_stats.h"
+
+// Usage: orion_inspect <db file>
+// Prints graph shape, tombstones and posting-list sizes of a database file
+// without loading it (Database::inspect()).
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <db file>\n";
+        return 2;
+    }
+    auto stats = orion::Database::inspect(argv[1]);
+    if (!stats) return 1;
+    print_stats(*stats);
+    return 0;
+}
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "orion/database.h"
+#include "formats.h"
+#include "print_stats.h"
+
+// Usage: orion <command> <db file> [args]
+//   import  <db> <vectors.npy|.fvecs> [--meta meta.jsonl] [--ids ids.npy|ids.txt] [--id-start N] [--metric l2|ip]
+//   export  <db> <vectors.npy|.fvecs> [--meta meta.jsonl]
+//   stats   <db>
+//   verify  <db>
+//   compact <db>
+//   bench   <db> <queries.npy|.fvecs> [-k N] [--ef N] [--recall N]
+// import creates the database when the file does not exist and appends to it
+// otherwise. Row i gets id start + i (or line i of --ids) unless its metadata
+// line has an integer "id"; export writes that "id" back.
+
+static const char *kUsage =
+    "Usage: orion <command> <db file> [args]\n"
+    "  import  <db> <vectors.npy|.fvecs> [--meta meta.jsonl] [--ids ids.npy|ids.txt] [--id-start N] [--metric l2|ip]\n"
+    "  export  <db> <vectors.npy|.fvecs> [--meta meta.jsonl]\n"
+    "  stats   <db>\n"
+    "  verify  <db>\n"
+    "  compact <db>\n"
+    "  bench   <db> <queries.npy|.fvecs> [-k N] [--ef N] [--recall N]\n";
+
+// positional arguments and --name value options
+struct Args {
+    std::vector<std::string> positional;
+    std::map<std::string, std::string> options;
+
+    std::string get(const std::string &name, const std::string &fallback = "") const
+    {
+        auto it = options.find(name);
+        return it == options.end() ? fallback : it->second;
+    }
+    uint64_t number(const std::string &name, uint64_t fallback) const
+    {
+        auto it = options.find(name);
+        return it == options.end() ? fallback : std::strtoull(it->second.c_str(), nullptr, 10);
+    }
+};
+
+static bool parse_args(int argc, char **argv, Args &args)
+{
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.size() > 1 && arg[0] == '-') {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return false;
+            }
+            args.options[arg] = argv[++i];
+        } else {
+            args.positional.push_back(arg);
+        }
+    }
+    return true;
+}
+
+static int import_command(const Args &args)
+{
+    if (args.positional.size() != 2) {
+        std::cerr << kUsage;
+        return 2;
+    }
+    const std::string &db_path = args.positional[0];
+    const std::string &matrix_path = args.positional[1];
+    // only the header, for the dimension of a new database
+    MatrixReader reader;
+    if (!reader.open(matrix_path)) return 1;
+
+    std::optional<orion::Database> db;
+    if (std::filesystem::exists(db_path)) {
+        db = orion::Database::load(db_path);
+    } else {
+        orion::Config config(reader.dim(), std::max<uint64_t>(reader.rows(), 1));
+        config.metric = args.get("--metric", "l2") == "ip" ? orion::Metric::InnerProduct : orion::Metric::L2;
+        db = orion::Database::create(db_path, config);
+    }
+    if (!db) return 1;
+
+    orion::ImportOptions options;
+    options.id_start = args.number("--id-start", 0);
+    options.ids_path = args.get("--ids");
+    options.metadata_path = args.get("--meta");
+    const size_t before = db->count();
+    const auto start = std::chrono::steady_clock::now();
+    const bool ok = has_suffix(matrix_path, ".fvecs") ? db->import_fvecs(matrix_path, options) : db->import_npy(matrix_path, options);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!ok || !db->save()) return 1;
+    std::cout << "imported " << reader.rows() << " vectors in " << seconds << " s ("
+              << double(reader.rows()) / std::max(seconds, 1e-9) << " vectors/s), " << db->count() - before << " new, "
+              << db->count() << " stored\n";
+    return 0;
+}
+
+static int export_command(const Args &args)
+{
+    if (args.positional.size() != 2) {
+        std::cerr << kUsage;
+        return 2;
+    }
+    auto db = orion::Database::load(args.positional[0]);
+    if (!db) return 1;
+    std::ofstream meta_out;
+    if (!args.get("--meta").empty()) {
+        meta_out.open(args.get("--meta"), std::ios::trunc);
+        if (!meta_out) {
+            std::cerr << "Cannot open " << args.get("--meta") << "\n";
+            return 1;
+        }
+    }
+    MatrixWriter writer;
+    bool opened = false, ok = true;
+    uint64_t rows = 0;
+    db->for_each([&](orion::VectorId id, const orion::Vector &vec, const orion::Metadata &meta) {
+        if (!opened) {
+            opened = true;
+            ok = writer.open(args.positional[1], uint32_t(vec.size()));
+        }
+        if (!ok) return false;
+        writer.write(vec);
+        if (meta_out.is_open()) write_json_line(meta_out, id, meta);
+        ++rows;
+        return true;
+    });
+    // an empty database still gets a (0, 0) matrix
+    if (!opened) ok = writer.open(args.positional[1], 0);
+    if (!ok || !writer.close() || (meta_out.is_open() && !meta_out.flush())) {
+        std::cerr << "Failed to write " << args.positional[1] << "\n";
+        return 1;
+    }
+    std::cout << "exported " << rows << " vectors\n";
+    return 0;
+}
+
+static int compact_command(const Args &args)
+{
+    auto db = orion::Database::load(args.positional[0]);
+    if (!db) return 1;
+    const auto before = db->stats();
+    if (!db->compact() || !db->save()) return 1;
+    std::cout << "dropped " << before.tombstones << " removed vectors, " << db->count() << " stored\n";
+    return 0;
+}
+
+static int bench_command(const Args &args)
+{
+    if (args.positional.size() != 2) {
+        std::cerr << kUsage;
+        return 2;
+    }
+    auto db = orion::Database::load(args.positional[0]);
+    if (!db) return 1;
+    MatrixReader reader;
+    std::vector<orion::Vector> queries;
+    if (!reader.open(args.positional[1]) || !reader.read(reader.rows(), queries)) return 1;
+    if (queries.empty()) {
+        std::cerr << "No queries in " << args.positional[1] << "\n";
+        return 1;
+    }
+    const size_t k = args.number("-k", 10);
+    orion::QueryOptions options;
+    options.ef = uint32_t(args.number("--ef", 0));
+
+    std::vector<double> latencies;
+    std::vector<std::vector<orion::QueryResult>> results;
+    latencies.reserve(queries.size());
+    results.reserve(queries.size());
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto &q : queries) {
+        const auto t0 = std::chrono::steady_clock::now();
+        results.push_back(db->query(q, k, {}, options));
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, size_t(p * double(latencies.size())))]; };
+    std::cout << queries.size() << " queries, k=" << k << ": " << double(queries.size()) / seconds << " QPS, p50 "
+              << percentile(0.50) << " us, p99 " << percentile(0.99) << " us\n";
+
+    // recall against exact search on the first N queries
+    const size_t checked = std::min<size_t>(args.number("--recall", 100), queries.size());
+    if (checked > 0) {
+        orion::QueryOptions exact;
+        exact.strategy = orion::SearchStrategy::Exact;
+        const std::vector<orion::Vector> sample(queries.begin(), queries.begin() + checked);
+        const auto truth = db->query_batch(sample, k, {}, exact);
+        size_t hits = 0, total = 0;
+        for (size_t i = 0; i < checked; ++i) {
+            std::set<orion::VectorId> expected;
+            for (const auto &r : truth[i]) expected.insert(r.id);
+            for (const auto &r : results[i]) hits += expected.count(r.id);
+            total += expected.size();
+        }
+        std::cout << "recall@" << k << " over " << checked << " queries: " << (total ? double(hits) / double(total) : 1.0) << "\n";
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    Args args;
+    if (argc < 3 || !parse_args(argc, argv, args) || args.positional.empty()) {
+        std::cerr << kUsage;
+        return 2;
+    }
+    const std::string command = argv[1];
+    if (command == "import") return import_command(args);
+    if (command == "export") return export_command(args);
+    if (command == "bench") return bench_command(args);
+    if (command == "compact") return compact_command(args);
+    if (command == "verify") {
+        const bool ok = orion::Database::verify(args.positional[0]);
+        std::cout << (ok ? "ok\n" : "FAILED\n");
+        return ok ? 0 : 1;
+    }
+    if (command == "stats") {
+        auto stats = orion::Database::inspect(args.positional[0]);
+        if (!stats) return 1;
+        print_stats(*stats);
+        return 0;
+    }
+    std::cerr << kUsage;
+    return 2;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "orion/database.h"
+
+// IndexStats as printed by orion_inspect and `orion stats`
+
+static void print_histogram(const std::string &label, const std::vector<uint64_t> &counts, bool powers_of_two)
+{
+    std::cout << label;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] == 0) continue;
+        std::cout << "  ";
+        if (powers_of_two)
+            std::cout << (uint64_t(1) << i) << "+";
+        else
+            std::cout << i;
+        std::cout << ":" << counts[i];
+    }
+    std::cout << "\n";
+}
+
+static void print_stats(const orion::IndexStats &stats)
+{
+    std::cout << "vectors: " << stats.vectors << "\n";
+    if (stats.graph_nodes > 0) {
+        std::cout << "graph nodes: " << stats.graph_nodes << " (M=" << stats.max_links << ", level-0 capacity "
+                  << stats.max_links0 << ")\n";
+        std::cout << "tombstones: " << stats.tombstones << " (" << stats.tombstone_fraction * 100.0 << "%)\n";
+        std::cout << "unreachable live nodes: " << stats.unreachable << "\n";
+        std::cout << "entry point level: " << stats.entry_point_level << "\n";
+        print_histogram("nodes by top level:", stats.level_counts, false);
+        for (size_t l = 0; l < stats.degree_histograms.size(); ++l)
+            print_histogram("degree histogram, level " + std::to_string(l) + ":", stats.degree_histograms[l], false);
+    }
+    if (!stats.ivf_list_sizes.empty()) {
+        uint64_t largest = 0, total = 0;
+        for (uint64_t size : stats.ivf_list_sizes) {
+            largest = std::max(largest, size);
+            total += size;
+        }
+        std::cout << "ivf lists: " << stats.ivf_list_sizes.size() << " (mean " << double(total) / double(stats.ivf_list_sizes.size())
+                  << ", largest " << largest << ")\n";
+    }
+    for (const auto &[key, postings] : stats.postings) {
+        std::cout << "metadata key '" << key << "': " << postings.values << " values, " << postings.total << " ids, lists "
+                  << postings.smallest << ".." << postings.largest << "\n";
+        print_histogram("  list sizes:", postings.size_histogram, true);
+    }
+}